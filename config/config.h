@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+
+ * this header is generated by the configuration script, see scripts/config.py
+
+ * to edit the configuration, edit the .config file (can be generated by make config)
+ * and run the make command again to regenerate this file
+
+*/
+
+// Enable the debug messages
+#define CONFIG_DEBUG (1)
+
+// Run the boot time benchmarks
+#define CONFIG_BENCH (0)
+
+// Max allowed open files per task
+#define CONFIG_TASK_FILES_MAX (32)
+
+// Default stack size for the task in pages
+#define CONFIG_TASK_STACK_PAGES (4)
+
+// Max size the user stack of the task can grow to in pages
+#define CONFIG_TASK_STACK_MAX (2048)
+
+// Max size the heap (program break) of the task can grow to in pages
+#define CONFIG_TASK_HEAP_MAX (65536)
+
+// Size of the pre-zeroed page pool in pages
+#define CONFIG_MM_ZERO_PAGES (64)
+
+// GPT partioning support
+#define CONFIG_CORE_GPT (1)
+
+// Frequency of the timer tick in Hz
+#define CONFIG_CORE_TIMER_HZ (1000)
+
+// FAT32 filesystem support
+#define CONFIG_FS_FAT32 (1)
+
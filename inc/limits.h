@@ -7,7 +7,7 @@
 #define NAME_MAX  (255)
 #define ARG_MAX   (PAGE_SIZE)
 #define ENV_MAX   (INT32_MAX)
-#define SIG_MAX   (SIGSEGV)
+#define SIG_MAX   (SIGALRM)
 #define SIG_MIN   (SIGHUP)
 #define PID_MAX   (INT32_MAX)
 #define FD_MAX    (UINT8_MAX)
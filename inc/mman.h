@@ -0,0 +1,14 @@
+#pragma once
+
+// memory protection flags (see mmap() and mprotect())
+#define PROT_NONE  (0)      // pages cannot be accessed
+#define PROT_READ  (1)      // pages can be read
+#define PROT_WRITE (1 << 1) // pages can be written
+#define PROT_EXEC  (1 << 2) // pages can be executed
+
+// mapping flags (see mmap())
+#define MAP_SHARED    (1)      // changes are shared with other processes (not supported)
+#define MAP_PRIVATE   (1 << 1) // changes are private to the process
+#define MAP_FIXED     (1 << 4) // place the mapping exactly at the given address
+#define MAP_ANONYMOUS (1 << 5) // mapping is not backed by a file, it's filled with zeros
+#define MAP_ANON      MAP_ANONYMOUS
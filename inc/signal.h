@@ -5,6 +5,7 @@
 #define SIGILL  (3) // illegal instruction
 #define SIGKILL (4) // kill
 #define SIGSEGV (5) // segmentation violation
+#define SIGALRM (6) // alarm clock (see alarm())
 
 #define SIG_DFL ((void *)0) // use the default handler
 #define SIG_IGN ((void *)1) // ignore the signal
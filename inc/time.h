@@ -0,0 +1,14 @@
+#pragma once
+#include "types.h"
+
+// clocks for clock_gettime()
+#define CLOCK_REALTIME  (0) // wall clock time since the UNIX epoch
+#define CLOCK_MONOTONIC (1) // time since the boot, never goes back
+
+typedef int32_t clockid_t;
+
+// time value with nanosecond resolution (see nanosleep() and clock_gettime())
+struct timespec {
+  int64_t tv_sec;  // seconds
+  int64_t tv_nsec; // nanoseconds (0 - 999999999)
+};
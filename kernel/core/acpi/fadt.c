@@ -74,7 +74,10 @@ struct fadt {
   acpi_gas_t x_pm_timer_block;
   acpi_gas_t x_gpe0_block;
   acpi_gas_t x_gpe1_block;
-};
+} __attribute__((packed));
+
+// 5.2.9 Fixed ACPI Description Table Fixed Feature Flags
+#define FADT_FLAG_TMR_VAL_EXT (8) // PM timer is 32 bits (24 bits otherwise)
 
 // 5.2.9.3 IA-PC Boot Architecture Flags
 enum {
@@ -98,3 +101,38 @@ bool acpi_supports_8042_ps2() {
   // otherwise we check the "8042" field of the IA-PC boot flags
   return bit_get(fadt->iapc_boot_arch, IAPC_BOOT_8042);
 }
+
+bool acpi_supports_cmos_rtc() {
+  struct fadt *fadt    = acpi_find(FADT_SIG, sizeof(struct fadt));
+  int32_t      version = acpi_version();
+
+  // same as the 8042, it's present if we can't check it
+  if (version < ACPI_VERSION_2 || NULL == fadt)
+    return true;
+
+  return !bit_get(fadt->iapc_boot_arch, IAPC_BOO_CMOS_RTC_NOT_PRESENT);
+}
+
+uint16_t acpi_pm_timer(bool *ext) {
+  struct fadt *fadt = acpi_find(FADT_SIG, sizeof(struct fadt));
+
+  // port address is zero if the PM timer is not supported
+  if (NULL == fadt || NULL == ext)
+    return 0;
+
+  *ext = bit_get(fadt->flags, FADT_FLAG_TMR_VAL_EXT);
+
+  // prefer the GAS structured address, if it's available and it's a port
+  if (acpi_version() >= ACPI_VERSION_2 && fadt->x_pm_timer_block.addr != 0 &&
+      fadt->x_pm_timer_block.addr_space == ACPI_GAS_IO)
+    return fadt->x_pm_timer_block.addr;
+
+  return fadt->pm_timer_block;
+}
+
+uint8_t acpi_century() {
+  struct fadt *fadt = acpi_find(FADT_SIG, sizeof(struct fadt));
+
+  // CMOS RTC index of the century register (zero if there is none)
+  return NULL == fadt ? 0 : fadt->century;
+}
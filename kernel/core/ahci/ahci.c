@@ -1,6 +1,10 @@
 #include "core/ahci.h"
 #include "core/disk.h"
 #include "core/pci.h"
+#include "core/pic.h"
+#include "core/im.h"
+
+#include "sched/sched.h"
 
 #include "util/bit.h"
 #include "util/mem.h"
@@ -103,6 +107,53 @@ struct ahci_protocol_func ahci_protocol_funcs[] = {
     {.func = NULL},
 };
 
+// HBAs that use interrupts, and the tasks waiting for their commands to complete
+ahci_mem_t *ahci_hbas[AHCI_HBA_MAX];
+waitq_t     ahci_waitq = {NULL, NULL};
+
+// HBA interrupt handler, clears the interrupt status and wakes up the waiting tasks
+void __ahci_handler(im_stack_t *stack) {
+  ahci_mem_t *hba = NULL;
+  uint32_t    is  = 0;
+
+  for (uint8_t i = 0; i < AHCI_HBA_MAX && NULL != (hba = ahci_hbas[i]); i++) {
+    if ((is = hba->is) == 0)
+      continue;
+
+    // clear the interrupt status of the ports, then the HBA
+    for (uint8_t p = 0; p < sizeof(hba->pi) * 8; p++)
+      if (bit_get(is, p))
+        hba->ports[p].is = hba->ports[p].is;
+
+    hba->is = is;
+  }
+
+  // tasks check their own command slot
+  waitq_wake_all(&ahci_waitq);
+}
+
+// enable the HBA interrupts, if it's connected to a PIC IRQ
+void __ahci_irq_enable(pci_device_t *dev, ahci_mem_t *hba) {
+  uint8_t i = 0;
+
+  // 0xff means it's not connected, and the PIC only has 16 IRQs
+  if (dev->int_line >= 16)
+    return;
+
+  for (; i < AHCI_HBA_MAX && NULL != ahci_hbas[i]; i++)
+    ;
+
+  if (i >= AHCI_HBA_MAX)
+    return;
+
+  ahci_hbas[i] = hba;
+  im_add_handler(pic_to_int(dev->int_line), IM_HANDLER_PRIO_FIRST, __ahci_handler);
+  pic_unmask(dev->int_line);
+
+  bit_set(hba->ghc, AHCI_GHC_IE, 1);
+  ahci_debg("enabled interrupts for HBA 0x%p (IRQ %u)", hba, dev->int_line);
+}
+
 char *__ahci_port_protocol(ahci_port_data_t *data) {
   switch (data->protocol) {
   case AHCI_PROTOCOL_SATA:
@@ -152,23 +203,29 @@ int32_t ahci_init(pci_device_t *dev) {
   if (bit_get(base->cap2, AHCI_CAP2_BOH) == 1 && bit_get(base->bohc, AHCI_BOHC_OOS) != 1) {
     bit_set(base->bohc, AHCI_BOHC_OOS, 1);
 
-    while (bit_get(base->bohc, AHCI_BOHC_OOS) != 1 || bit_get(base->bohc, AHCI_BOHC_BOS) == 1)
-      continue;
+    // BIOS may take up to 2 seconds to finish the outstanding commands
+    if (!timer_wait(bit_get(base->bohc, AHCI_BOHC_OOS) == 1 && bit_get(base->bohc, AHCI_BOHC_BOS) == 0, AHCI_TIMEOUT * 2))
+      ahci_debg("BIOS did not release the HBA, taking it anyway");
   }
 
   // HBA reset (page 26 in da spec)
   bit_set(base->ghc, 0, 1);
 
-  while (bit_get(base->ghc, 0) == 1)
-    continue;
+  if (!timer_wait(bit_get(base->ghc, 0) == 0, AHCI_TIMEOUT)) {
+    ahci_fail("HBA reset timed out");
+    return -ETIMEDOUT;
+  }
 
   // enable AHCI
   bit_set(base->ghc, 31, 1);
 
   // disable interrupts & clear interrupt status
-  bit_set(base->ghc, 1, 0);
+  bit_set(base->ghc, AHCI_GHC_IE, 0);
   base->is = UINT32_MAX;
 
+  // enable interrupts, so the commands can block instead of polling (see ahci_cmd_issue())
+  __ahci_irq_enable(dev, base);
+
   ahci_info("HBA at 0x%p supports version %d.%d", base, (base->vs >> 16) & 0xFFFF, base->vs & 0xFFFF);
   ahci_info("enumerating %u ports", sizeof(base->ports) / sizeof(base->ports[0]));
 
@@ -217,11 +274,5 @@ int32_t ahci_init(pci_device_t *dev) {
     disk_part_scan(port_data->disk);
   }
 
-  // add interrupt handler
-  // im_add_handler(dev->int_line + PIC_VECTOR_OFFSET, ahci_handle_int);
-
-  // enable interrupts
-  // bit_set(base->ghc, 1, 1);
-
   return 0;
 }
@@ -56,6 +56,7 @@ int32_t ahci_atapi_port_read(ahci_port_data_t *data, uint64_t lba, uint64_t sect
   ahci_cmd_t cmd = {
       .vaddr     = data->vaddr,
       .port      = data->port,
+      .hba       = data->hba,
       .data      = buf,
       .data_size = sector_count * data->disk->sector_size,
       .fis_size  = sizeof(struct sata_fis_h2d),
@@ -111,9 +112,11 @@ int32_t ahci_atapi_port_write(ahci_port_data_t *data, uint64_t lba, uint64_t sec
   ahci_cmd_t cmd = {
       .vaddr     = data->vaddr,
       .port      = data->port,
+      .hba       = data->hba,
       .data      = buf,
       .data_size = sector_count * data->disk->sector_size,
       .fis_size  = sizeof(struct sata_fis_h2d),
+      .write     = true,
   };
 
   if ((err = ahci_cmd_setup(&cmd)) != 0) {
@@ -162,6 +165,7 @@ int32_t __ahci_atapi_port_inquiry(ahci_port_data_t *data) {
   ahci_cmd_t cmd = {
       .vaddr     = data->vaddr,
       .port      = data->port,
+      .hba       = data->hba,
       .data      = inquiry_data,
       .data_size = sizeof(inquiry_data),
       .fis_size  = sizeof(struct sata_fis_h2d),
@@ -212,6 +216,7 @@ int32_t __ahci_atapi_port_capacity(ahci_port_data_t *data) {
   ahci_cmd_t cmd = {
       .vaddr     = data->vaddr,
       .port      = data->port,
+      .hba       = data->hba,
       .data      = capacity_data,
       .data_size = sizeof(capacity_data),
       .fis_size  = sizeof(struct sata_fis_h2d),
@@ -251,6 +256,7 @@ int32_t __ahci_atapi_port_mode_sense(ahci_port_data_t *data) {
   ahci_cmd_t cmd = {
       .vaddr     = data->vaddr,
       .port      = data->port,
+      .hba       = data->hba,
       .data      = sense_data,
       .data_size = sizeof(sense_data),
       .fis_size  = sizeof(struct sata_fis_h2d),
@@ -1,4 +1,6 @@
 #include "core/ahci.h"
+#include "sched/sched.h"
+#include "mm/paging.h"
 #include "mm/vmm.h"
 
 #include "util/bit.h"
@@ -7,14 +9,39 @@
 #include "types.h"
 #include "errno.h"
 
+/*
+
+ * access every page of the data block, so they all get mapped if they are not
+ * mapped yet (demand paging), and if the device is going to modify the pages,
+ * they are written to as well, so they are not shared with another task anymore
+ * (copy-on-write), as the device ignores the page permissions
+
+ * this should be done before claiming a command slot, as loading a page may
+ * need to issue another command to read it from the disk
+
+*/
+void __ahci_cmd_touch(ahci_cmd_t *cmd) {
+  volatile uint8_t *pos = cmd->data, *end = cmd->data + cmd->data_size;
+
+  for (; pos < end; pos = (void *)vmm_align((uint64_t)pos + 1)) {
+    if (cmd->write)
+      (void)*pos;
+    else
+      *pos = *pos;
+  }
+}
+
 int32_t ahci_cmd_setup(ahci_cmd_t *cmd) {
   if (NULL == cmd)
     return -EINVAL;
 
-  uint64_t size = cmd->data_size;
+  uint64_t size = cmd->data_size, paddr = 0, cur = 0;
   void    *data = cmd->data;
   uint8_t  i    = 0;
 
+  // make sure all the pages of the data block are present
+  __ahci_cmd_touch(cmd);
+
   // clear the outputs
   cmd->slot   = -1;
   cmd->header = NULL;
@@ -51,37 +78,54 @@ int32_t ahci_cmd_setup(ahci_cmd_t *cmd) {
     return -EFAULT;
   }
 
-  cmd->header->cfl   = cmd->fis_size / sizeof(uint32_t);
-  cmd->header->prdtl = ahci_prdtl_from_size(size);
+  cmd->header->cfl = cmd->fis_size / sizeof(uint32_t);
 
   cmd->table = (void *)cmd->vaddr + (cmd->header->ctba - cmd->port->clb);
   bzero(cmd->table, sizeof(struct ahci_cmd_table));
 
-  // setup all the PRDs
-  for (i = 0; i < cmd->header->prdtl; i++) {
-    cmd->table->prdt[i].interrupt = 0; // don't send an interrupt when the data block transfer is completed
-    cmd->table->prdt[i].dba       = vmm_resolve(data); // set the data block base address
+  /*
+
+   * setup all the PRDs, the data block is only virtually contiguous, so every
+   * PRD points to a physically contiguous part of it, which may not be larger
+   * than the max data block size
 
-    // set the data block size (1 means 2, so we subtract one)
-    if (i == cmd->header->prdtl - 1)
-      // last PRD's data block size is calculated from left over sector count
-      cmd->table->prdt[i].dbc = size - 1;
-    else
-      // other PRD's just use the data block with the max size
-      cmd->table->prdt[i].dbc = AHCI_PRD_DATA_MAX - 1;
+  */
+  for (i = 0; size > 0; i++) {
+    if (i >= AHCI_PRDTL_MAX) {
+      ahci_debg("data block is too fragmented (%u bytes left)", size);
+      return -E2BIG;
+    }
 
-    data += AHCI_PRD_DATA_MAX; // the next buffer address
-    size -= AHCI_PRD_DATA_MAX; // left over size
+    paddr = vmm_resolve(data);
+
+    // find the end of the physically contiguous part
+    for (cur = PAGE_SIZE - (uint64_t)data % PAGE_SIZE; cur < size && cur < AHCI_PRD_DATA_MAX; cur += PAGE_SIZE)
+      if (vmm_resolve(data + cur) != paddr + cur)
+        break;
+
+    if (cur > size)
+      cur = size;
+
+    if (cur > AHCI_PRD_DATA_MAX)
+      cur = AHCI_PRD_DATA_MAX;
+
+    cmd->table->prdt[i].interrupt = 0;       // don't send an interrupt when the data block transfer is completed
+    cmd->table->prdt[i].dba       = paddr;   // set the data block base address
+    cmd->table->prdt[i].dbc       = cur - 1; // set the data block size (1 means 2, so we subtract one)
+
+    data += cur; // the next buffer address
+    size -= cur; // left over size
   }
 
+  cmd->header->prdtl = i;
   return 0;
 }
 
 // issues a command and waits for it to complete
 int32_t ahci_cmd_issue(ahci_cmd_t *cmd) {
   // check if the port is busy, if so wait till it's not
-  while (ahci_port_is_busy(cmd->port))
-    continue;
+  if (!timer_wait(!ahci_port_is_busy(cmd->port), AHCI_TIMEOUT))
+    return -ETIMEDOUT;
 
   /*
 
@@ -93,11 +137,19 @@ int32_t ahci_cmd_issue(ahci_cmd_t *cmd) {
   */
   bit_set(cmd->port->ci, cmd->slot, 1);
 
-  // wait until the command is completed (and also check task file data for errors)
-  while (bit_get(cmd->port->ci, cmd->slot) != 0) {
-    if (!ahci_port_check_error(cmd->port, cmd->slot))
-      return -EIO;
-  }
+  /*
+
+   * wait until the command is completed (and also check task file data for errors)
+
+   * if the HBA interrupts are enabled, we block until the HBA interrupt handler
+   * wakes us up (see __ahci_handler()), otherwise we just poll the register
+
+  */
+  if (ahci_hba_has_irq(cmd->hba))
+    waitq_sleep(&ahci_waitq, bit_get(cmd->port->ci, cmd->slot) == 0 || !ahci_port_check_error(cmd->port, cmd->slot));
+
+  if (!timer_wait(bit_get(cmd->port->ci, cmd->slot) == 0 || !ahci_port_check_error(cmd->port, cmd->slot), AHCI_TIMEOUT))
+    return -ETIMEDOUT;
 
   // when the command is completed, check for error one last time
   return ahci_port_check_error(cmd->port, cmd->slot) ? 0 : -EIO;
@@ -73,21 +73,17 @@ struct ahci_received_fis {
 bool ahci_port_stop(ahci_port_t *port) {
   bit_set(port->cmd, AHCI_PxCMD_ST, 0);
 
-  while (bit_get(port->cmd, AHCI_PxCMD_CR) != 0)
-    continue;
+  if (!timer_wait(bit_get(port->cmd, AHCI_PxCMD_CR) == 0, AHCI_TIMEOUT))
+    return false;
 
   bit_set(port->cmd, AHCI_PxCMD_FRE, 0);
-
-  while (bit_get(port->cmd, AHCI_PxCMD_FR) != 0)
-    continue;
-
-  return true;
+  return timer_wait(bit_get(port->cmd, AHCI_PxCMD_FR) == 0, AHCI_TIMEOUT);
 }
 
 // starts the stoppen HBA back again
 bool ahci_port_start(ahci_port_t *port) {
-  while (bit_get(port->cmd, AHCI_PxCMD_CR) == 1)
-    continue;
+  if (!timer_wait(bit_get(port->cmd, AHCI_PxCMD_CR) == 0, AHCI_TIMEOUT))
+    return false;
 
   bit_set(port->cmd, AHCI_PxCMD_ST, 1);
   bit_set(port->cmd, AHCI_PxCMD_FRE, 1);
@@ -103,8 +99,8 @@ bool ahci_port_reset(ahci_port_t *port) {
   // COMRESET
   port->ssts &= ~0b111; // clear DEt
 
-  while ((port->ssts & 0x0F) != AHCI_PxSSTS_DET_OK)
-    continue;
+  if (!timer_wait((port->ssts & 0x0F) == AHCI_PxSSTS_DET_OK, AHCI_TIMEOUT))
+    return false;
 
   port->serr = UINT32_MAX; // clear error status
 
@@ -200,7 +196,7 @@ void *ahci_port_setup(ahci_port_t *port) {
    * reason
 
   */
-  clb_vaddr = vmm_map(page_count, 1024, VMM_ATTR_NO_CACHE);
+  clb_vaddr = vmm_map(page_count, 1024, VMM_ATTR_NO_CACHE | VMM_ATTR_CONTIG);
   port->clb = vmm_resolve(clb_vaddr);
   bzero(clb_vaddr, size);
 
@@ -226,9 +222,9 @@ void *ahci_port_setup(ahci_port_t *port) {
     header[i].ctba  = port->clb + command_table_offset[i];
   }
 
-  // clear interrupt status and enable all interrupts
+  // clear interrupt status and enable the command completion interrupts
   port->is = UINT32_MAX;
-  port->ie = 1;
+  port->ie = AHCI_PxIE_DONE;
 
   if (!ahci_port_start(port)) {
     ahci_fail("failed to start port 0x%p after initialization", port);
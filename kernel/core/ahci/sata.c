@@ -95,6 +95,7 @@ int32_t ahci_sata_port_read(ahci_port_data_t *data, uint64_t lba, uint64_t secto
   ahci_cmd_t cmd = {
       .vaddr     = data->vaddr,
       .port      = data->port,
+      .hba       = data->hba,
       .data      = buf,
       .data_size = sector_count * data->disk->sector_size,
       .fis_size  = sizeof(struct sata_fis_h2d),
@@ -138,9 +139,11 @@ int32_t ahci_sata_port_write(ahci_port_data_t *data, uint64_t lba, uint64_t sect
   ahci_cmd_t cmd = {
       .vaddr     = data->vaddr,
       .port      = data->port,
+      .hba       = data->hba,
       .data      = buf,
       .data_size = sector_count * data->disk->sector_size,
       .fis_size  = sizeof(struct sata_fis_h2d),
+      .write     = true,
   };
 
   if ((err = ahci_cmd_setup(&cmd)) != 0) {
@@ -179,6 +182,7 @@ int32_t ahci_sata_port_info(ahci_port_data_t *data, uint64_t lba, uint64_t secto
   ahci_cmd_t cmd = {
       .vaddr     = data->vaddr,
       .port      = data->port,
+      .hba       = data->hba,
       .data      = info,
       .data_size = sizeof(info),
       .fis_size  = sizeof(struct sata_fis_h2d),
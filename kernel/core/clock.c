@@ -0,0 +1,253 @@
+#include "core/clock.h"
+#include "core/timer.h"
+#include "core/acpi.h"
+#include "core/rtc.h"
+#include "core/im.h"
+
+#include "util/string.h"
+#include "util/printk.h"
+#include "util/asm.h"
+#include "util/bit.h"
+#include "util/io.h"
+
+#include "mm/vmm.h"
+
+#include "types.h"
+#include "errno.h"
+
+#define clock_debg(f, ...) pdebg("Clock: " f, ##__VA_ARGS__)
+#define clock_info(f, ...) pinfo("Clock: " f, ##__VA_ARGS__)
+#define clock_fail(f, ...) pfail("Clock: " f, ##__VA_ARGS__)
+
+/*
+
+ * clock sources, a clock source is a free running counter with a known
+ * frequency, the time is kept by converting the counter delta since the last
+ * update to nanoseconds, and adding it to the time at the last update
+
+ * the sources are (in the order of preference):
+ * - TSC: read with a single instruction, it's only used if it's invariant
+ *   (runs at a constant rate in all the P/C states), and its frequency is
+ *   calibrated against the best of the other sources
+ * - HPET: memory mapped 32/64 bit counter, found with the ACPI HPET table
+ * - ACPI PM timer: 24/32 bit port I/O counter at 3.579545 MHz, its port is
+ *   in the FADT
+ * - PIT: the PIT counts kept by the timer (see timer_now()), always available
+
+ * the counter delta is converted with a multiplier and a shift instead of a
+ * division, and the time is updated every tick (see clock_update()), so the
+ * narrow counters don't wrap around between the updates
+
+ * wall clock is seeded from the CMOS RTC during the boot, and after that it's
+ * just the monotonic time plus the wall clock time at the boot
+
+*/
+
+#define CLOCK_SHIFT       (32)                 // shift of the counter to nanosecond multiplier
+#define CLOCK_CALIBRATION (20 * NSEC_PER_MSEC) // time spent calibrating the TSC
+#define CLOCK_CYCLES_MAX  (10000000000ull)     // give up on the calibration after this many TSC cycles
+
+#define HPET_SIG           "HPET"
+#define HPET_REG_CAP       (0x00)         // general capabilities and ID register
+#define HPET_REG_CONFIG    (0x10)         // general configuration register
+#define HPET_REG_COUNTER   (0xF0)         // main counter value register
+#define HPET_CAP_COUNT_64  (13)           // main counter is 64 bits
+#define HPET_CONFIG_ENABLE (0)            // main counter is running
+#define HPET_PERIOD_MAX    (100000000ull) // max counter period (femtoseconds)
+#define HPET_FSEC_PER_SEC  (1000000000000000ull)
+#define hpet_reg(reg)      (*(volatile uint64_t *)(clock_hpet_regs + (reg)))
+
+#define PM_TIMER_FREQ (3579545)  // ACPI PM timer frequency (Hz)
+#define PM_TIMER_MASK (0xFFFFFF) // ACPI PM timer mask (if it's not 32 bits)
+
+// ACPI HPET description table
+struct hpet {
+  uint32_t   block_id;  // event timer block ID
+  acpi_gas_t addr;      // address of the HPET registers
+  uint8_t    number;    // HPET sequence number
+  uint16_t   min_tick;  // minimum clock ticks in the periodic mode
+  uint8_t    page_prot; // page protection and OEM attributes
+} __attribute__((packed));
+
+uint8_t *clock_hpet_regs = NULL; // mapped HPET registers
+uint16_t clock_pm_port   = 0;    // ACPI PM timer port
+
+uint64_t __clock_tsc_read() {
+  uint32_t low = 0, high = 0;
+  __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+uint64_t __clock_hpet_read() {
+  return hpet_reg(HPET_REG_COUNTER);
+}
+
+uint64_t __clock_pm_read() {
+  return in32(clock_pm_port);
+}
+
+// clang-format off
+clock_source_t clock_tsc  = {.name = "TSC",           .read = __clock_tsc_read,  .freq = 0,             .mask = UINT64_MAX};
+clock_source_t clock_hpet = {.name = "HPET",          .read = __clock_hpet_read, .freq = 0,             .mask = UINT64_MAX};
+clock_source_t clock_pm   = {.name = "ACPI PM timer", .read = __clock_pm_read,   .freq = PM_TIMER_FREQ, .mask = PM_TIMER_MASK};
+clock_source_t clock_pit  = {.name = "PIT",           .read = timer_now,         .freq = NSEC_PER_SEC,  .mask = UINT64_MAX};
+// clang-format on
+
+clock_source_t *clock_source = &clock_pit;          // clock source that's in use
+uint64_t        clock_mult   = 1ull << CLOCK_SHIFT; // counter to nanosecond multiplier
+uint64_t        clock_last   = 0;                   // counter value at the last update
+uint64_t        clock_ns     = 0;                   // monotonic time at the last update
+uint64_t        clock_boot   = 0;                   // wall clock time at the boot (monotonic time 0)
+
+// convert the counter delta to nanoseconds
+#define __clock_to_ns(delta) ((uint64_t)(((unsigned __int128)(delta) * clock_mult) >> CLOCK_SHIFT))
+
+// CPUID.80000007H:EDX[bit 8] (invariant TSC)
+bool __clock_tsc_is_invariant() {
+  uint32_t regs[4];
+
+  _cpuid(0x80000000, 0, regs);
+
+  if (regs[CPUID_EAX] < 0x80000007)
+    return false;
+
+  _cpuid(0x80000007, 0, regs);
+  return bit_get(regs[CPUID_EDX], 8);
+}
+
+bool __clock_hpet_init() {
+  struct hpet *hpet = acpi_find(HPET_SIG, sizeof(struct hpet));
+  uint64_t     cap  = 0;
+
+  if (NULL == hpet || hpet->addr.addr_space != ACPI_GAS_MEMORY)
+    return false;
+
+  if (NULL == (clock_hpet_regs = vmm_map_paddr(hpet->addr.addr, 1, VMM_ATTR_NO_CACHE | VMM_ATTR_SAVE))) {
+    clock_fail("failed to map the HPET registers at 0x%p", hpet->addr.addr);
+    return false;
+  }
+
+  // upper 32 bits of the capabilities is the counter period
+  if ((cap = hpet_reg(HPET_REG_CAP)) >> 32 == 0 || cap >> 32 > HPET_PERIOD_MAX) {
+    clock_fail("invalid HPET counter period: %u fs", cap >> 32);
+    return false;
+  }
+
+  clock_hpet.freq = HPET_FSEC_PER_SEC / (cap >> 32);
+  clock_hpet.mask = bit_get(cap, HPET_CAP_COUNT_64) ? UINT64_MAX : UINT32_MAX;
+
+  // start the main counter (if it's not already running)
+  hpet_reg(HPET_REG_CONFIG) |= 1 << HPET_CONFIG_ENABLE;
+  return true;
+}
+
+bool __clock_pm_init() {
+  bool ext = false;
+
+  if ((clock_pm_port = acpi_pm_timer(&ext)) == 0)
+    return false;
+
+  clock_pm.mask = ext ? UINT32_MAX : PM_TIMER_MASK;
+  return true;
+}
+
+// measure the TSC frequency against the reference clock source (returns 0 on failure)
+uint64_t __clock_tsc_calibrate(clock_source_t *ref) {
+  uint64_t target = ref->freq * CLOCK_CALIBRATION / NSEC_PER_SEC;
+  uint64_t ref_start = 0, ref_delta = 0, tsc_start = 0, tsc_delta = 0;
+
+  /*
+
+   * interrupts are not disabled, PIT reference needs the timer tick to keep
+   * the time, since both counters are read back to back, an interrupt only
+   * makes the measured interval longer, it doesn't change the frequency
+
+  */
+  ref_start = ref->read();
+  tsc_start = __clock_tsc_read();
+
+  do {
+    ref_delta = (ref->read() - ref_start) & ref->mask;
+    tsc_delta = __clock_tsc_read() - tsc_start;
+  } while (ref_delta < target && tsc_delta < CLOCK_CYCLES_MAX);
+
+  if (ref_delta < target)
+    return 0;
+
+  return tsc_delta * ref->freq / ref_delta;
+}
+
+void __clock_select(clock_source_t *source) {
+  uint64_t flags = 0;
+
+  im_save(flags);
+
+  // continue from the current time, so the time doesn't jump
+  clock_ns     = clock_now();
+  clock_source = source;
+  clock_mult   = (NSEC_PER_SEC << CLOCK_SHIFT) / source->freq;
+  clock_last   = source->read();
+
+  im_restore(flags);
+}
+
+int32_t clock_init() {
+  clock_source_t *ref = &clock_pit;
+  timestamp_t     ts  = 0;
+  int32_t         err = 0;
+
+  if (__clock_hpet_init())
+    ref = &clock_hpet;
+
+  else if (__clock_pm_init())
+    ref = &clock_pm;
+
+  if (!__clock_tsc_is_invariant())
+    clock_debg("TSC is not invariant, using the %s", ref->name);
+
+  else if ((clock_tsc.freq = __clock_tsc_calibrate(ref)) == 0)
+    clock_fail("failed to calibrate the TSC against the %s", ref->name);
+
+  else
+    ref = &clock_tsc;
+
+  __clock_select(ref);
+  clock_info("using the %s as the clock source (%u Hz)", ref->name, ref->freq);
+
+  // seed the wall clock from the RTC
+  if ((err = rtc_read(&ts)) != 0) {
+    clock_fail("failed to read the RTC: %s", strerror(err));
+    return err;
+  }
+
+  clock_boot = ts * NSEC_PER_SEC - clock_now();
+  clock_info("wall clock: %u", ts);
+
+  return 0;
+}
+
+void clock_update() {
+  uint64_t flags = 0, cur = 0;
+
+  im_save(flags);
+
+  cur = clock_source->read();
+  clock_ns += __clock_to_ns((cur - clock_last) & clock_source->mask);
+  clock_last = cur;
+
+  im_restore(flags);
+}
+
+uint64_t clock_now() {
+  uint64_t flags = 0, now = 0;
+
+  im_save(flags);
+  now = clock_ns + __clock_to_ns((clock_source->read() - clock_last) & clock_source->mask);
+  im_restore(flags);
+
+  return now;
+}
+
+uint64_t clock_real() {
+  return clock_boot + clock_now();
+}
@@ -77,6 +77,21 @@ struct tss {
   uint16_t io_bitmap_offset;
 } __attribute__((packed));
 
+/*
+
+ * interrupt stack table (IST) stacks, an IDT entry with an IST index always
+ * switches to the IST stack, even if we are already in ring 0, so #DF is
+ * handled on it's own stack, a fault while delivering a page fault (such as a
+ * kernel stack overflow into the guard page) would otherwise push the #DF frame
+ * to the same bad stack, which is a triple fault
+
+ * #PF is not moved to an IST stack, the IST stack pointer is reset on every
+ * entry, and the page fault handler may block (loading a page), so a nested
+ * page fault from an another task would overwrite it's frame
+
+*/
+#define IM_IST_DOUBLE_FAULT (1)
+
 #define IM_IDT_SIZE        sizeof(im_idt)
 #define IM_IDT_ENTRY_SIZE  sizeof(struct im_desc)
 #define IM_IDT_ENTRY_COUNT (IM_IDT_SIZE / IM_IDT_ENTRY_SIZE)
@@ -115,8 +130,8 @@ void im_set_entry(uint8_t vector, uint8_t dpl) {
   */
   d->attr = (1 << 7) | ((dpl & 0b11) << 5) | 0b1110;
 
-  // for now we are just gonna disable the IST (and clear out the reserved area as well)
-  d->ist = 0;
+  // only #DF uses an IST stack (this also clears out the reserved area)
+  d->ist = vector == IM_INT_DOUBLE_FAULT ? IM_IST_DOUBLE_FAULT : 0;
 }
 
 // add/set interrupt in the IDT
@@ -221,6 +236,13 @@ void im_init() {
   im_tss.rsp0 += PAGE_SIZE;
   pdebg("IM: TSS stack @ 0x%p", im_tss.rsp0);
 
+  // #DF stack is also a single page, it's only used to report the fault (see above)
+  if ((im_tss.ist1 = (uint64_t)vmm_map(1, 0, 0)) == NULL)
+    panic("Failed to allocate a #DF stack for the TSS");
+
+  im_tss.ist1 += PAGE_SIZE;
+  pdebg("IM: #DF stack @ 0x%p", im_tss.ist1);
+
   gdt_tss_set(&im_tss, (sizeof(struct tss) - 1));
 }
 
@@ -236,3 +258,11 @@ void *im_stack() {
   // stack is allocated and the address is calculated in im_init()
   return (void *)im_tss.rsp0;
 }
+
+bool im_handling() {
+  uint64_t rsp = 0;
+  __asm__("mov %%rsp, %0" : "=r"(rsp));
+
+  // interrupt stack is a single page (see im_init())
+  return rsp < im_tss.rsp0 && rsp >= im_tss.rsp0 - PAGE_SIZE;
+}
@@ -0,0 +1,79 @@
+#include "core/pit.h"
+#include "util/io.h"
+#include "types.h"
+
+/*
+
+ * programmable interval timer functions (PIT)
+ * see https://wiki.osdev.org/Programmable_Interval_Timer
+
+ * PIT is connected to the IRQ 0 of the PIC, only the channel 0 is used, in
+ * the rate generator mode (mode 2) for the periodic scheduler tick, and in the
+ * interrupt on terminal count mode (mode 0) for the one-shot events
+
+ * both modes count down from the given count at PIT_FREQ, mode 2 reloads the
+ * count and sends an interrupt every time it reaches zero, mode 0 sends a single
+ * interrupt when it reaches zero (and keeps counting down, wrapping around)
+
+*/
+
+#define PIT_PORT_CH0     0x40
+#define PIT_PORT_COMMAND 0x43
+
+/*
+
+ * command register bits:
+ * - bit 7-6: channel (0)
+ * - bit 5-4: access mode (0 = latch count, 3 = low byte then high byte)
+ * - bit 3-1: operating mode
+ * - bit 0  : BCD mode (0 = binary)
+
+ * read-back command (bit 7-6 = 3) is used to read the status of channel 0:
+ * - bit 5: don't latch the count
+ * - bit 1: channel 0
+
+*/
+#define PIT_CMD_LATCH     (0)
+#define PIT_CMD_MODE(m)   (0b00110000 | (m) << 1)
+#define PIT_CMD_READ_BACK (0b11100010)
+
+#define PIT_MODE_ONESHOT  (0) // interrupt on terminal count
+#define PIT_MODE_PERIODIC (2) // rate generator
+
+#define PIT_STATUS_OUTPUT (1 << 7) // state of the output pin
+
+// set the mode and the reload count of channel 0
+void __pit_set(uint8_t mode, uint32_t count) {
+  // 0 is used for the max count
+  if (count >= PIT_COUNT_MAX)
+    count = 0;
+
+  out8(PIT_PORT_COMMAND, PIT_CMD_MODE(mode));
+  out8(PIT_PORT_CH0, count & 0xff);
+  out8(PIT_PORT_CH0, (count >> 8) & 0xff);
+}
+
+void pit_periodic(uint32_t count) {
+  __pit_set(PIT_MODE_PERIODIC, count);
+}
+
+void pit_oneshot(uint32_t count) {
+  __pit_set(PIT_MODE_ONESHOT, count);
+}
+
+uint16_t pit_count() {
+  uint16_t count = 0;
+
+  // latch the count, so both bytes belong to the same count
+  out8(PIT_PORT_COMMAND, PIT_CMD_LATCH);
+
+  count = in8(PIT_PORT_CH0);
+  count |= in8(PIT_PORT_CH0) << 8;
+
+  return count;
+}
+
+bool pit_fired() {
+  out8(PIT_PORT_COMMAND, PIT_CMD_READ_BACK);
+  return (in8(PIT_PORT_CH0) & PIT_STATUS_OUTPUT) != 0;
+}
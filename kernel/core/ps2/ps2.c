@@ -1,6 +1,8 @@
+#include "core/timer.h"
 #include "core/ps2.h"
 #include "core/acpi.h"
 
+#include "util/string.h"
 #include "util/printk.h"
 #include "util/bit.h"
 #include "util/io.h"
@@ -25,6 +27,8 @@
 #define PS2_CMD_ENABLE_FIRST   (0xAE)
 #define PS2_CMD_TEST_FIRST     (0xAB)
 
+#define PS2_TIMEOUT (100 * NSEC_PER_MSEC) // max time to wait for the controller
+
 #define PS2_STATUS_OUTPUT (0)
 #define PS2_STATUS_INPUT  (1)
 
@@ -40,8 +44,8 @@ int32_t ps2_init() {
   if (!acpi_supports_8042_ps2())
     return -EFAULT;
 
-  uint8_t port_count = 2, port_err = 0;
-  uint8_t config = 0;
+  uint8_t port_count = 2;
+  int32_t port_err = 0, config = 0;
 
   // disable both devices
   ps2_cmd(PS2_CMD_DISABLE_FIRST);
@@ -51,7 +55,11 @@ int32_t ps2_init() {
   in8(PS2_PORT_DATA);
 
   // configure port 1
-  config = ps2_cmd(PS2_CMD_READ_0);
+  if ((config = ps2_cmd(PS2_CMD_READ_0)) < 0) {
+    ps2_fail("failed to read the configuration: %s", strerror(config));
+    return config;
+  }
+
   bit_set(config, PS2_CONFIG_FIRST_INT, 0);   // disable port 1 interrupt
   bit_set(config, PS2_CONFIG_FIRST_CLOCK, 0); // enable port 1 clock
   bit_set(config, PS2_CONFIG_FIRST_TRANS, 0); // disable port 1 translation
@@ -65,9 +73,8 @@ int32_t ps2_init() {
 
   // check if port 2 is available
   ps2_cmd(PS2_CMD_ENABLE_SECOND);
-  config = ps2_cmd(PS2_CMD_READ_0);
 
-  if (!bit_get(config, PS2_CONFIG_SECOND_CLOCK)) {
+  if ((config = ps2_cmd(PS2_CMD_READ_0)) >= 0 && !bit_get(config, PS2_CONFIG_SECOND_CLOCK)) {
     // if so, configure port 2
     ps2_cmd(PS2_CMD_DISABLE_SECOND);
     bit_set(config, PS2_CONFIG_SECOND_INT, 0);   // disable port 2 interrupt
@@ -94,25 +101,26 @@ int32_t ps2_init() {
   return -ENOSYS;
 }
 
-uint8_t ps2_read() {
+int32_t ps2_read() {
   // wait until data can be read (output buffer is full)
-  while (!bit_get(in8(PS2_PORT_STATUS), PS2_STATUS_OUTPUT))
-    continue;
+  if (!timer_wait(bit_get(in8(PS2_PORT_STATUS), PS2_STATUS_OUTPUT), PS2_TIMEOUT))
+    return -ETIMEDOUT;
 
   // read the data
   return in8(PS2_PORT_DATA);
 }
 
-void ps2_write(uint8_t data) {
+int32_t ps2_write(uint8_t data) {
   // wait until data can be written (input buffer is clear)
-  while (bit_get(in8(PS2_PORT_STATUS), PS2_STATUS_INPUT))
-    continue;
+  if (!timer_wait(!bit_get(in8(PS2_PORT_STATUS), PS2_STATUS_INPUT), PS2_TIMEOUT))
+    return -ETIMEDOUT;
 
-  // read the data
+  // write the data
   out8(PS2_PORT_DATA, data);
+  return 0;
 }
 
-uint8_t ps2_cmd(uint8_t cmd) {
+int32_t ps2_cmd(uint8_t cmd) {
   out8(PS2_PORT_COMMAND, cmd);
 
   switch (cmd) {
@@ -127,7 +135,7 @@ uint8_t ps2_cmd(uint8_t cmd) {
   return ps2_read();
 }
 
-void ps2_cmd_with(uint8_t cmd, uint8_t data) {
+int32_t ps2_cmd_with(uint8_t cmd, uint8_t data) {
   out8(PS2_PORT_COMMAND, cmd);
-  ps2_write(data);
+  return ps2_write(data);
 }
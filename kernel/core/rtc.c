@@ -0,0 +1,132 @@
+#include "core/timer.h"
+#include "core/acpi.h"
+#include "core/rtc.h"
+
+#include "util/timestamp.h"
+#include "util/bit.h"
+#include "util/io.h"
+
+#include "types.h"
+#include "errno.h"
+
+/*
+
+ * CMOS real time clock functions (RTC)
+ * see https://wiki.osdev.org/CMOS
+
+ * RTC keeps the date & time in the CMOS registers, the registers are updated
+ * once a second, and they may hold inconsistent values during the update, so
+ * we wait for the update to finish, and read the registers until we get the
+ * same values twice in a row
+
+ * it's only read once during the boot to seed the wall clock (see clock_init()),
+ * after that the wall clock is kept by the clock source
+
+*/
+
+#define RTC_PORT_INDEX (0x70)
+#define RTC_PORT_DATA  (0x71)
+#define RTC_TIMEOUT    (10 * NSEC_PER_MSEC) // max time to wait for an update (it takes ~2 ms)
+
+#define RTC_REG_SECOND   (0x00)
+#define RTC_REG_MINUTE   (0x02)
+#define RTC_REG_HOUR     (0x04)
+#define RTC_REG_DAY      (0x07)
+#define RTC_REG_MONTH    (0x08)
+#define RTC_REG_YEAR     (0x09)
+#define RTC_REG_STATUS_A (0x0A)
+#define RTC_REG_STATUS_B (0x0B)
+
+#define RTC_STATUS_A_UIP    (7) // update in progress
+#define RTC_STATUS_B_24H    (1) // hours are in the 24 hour format
+#define RTC_STATUS_B_BINARY (2) // values are in binary (BCD otherwise)
+
+#define RTC_HOUR_PM     (0x80) // PM bit of the hour (12 hour format only)
+#define RTC_CENTURY_DFL (20)   // century used if the RTC doesn't have a century register
+#define rtc_bcd(v)      (((v) >> 4) * 10 + ((v) & 0x0F))
+
+struct rtc_time {
+  uint8_t second;
+  uint8_t minute;
+  uint8_t hour;
+  uint8_t day;
+  uint8_t month;
+  uint8_t year;
+  uint8_t century;
+};
+
+uint8_t __rtc_reg(uint8_t reg) {
+  out8(RTC_PORT_INDEX, reg);
+  return in8(RTC_PORT_DATA);
+}
+
+bool __rtc_time(struct rtc_time *time, uint8_t century_reg) {
+  // wait for the update to finish
+  if (!timer_wait(!bit_get(__rtc_reg(RTC_REG_STATUS_A), RTC_STATUS_A_UIP), RTC_TIMEOUT))
+    return false;
+
+  time->second  = __rtc_reg(RTC_REG_SECOND);
+  time->minute  = __rtc_reg(RTC_REG_MINUTE);
+  time->hour    = __rtc_reg(RTC_REG_HOUR);
+  time->day     = __rtc_reg(RTC_REG_DAY);
+  time->month   = __rtc_reg(RTC_REG_MONTH);
+  time->year    = __rtc_reg(RTC_REG_YEAR);
+  time->century = century_reg == 0 ? 0 : __rtc_reg(century_reg);
+
+  return true;
+}
+
+bool __rtc_time_eq(struct rtc_time *a, struct rtc_time *b) {
+  return a->second == b->second && a->minute == b->minute && a->hour == b->hour && a->day == b->day &&
+         a->month == b->month && a->year == b->year && a->century == b->century;
+}
+
+int32_t rtc_read(timestamp_t *ts) {
+  struct rtc_time cur, last;
+  uint8_t         century_reg = 0, status = 0, pm = 0;
+  uint16_t        year        = 0;
+
+  if (NULL == ts)
+    return -EINVAL;
+
+  if (!acpi_supports_cmos_rtc())
+    return -ENODEV;
+
+  century_reg = acpi_century();
+
+  // read till we get the same values twice, so we don't read during an update
+  if (!__rtc_time(&cur, century_reg))
+    return -ETIMEDOUT;
+
+  do {
+    last = cur;
+
+    if (!__rtc_time(&cur, century_reg))
+      return -ETIMEDOUT;
+  } while (!__rtc_time_eq(&last, &cur));
+
+  status = __rtc_reg(RTC_REG_STATUS_B);
+
+  // PM bit is not a part of the BCD value
+  pm = cur.hour & RTC_HOUR_PM;
+  cur.hour &= ~RTC_HOUR_PM;
+
+  if (!bit_get(status, RTC_STATUS_B_BINARY)) {
+    cur.second  = rtc_bcd(cur.second);
+    cur.minute  = rtc_bcd(cur.minute);
+    cur.hour    = rtc_bcd(cur.hour);
+    cur.day     = rtc_bcd(cur.day);
+    cur.month   = rtc_bcd(cur.month);
+    cur.year    = rtc_bcd(cur.year);
+    cur.century = rtc_bcd(cur.century);
+  }
+
+  // convert 12 hour format to 24 hour format (12 AM is 0, 12 PM is 12)
+  if (!bit_get(status, RTC_STATUS_B_24H))
+    cur.hour = cur.hour % 12 + (pm ? 12 : 0);
+
+  year = (cur.century == 0 ? RTC_CENTURY_DFL : cur.century) * 100 + cur.year;
+  *ts  = timestamp_calc(year, cur.month, cur.day, cur.hour, cur.minute, cur.second);
+
+  return 0;
+}
@@ -2,6 +2,9 @@
 #include "sched/sched.h"
 #include "fs/devfs.h"
 
+#include "core/pic.h"
+#include "core/im.h"
+
 #include "util/printk.h"
 #include "util/string.h"
 #include "util/lock.h"
@@ -28,6 +31,8 @@ struct serial_port {
   bool               available;  // is the port available
   spinlock_t         read_lock;  // read lock for the port
   spinlock_t         write_lock; // write lock for the port
+  waitq_t            read_wait;  // tasks waiting for the port to be readable
+  waitq_t            write_wait; // tasks waiting for the port to be writeable
 };
 
 enum {
@@ -114,13 +119,56 @@ struct serial_port *__serial_port_by_dev(int32_t dev) {
 // interrrupt status, data ready (DR) bit
 #define __serial_port_readable() (__in8_port(SERIAL_OFF_LINE_STATUS) & 1)
 
-int32_t __serial_port_write(struct serial_port *port, char c) {
+// interrupt enable bits
+#define SERIAL_INT_READ  (1 << 0) // received data available
+#define SERIAL_INT_WRITE (1 << 1) // transmitter holding register empty (THRE)
+
+// get the IRQ of the port (only the first four ports have one)
+pic_irq_t __serial_port_irq(struct serial_port *port) {
+  switch (port->addr) {
+  case SERIAL_PORT_COM1:
+  case SERIAL_PORT_COM3:
+    return PIC_IRQ_COM1;
+
+  case SERIAL_PORT_COM2:
+  case SERIAL_PORT_COM4:
+    return PIC_IRQ_COM2;
+
+  default:
+    return 0;
+  }
+}
+
+/*
+
+ * block the current task until the port's interrupt enabled with the given
+ * bit is received, interrupt is only enabled while a task waits on it, and
+ * it's disabled again by the handler, so the IRQ line goes back down, and the
+ * next interrupt is not missed (PIC is edge triggered)
+
+*/
+#define __serial_port_wait(port, bit, wq, cond)                                                                        \
+  do {                                                                                                                 \
+    uint64_t __flags = 0;                                                                                              \
+    im_save(__flags);                                                                                                  \
+    while (!(cond)) {                                                                                                  \
+      __out8_port(SERIAL_OFF_INTERRUPT_ENABLE, __in8_port(SERIAL_OFF_INTERRUPT_ENABLE) | (bit));                       \
+      __waitq_sleep(wq);                                                                                               \
+    }                                                                                                                  \
+    im_restore(__flags);                                                                                               \
+  } while (0)
+
+int32_t __serial_port_write(struct serial_port *port, char c, bool block) {
   if (NULL == port || !port->available)
     return -EINVAL;
 
-  // wait until port is waitable
-  while (!__serial_port_writeable())
-    sched_wait();
+  // wait until port is writeable
+  if (block && __serial_port_irq(port) != 0)
+    __serial_port_wait(port, SERIAL_INT_WRITE, &port->write_wait, __serial_port_writeable());
+
+  else
+    while (!__serial_port_writeable())
+      continue;
 
   // write a single byte
   if (!__out8_port(SERIAL_OFF_WRITE, c))
@@ -129,19 +177,50 @@ int32_t __serial_port_write(struct serial_port *port, char c) {
   return 0;
 }
 
-int32_t __serial_port_read(struct serial_port *port, char *c) {
+int32_t __serial_port_read(struct serial_port *port, char *c, bool block) {
   if (NULL == c || NULL == port || !port->available)
     return -EINVAL;
 
   // wait until port is readble
-  while (!__serial_port_readable())
-    sched_wait();
+  if (block && __serial_port_irq(port) != 0)
+    __serial_port_wait(port, SERIAL_INT_READ, &port->read_wait, __serial_port_readable());
+
+  else
+    while (!__serial_port_readable())
+      continue;
 
   // read a single byte
   *c = (char)__in8_port(SERIAL_OFF_READ);
   return 0;
 }
 
+// serial port interrupt handler, wakes up the tasks waiting on the ports
+void __serial_handler(im_stack_t *stack) {
+  struct serial_port *port = &serial_ports[0];
+  uint8_t             ier  = 0;
+
+  for (; NULL != port->addr; port++) {
+    if (!port->available || __serial_port_irq(port) != pic_to_irq(stack->vector))
+      continue;
+
+    // reading the interrupt ID clears the THRE interrupt
+    __in8_port(SERIAL_OFF_INTERRUPT_ID);
+    ier = __in8_port(SERIAL_OFF_INTERRUPT_ENABLE);
+
+    if ((ier & SERIAL_INT_READ) && __serial_port_readable()) {
+      ier &= ~SERIAL_INT_READ;
+      waitq_wake_all(&port->read_wait);
+    }
+
+    if ((ier & SERIAL_INT_WRITE) && __serial_port_writeable()) {
+      ier &= ~SERIAL_INT_WRITE;
+      waitq_wake_all(&port->write_wait);
+    }
+
+    __out8_port(SERIAL_OFF_INTERRUPT_ENABLE, ier);
+  }
+}
+
 int32_t __serial_open(fs_inode_t *inode) {
   // try to obtain the port from the inode
   if (NULL == __serial_port_by_dev(inode->addr))
@@ -170,13 +249,13 @@ int64_t __serial_read(fs_inode_t *inode, uint64_t offset, uint64_t size, void *b
 
   // read each char into the buffer
   for (; cur_size < size; cur_size++, buffer++) {
-    if ((err = __serial_port_read(port, (char *)buffer)) != 0)
-      return err;
+    if ((err = __serial_port_read(port, (char *)buffer, true)) != 0)
+      break;
   }
 
   // release the lock
   spinlock_release(&port->read_lock);
-  return cur_size;
+  return err == 0 ? (int64_t)cur_size : err;
 }
 
 int64_t __serial_write(fs_inode_t *inode, uint64_t offset, uint64_t size, void *buffer) {
@@ -189,13 +268,13 @@ int64_t __serial_write(fs_inode_t *inode, uint64_t offset, uint64_t size, void *
 
   // write the each char to the port
   for (; cur_size < size; cur_size++, buffer++) {
-    if ((err = __serial_port_write(port, *(char *)buffer)) != 0)
-      return err;
+    if ((err = __serial_port_write(port, *(char *)buffer, true)) != 0)
+      break;
   }
 
   // release the lock
   spinlock_release(&port->write_lock);
-  return cur_size;
+  return err == 0 ? (int64_t)cur_size : err;
 }
 
 // device operations for the serial port devices
@@ -306,6 +385,12 @@ int32_t serial_register() {
     // save the device address
     port->dev = dev_addr;
 
+    // tasks using the device block until the port's interrupt (see __serial_port_wait())
+    if (__serial_port_irq(port) != 0) {
+      im_add_handler(pic_to_int(__serial_port_irq(port)), IM_HANDLER_PRIO_FIRST, __serial_handler);
+      pic_unmask(__serial_port_irq(port));
+    }
+
     serial_info("registered the serial port device");
     pinfo("        |- Name: %s (0x%x)", port->name, port->addr);
     pinfo("        `- Device: %u", port->dev);
@@ -328,7 +413,7 @@ int32_t serial_write(serial_port_addr_t addr, char *msg) {
 
   for (; *msg != 0; msg++) {
     // write each char of the message
-    if ((err = __serial_port_write(port, *msg)) != 0)
+    if ((err = __serial_port_write(port, *msg, false)) != 0)
       return err;
   }
 
@@ -350,7 +435,7 @@ int32_t serial_read(serial_port_addr_t addr, char *msg, uint64_t size) {
 
   for (; cur < size; cur++) {
     // read each char from the serial port
-    if ((err = __serial_port_read(port, &msg[cur])) != 0)
+    if ((err = __serial_port_read(port, &msg[cur], false)) != 0)
       return err;
   }
 
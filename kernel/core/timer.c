@@ -0,0 +1,322 @@
+#include "core/timer.h"
+#include "core/clock.h"
+#include "core/pit.h"
+#include "core/pic.h"
+#include "core/im.h"
+
+#include "sched/sched.h"
+#include "util/printk.h"
+#include "util/math.h"
+
+#include "config.h"
+#include "types.h"
+
+#define timer_debg(f, ...) pdebg("Timer: " f, ##__VA_ARGS__)
+#define timer_info(f, ...) pinfo("Timer: " f, ##__VA_ARGS__)
+
+/*
+
+ * timer subsystem, PIT sends the timer tick every TIMER_PERIOD counts, and the
+ * time is kept as the total PIT counts since the timer is initialized, so it
+ * doesn't drift, even though a tick is not exactly NSEC_PER_TICK nanoseconds
+
+ * pending timers are kept in a hierarchical timer wheel, every level has
+ * TIMER_SIZE slots, a slot in the first level is a single tick, and a slot in
+ * the next level is a full turn of the previous level, so timers are added
+ * and removed in constant time, and the tick only looks at a single slot
+
+ * when a level turns around, the next slot of the next level is cascaded down,
+ * so the timers in it are moved to the lower levels, until they are in the
+ * first level, which is where they expire
+
+ * while the CPU is idle, the periodic tick is stopped, and the PIT is used as
+ * a one-shot event source, which is programmed for the next pending timer (see
+ * timer_idle_enter()), when the event fires, the periodic tick starts again
+
+*/
+
+#define TIMER_PERIOD ((PIT_FREQ + CONFIG_CORE_TIMER_HZ / 2) / CONFIG_CORE_TIMER_HZ) // PIT count for a single tick
+#define TIMER_BITS   (6)                                   // slot index bits for a single level
+#define TIMER_SIZE   (1 << TIMER_BITS)                     // slot count for a single level
+#define TIMER_MASK   (TIMER_SIZE - 1)                      // mask for the slot index
+#define TIMER_LEVELS (5)                                   // level count of the wheel
+#define TIMER_SPAN   (1ull << (TIMER_BITS * TIMER_LEVELS)) // max ticks a timer can be away
+
+#define __timer_min(a, b) ((a) < (b) ? (a) : (b))
+
+timer_t *timer_wheel[TIMER_LEVELS][TIMER_SIZE];
+
+bool     timer_running = false; // is the timer initialized (see timer_init())
+uint64_t timer_counts  = 0;     // PIT counts since the timer is initialized (till the last tick)
+uint64_t timer_jiffies = 0;     // next tick the wheel should process
+uint32_t timer_oneshot = 0;     // PIT count of the one-shot event (0 if the periodic tick is running)
+uint64_t timer_last    = 0;     // last returned time, so the time never goes back (see timer_now())
+
+// convert the PIT counts to nanoseconds
+uint64_t __timer_to_ns(uint64_t counts) {
+  return counts / PIT_FREQ * NSEC_PER_SEC + counts % PIT_FREQ * NSEC_PER_SEC / PIT_FREQ;
+}
+
+// convert nanoseconds to the PIT counts (rounded up)
+uint64_t __timer_to_counts(uint64_t ns) {
+  return ns / NSEC_PER_SEC * PIT_FREQ + div_ceil(ns % NSEC_PER_SEC * PIT_FREQ, NSEC_PER_SEC);
+}
+
+// PIT counts since the last tick (or since the one-shot event is programmed)
+uint64_t __timer_elapsed() {
+  if (timer_oneshot != 0)
+    return pit_fired() ? timer_oneshot : timer_oneshot - pit_count();
+
+  return TIMER_PERIOD - __timer_min(pit_count(), TIMER_PERIOD);
+}
+
+void __timer_insert(timer_t *timer) {
+  uint64_t expires = timer->expires, delta = 0;
+  uint8_t  level   = 0;
+
+  // timers that already expired are expired with the next tick
+  if (expires < timer_jiffies)
+    expires = timer_jiffies;
+
+  // timers that are too far away are put to the last level, and cascaded down again later
+  if ((delta = expires - timer_jiffies) >= TIMER_SPAN)
+    delta = (expires = timer_jiffies + TIMER_SPAN - 1) - timer_jiffies;
+
+  while (level < TIMER_LEVELS - 1 && delta >> (TIMER_BITS * (level + 1)) != 0)
+    level++;
+
+  timer->slot = &timer_wheel[level][(expires >> (TIMER_BITS * level)) & TIMER_MASK];
+  timer->prev = NULL;
+
+  if (NULL != (timer->next = *timer->slot))
+    timer->next->prev = timer;
+
+  *timer->slot = timer;
+}
+
+void __timer_unlink(timer_t *timer) {
+  if (NULL == timer->prev)
+    *timer->slot = timer->next;
+  else
+    timer->prev->next = timer->next;
+
+  if (NULL != timer->next)
+    timer->next->prev = timer->prev;
+
+  timer->slot = NULL;
+  timer->next = timer->prev = NULL;
+}
+
+// move the timers in the current slot of the level to the lower levels, returns the slot index
+uint64_t __timer_cascade(uint8_t level) {
+  uint64_t indx = (timer_jiffies >> (TIMER_BITS * level)) & TIMER_MASK;
+  timer_t *cur = timer_wheel[level][indx], *next = NULL;
+
+  timer_wheel[level][indx] = NULL;
+
+  for (; NULL != cur; cur = next) {
+    next = cur->next;
+    __timer_insert(cur);
+  }
+
+  return indx;
+}
+
+// process the wheel till the given tick, and call the functions of the expired timers
+void __timer_run(uint64_t ticks) {
+  timer_t *timer = NULL;
+  uint64_t indx  = 0;
+  uint8_t  level = 0;
+
+  for (; timer_jiffies <= ticks; timer_jiffies++) {
+    // first level turned around, cascade the next levels down
+    if ((indx = timer_jiffies & TIMER_MASK) == 0)
+      for (level = 1; level < TIMER_LEVELS && __timer_cascade(level) == 0; level++)
+        ;
+
+    while (NULL != (timer = timer_wheel[0][indx])) {
+      __timer_unlink(timer);
+      timer->func(timer);
+    }
+  }
+}
+
+// find the tick the first pending timer expires at (UINT64_MAX if there is none)
+uint64_t __timer_next() {
+  uint64_t next = UINT64_MAX;
+  timer_t *cur  = NULL;
+
+  for (uint8_t level = 0; level < TIMER_LEVELS; level++)
+    for (uint8_t indx = 0; indx < TIMER_SIZE; indx++)
+      for (cur = timer_wheel[level][indx]; NULL != cur; cur = cur->next)
+        next = __timer_min(next, cur->expires);
+
+  return next;
+}
+
+// timer interrupt handler, it's called before the scheduler's handler
+void __timer_handler(im_stack_t *stack) {
+  // one-shot event (see timer_idle_enter()), start the periodic tick again
+  if (timer_oneshot != 0) {
+    timer_counts += timer_oneshot;
+    timer_oneshot = 0;
+    pit_periodic(TIMER_PERIOD);
+  }
+
+  else
+    timer_counts += TIMER_PERIOD;
+
+  clock_update();
+  __timer_run(timer_counts / TIMER_PERIOD);
+}
+
+int32_t timer_init() {
+  pit_periodic(TIMER_PERIOD);
+  im_add_handler(pic_to_int(PIC_IRQ_TIMER), IM_HANDLER_PRIO_FIRST, __timer_handler);
+
+  timer_running = true;
+  timer_info("started the timer tick at %u Hz (PIT count: %u)", CONFIG_CORE_TIMER_HZ, TIMER_PERIOD);
+
+  return 0;
+}
+
+uint64_t timer_now() {
+  uint64_t flags = 0, now = 0;
+
+  if (!timer_running)
+    return 0;
+
+  im_save(flags);
+
+  // the count may wrap around before the tick is handled, so don't go back
+  if ((now = __timer_to_ns(timer_counts + __timer_elapsed())) < timer_last)
+    now = timer_last;
+
+  timer_last = now;
+  im_restore(flags);
+
+  return now;
+}
+
+void timer_add(timer_t *timer, uint64_t ns) {
+  uint64_t flags = 0;
+
+  if (NULL == timer || NULL == timer->func)
+    return;
+
+  im_save(flags);
+
+  if (timer_pending(timer))
+    __timer_unlink(timer);
+
+  timer->expires = div_ceil(timer_counts + __timer_elapsed() + __timer_to_counts(ns), TIMER_PERIOD);
+  __timer_insert(timer);
+
+  im_restore(flags);
+}
+
+void timer_del(timer_t *timer) {
+  uint64_t flags = 0;
+
+  if (NULL == timer)
+    return;
+
+  im_save(flags);
+
+  if (timer_pending(timer))
+    __timer_unlink(timer);
+
+  im_restore(flags);
+}
+
+uint64_t timer_left(timer_t *timer) {
+  uint64_t flags = 0, now = 0, end = 0;
+
+  if (NULL == timer)
+    return 0;
+
+  im_save(flags);
+
+  if (timer_pending(timer)) {
+    now = timer_counts + __timer_elapsed();
+    end = timer->expires * TIMER_PERIOD;
+  }
+
+  im_restore(flags);
+  return end > now ? __timer_to_ns(end - now) : 0;
+}
+
+// wake up the task that's sleeping on the timer (see timer_sleep())
+void __timer_wake(timer_t *timer) {
+  waitq_wake_all(&((task_t *)timer->data)->sleep);
+}
+
+void timer_sleep(uint64_t ns) {
+  uint64_t deadline = timer_deadline(ns);
+  task_t  *task     = task_current;
+
+  // we can't block, so just wait for the deadline
+  if (!sched_sleepable()) {
+    while (!timer_expired(deadline))
+      continue;
+    return;
+  }
+
+  task->timer.func = __timer_wake;
+  task->timer.data = task;
+
+  timer_add(&task->timer, ns);
+  waitq_sleep(&task->sleep, !timer_pending(&task->timer));
+}
+
+void timer_idle_enter() {
+  uint64_t flags = 0, next = 0, now = 0, count = PIT_COUNT_MAX;
+
+  im_save(flags);
+
+  // one-shot event already fired, timer interrupt handler will start the tick
+  if (!timer_running || (timer_oneshot != 0 && pit_fired())) {
+    im_restore(flags);
+    return;
+  }
+
+  // count the time since the last tick (or the last event), as the one-shot event starts from now
+  now = timer_counts + __timer_elapsed();
+
+  // without a pending timer, the event is used to keep the time with the longest possible interval
+  if ((next = __timer_next()) != UINT64_MAX)
+    count = next * TIMER_PERIOD > now ? __timer_min(next * TIMER_PERIOD - now, PIT_COUNT_MAX) : 1;
+
+  /*
+
+   * if the one-shot event is already programmed, only program it again if the
+   * next timer expires before it, a timer can be added by an interrupt handler
+   * while we are idle, and the idle task calls this again after every interrupt
+
+  */
+  if (timer_oneshot != 0 && now + count >= timer_counts + timer_oneshot) {
+    im_restore(flags);
+    return;
+  }
+
+  timer_counts  = now;
+  timer_oneshot = count;
+  pit_oneshot(count);
+
+  im_restore(flags);
+}
+
+void timer_idle_exit() {
+  uint64_t flags = 0;
+
+  im_save(flags);
+
+  // if the event already fired, timer interrupt handler will start the tick
+  if (timer_oneshot != 0 && !pit_fired()) {
+    timer_counts += timer_oneshot - pit_count();
+    timer_oneshot = 0;
+    pit_periodic(TIMER_PERIOD);
+  }
+
+  im_restore(flags);
+}
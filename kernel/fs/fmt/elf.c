@@ -296,6 +296,18 @@ int32_t __elf_load_dyn(struct elf *elf) {
       return -ENOMEM;
     }
 
+    /*
+
+     * segment is not loaded right away, filesz bytes of the segment are loaded
+     * from the file when it's pages are accessed, rest of it is zero filled
+
+    */
+    if (header.filesz != 0 && (err = region_file(mem, elf->node, header.offset, header.filesz)) != 0) {
+      elf_debg("failed to set the file for %s memory region: %s", region_name(mem), strerror(err));
+      region_free(mem);
+      return err;
+    }
+
     // map the new memory region
     if ((err = region_map(mem)) != 0) {
       elf_debg("failed to map %s memory region @ 0x%p (%u pages): %s",
@@ -313,16 +325,6 @@ int32_t __elf_load_dyn(struct elf *elf) {
     if (NULL == pos)
       pos = mem->vaddr;
 
-    // load filesz bytes from file to the allocated memory
-    if (header.filesz != 0 && (err = __elf_read(elf, header.offset, header.filesz, pos)) < 0) {
-      elf_debg("failed to load program header from the file: %s", strerror(err));
-      return -EIO;
-    }
-
-    // zero out the rest of the memory
-    for (uint64_t i = header.filesz; i < header.memsz; i++)
-      ((uint8_t *)pos)[i] = 0;
-
     // see if this section contains the entrypoint
     if (header.vaddr < elf->header.entry && header.vaddr + header.memsz > elf->header.entry)
       elf->entry = pos + elf->header.entry;
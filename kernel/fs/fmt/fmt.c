@@ -67,7 +67,7 @@ void fmt_free(fmt_t *fmt) {
     return;
 
   // unmap all the memory regions
-  region_each(&fmt->mem) region_unmap(fmt->mem);
+  region_each(&fmt->mem) region_unmap(cur);
 
   // free all the regions
   slist_clear(&fmt->mem, region_free, region_t);
@@ -5,13 +5,16 @@
 #include "util/string.h"
 #include "util/mem.h"
 
-#include "mm/heap.h"
+#include "mm/slab.h"
 #include "errno.h"
 
 vfs_node_t *vfs_root = NULL;
 
+// object cache for the VFS nodes
+slab_cache_t vfs_node_cache = slab_cache("vfs_node", sizeof(vfs_node_t));
+
 #define __vfs_node_foreach_child(node) for (node = node->child; node != NULL; node = node->sibling)
-#define __vfs_node_free(node)          heap_free(node)
+#define __vfs_node_free(node)          slab_free(node)
 
 bool __vfs_node_deleteable(vfs_node_t *node) {
   // check the reference counter for the node
@@ -42,7 +45,7 @@ vfs_node_t *vfs_node_new(vfs_node_t *parent, char *name, fs_t *fs) {
   }
 
   // create a new VFS node for the name
-  if (NULL == (node = heap_alloc(sizeof(vfs_node_t)))) {
+  if (NULL == (node = slab_alloc(&vfs_node_cache))) {
     vfs_fail("failed to allocate memory for a new node");
     return NULL;
   }
@@ -85,6 +85,23 @@ int32_t vfs_open(vfs_node_t **node, char *path) {
   return 0;
 }
 
+int32_t vfs_reopen(vfs_node_t *node) {
+  if (NULL == node)
+    return -EINVAL;
+
+  int32_t err = 0;
+
+  // call the filesystem's open call
+  if ((err = vfs_node_open(node)) != 0) {
+    vfs_debg("failed to reopen the VFS node @ 0x%p: %s", node, strerror(err));
+    return err;
+  }
+
+  // new reference to the node, which should be closed with vfs_close()
+  node->ref_count++;
+  return 0;
+}
+
 int32_t vfs_close(vfs_node_t *node) {
   if (NULL == node)
     return -EINVAL;
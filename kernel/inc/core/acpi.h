@@ -22,7 +22,13 @@ typedef struct {
   uint8_t  bit_offset;
   uint8_t  access_size;
   uint64_t addr;
-} acpi_gas_t;
+} __attribute__((packed)) acpi_gas_t;
+
+// address spaces of the generic address structure
+enum {
+  ACPI_GAS_MEMORY = 0,
+  ACPI_GAS_IO     = 1,
+};
 
 // core/acpi/acpi.c
 int32_t acpi_load();
@@ -30,6 +36,9 @@ void   *acpi_find(char *sig, uint64_t size);
 int32_t acpi_version();
 
 // core/acpi/fadt.c
-bool acpi_supports_8042_ps2();
+bool     acpi_supports_8042_ps2();
+bool     acpi_supports_cmos_rtc();
+uint16_t acpi_pm_timer(bool *ext);
+uint8_t  acpi_century();
 
 #endif
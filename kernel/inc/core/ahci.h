@@ -1,8 +1,11 @@
 #pragma once
+#include "core/timer.h"
 #include "core/disk.h"
 #include "core/pci.h"
 
+#include "sched/task.h"
 #include "util/math.h"
+#include "util/bit.h"
 #include "types.h"
 
 extern pci_driver_t ahci_driver;
@@ -305,10 +308,12 @@ typedef struct {
 typedef struct {
   // input (used to setup the command)
   ahci_port_t *port;      // port memory
+  ahci_mem_t  *hba;       // HBA memory
   void        *vaddr;     // virtual base address of the port
   uint64_t     fis_size;  // size of the command FIS
   uint64_t     data_size; // size of the data block (bytes)
   uint8_t     *data;      // vaddr pointer to the data block to read/write
+  bool         write;     // is the data block written to the device (otherwise it's read from the device)
 
   // output (obtained after calling ahci_cmd_setup() with the input)
   int8_t                  slot;   // command slot (number of the command header that is being used)
@@ -317,10 +322,16 @@ typedef struct {
 } ahci_cmd_t;
 
 // general AHCI functions
+#define AHCI_GHC_IE           (1)                                      // interrupt enable bit of the GHC
+#define AHCI_HBA_MAX          (4)                                      // max HBA count that can use interrupts
+#define AHCI_TIMEOUT          (NSEC_PER_SEC)                           // max time to wait for the HBA or a port
+#define ahci_hba_has_irq(hba) (bit_get((hba)->ghc, AHCI_GHC_IE) == 1) // check if the HBA interrupts are enabled
+extern waitq_t ahci_waitq; // tasks waiting for an AHCI command to complete
 int32_t ahci_init(pci_device_t *dev);
 int32_t ahci_do(ahci_port_data_t *data, disk_op_t op, uint64_t lba, uint64_t sector_count, uint8_t *buf);
 
 // port functions (core/ahci/port.c)
+#define AHCI_PxIE_DONE           (0b1111 | 1 << 30) // interrupts sent when a command is done (FIS received or TFD error)
 #define ahci_port_reset_is(port) (port->is = UINT32_MAX)
 void *ahci_port_setup(ahci_port_t *port);
 bool  ahci_port_stop(ahci_port_t *port);
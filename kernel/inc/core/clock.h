@@ -0,0 +1,19 @@
+#pragma once
+#include "types.h"
+
+#ifndef __ASSEMBLY__
+
+// a free running counter that's used to keep the time (see core/clock.c)
+typedef struct clock_source {
+  const char *name;   // name of the clock source
+  uint64_t (*read)(); // read the current counter value
+  uint64_t    freq;   // frequency of the counter (Hz)
+  uint64_t    mask;   // mask of the counter bits (counter wraps around after the mask)
+} clock_source_t;
+
+int32_t  clock_init();   // select and calibrate the clock source, read the wall clock from the RTC
+void     clock_update(); // accumulate the counter into the time, so it doesn't wrap around (called every tick)
+uint64_t clock_now();    // monotonic time (in nanoseconds)
+uint64_t clock_real();   // wall clock time (in nanoseconds since the UNIX epoch)
+
+#endif
@@ -73,9 +73,14 @@ void im_init();                                  // initialize IDT with the defa
 void im_enable();                                // enable the interrupts (set interrupt)
 #define im_disable() __asm__("cli")              // disable the interrupts (clear interrupt)
 void *im_stack();                                // get the stack used for handling interrupts (TSS RSP0)
+bool  im_handling();                             // check if we are running on the interrupt stack (see im_stack())
 void  im_set_entry(uint8_t vector, uint8_t dpl); // modfiy a IDT entry
 void  im_del_handler(uint8_t vector, im_handler_func_t handler); // switch a given IDT entry with the default handler
 void  im_disable_handler(uint8_t vector, im_handler_func_t handler); // disable an interrupt handler
 void  im_enable_handler(uint8_t vector, im_handler_func_t handler);  // enable an interrupt handler
 void  im_add_handler(
      uint8_t vector, im_handler_prio_t prio, im_handler_func_t handler); // set a given IDT entry to a handler
+
+// disable the interrupts and save the previous flags, so they can be restored (interrupts are only enabled if they were)
+#define im_save(flags)    __asm__ volatile("pushfq\npop %0\ncli\n" : "=r"(flags)::"memory")
+#define im_restore(flags) __asm__ volatile("push %0\npopfq\n" ::"r"(flags) : "memory", "cc")
@@ -0,0 +1,16 @@
+#pragma once
+#include "types.h"
+
+/*
+
+ * programmable interval timer (PIT) functions
+ * see: core/pit.c
+
+*/
+#define PIT_FREQ      (1193182) // PIT input clock frequency (Hz)
+#define PIT_COUNT_MAX (65536)   // max count (0 is used for 65536)
+
+void     pit_periodic(uint32_t count); // send an interrupt every count ticks (rate generator)
+void     pit_oneshot(uint32_t count);  // send a single interrupt after count ticks (interrupt on terminal count)
+uint16_t pit_count();                  // read the current count
+bool     pit_fired();                  // check if the one-shot count reached zero (output is high)
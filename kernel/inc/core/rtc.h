@@ -0,0 +1,11 @@
+#pragma once
+#include "util/timestamp.h"
+#include "types.h"
+
+/*
+
+ * CMOS real time clock (RTC) functions
+ * see: core/rtc.c
+
+*/
+int32_t rtc_read(timestamp_t *ts); // read the current date & time as a UNIX timestamp
@@ -0,0 +1,57 @@
+#pragma once
+#include "core/clock.h"
+#include "config.h"
+#include "types.h"
+
+#define NSEC_PER_SEC  (1000000000ull)
+#define NSEC_PER_MSEC (1000000ull)
+#define NSEC_PER_TICK (NSEC_PER_SEC / CONFIG_CORE_TIMER_HZ) // (approximate) length of a timer tick
+
+#ifndef __ASSEMBLY__
+
+struct timer;
+typedef void (*timer_func_t)(struct timer *timer);
+
+/*
+
+ * timers are kept in a hierarchical timer wheel (see core/timer.c), their
+ * resolution is a timer tick, so a timer expires at the first tick after
+ * it's deadline, and it's function is called from the timer interrupt
+
+ * timer structures are owned by the caller, and they should stay around
+ * until the timer expires or it's removed with timer_del()
+
+*/
+typedef struct timer {
+  uint64_t       expires; // tick the timer expires at
+  timer_func_t   func;    // function called when the timer expires
+  void          *data;    // data for the function
+  struct timer **slot;    // wheel slot the timer is in (NULL if it's not pending)
+  struct timer  *next;    // next timer in the slot
+  struct timer  *prev;    // previous timer in the slot
+} timer_t;
+
+#define timer_pending(timer)    (NULL != (timer)->slot)
+#define timer_deadline(ns)      (clock_now() + (ns))        // get a deadline that's ns nanoseconds from now
+#define timer_expired(deadline) (clock_now() >= (deadline)) // check if the deadline passed
+
+// busy wait until the condition is true or ns nanoseconds pass, evaluates to the condition
+#define timer_wait(cond, ns)                                                                                           \
+  ({                                                                                                                   \
+    uint64_t __deadline = timer_deadline(ns);                                                                          \
+    bool     __cond     = false;                                                                                       \
+    while (!(__cond = (cond)) && !timer_expired(__deadline))                                                           \
+      __asm__("pause");                                                                                                \
+    __cond;                                                                                                            \
+  })
+
+int32_t  timer_init();                           // program the PIT and start the timer tick
+uint64_t timer_now();                            // monotonic time since the timer is initialized (in nanoseconds)
+void     timer_add(timer_t *timer, uint64_t ns); // add a timer that expires after ns nanoseconds
+void     timer_del(timer_t *timer);              // remove a pending timer
+uint64_t timer_left(timer_t *timer);             // nanoseconds left until the timer expires (0 if it's not pending)
+void     timer_sleep(uint64_t ns);               // block the current task for ns nanoseconds
+void     timer_idle_enter();                     // stop the tick, program a one-shot event for the next timer
+void     timer_idle_exit();                      // start the tick again
+
+#endif
@@ -61,6 +61,7 @@ int32_t     vfs_node_put(vfs_node_t *node);                         // put (free
 
 // fs/vfs/vfs.c
 int32_t vfs_open(vfs_node_t **node, char *path);                                   // open a path to obtain the VFS node
+int32_t vfs_reopen(vfs_node_t *node);                                              // open an already opened VFS node again
 int32_t vfs_close(vfs_node_t *node);                                               // close (free) a VFS node
 int64_t vfs_read(vfs_node_t *node, uint64_t offset, uint64_t size, void *buffer);  // read data from a node
 int64_t vfs_write(vfs_node_t *node, uint64_t offset, uint64_t size, void *buffer); // write to a node
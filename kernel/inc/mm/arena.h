@@ -0,0 +1,24 @@
+#pragma once
+#include "types.h"
+
+#ifndef __ASSEMBLY__
+
+/*
+
+ * scratch arena, a block of contiguous pages that's handed out with a bump
+ * pointer, allocations are never freed one by one, the whole arena is freed
+ * at once when it's no longer needed, so it's meant for short lived buffers
+ * that are used by a single syscall, see mm/arena.c for more information
+
+*/
+typedef struct arena {
+  uint64_t paddr; // physical address of the arena's pages
+  uint64_t num;   // number of pages in the arena
+  uint64_t pos;   // offset of the next allocation
+} arena_t;
+
+int32_t arena_init(arena_t *arena, uint64_t size); // allocate an arena that can hold size bytes
+void   *arena_alloc(arena_t *arena, uint64_t size); // allocate a buffer from the arena
+void    arena_free(arena_t *arena);                 // free the arena with all of it's buffers
+
+#endif
@@ -3,8 +3,9 @@
 
 #ifndef __ASSEMBLY__
 
-void *heap_alloc(uint64_t size);              // allocate an arbitrary sized buffer
-void *heap_realloc(void *mem, uint64_t size); // resize an arbitrary sized allocated buffer
-void  heap_free(void *mem);                   // free an arbtirary sized buffer
+void   *heap_alloc(uint64_t size);              // allocate an arbitrary sized buffer
+void   *heap_realloc(void *mem, uint64_t size); // resize an arbitrary sized allocated buffer
+void    heap_free(void *mem);                   // free an arbtirary sized buffer
+int32_t heap_register();                        // register the heapstat device
 
 #endif
@@ -1,13 +1,53 @@
 #pragma once
 #include "types.h"
 
+// page flags (see page_t)
+#define PAGE_FLAG_FREE   (1 << 0) // page is the first page of a free block
+#define PAGE_FLAG_RSVD   (1 << 1) // page is not usable, never allocated or freed
+#define PAGE_FLAG_TABLE  (1 << 2) // page is used as a page table (see pmm_table())
+#define PAGE_FLAG_DIRTY  (1 << 3) // page is modified since it's contents were loaded
+#define PAGE_FLAG_LOCKED (1 << 4) // page should stay where it is (no reclaim)
+#define PAGE_FLAG_ZERO   (1 << 5) // page is filled with zeros
+#define PAGE_FLAG_SLAB   (1 << 6) // page is a slab, owner is the slab cache
+#define PAGE_FLAG_CACHE  (1 << 7) // page is in the page cache, owner is the file
+
 #ifndef __ASSEMBLY__
 
+/*
+
+ * page frame database, every page in the available physical memory has an
+ * entry, entries are indexed by the page frame number (PFN), and they are
+ * kept small (24 bytes), so the entries of the nearby pages share cache lines
+
+*/
+typedef struct page {
+  uint32_t next;  // next free block in the list (free blocks only)
+  uint32_t prev;  // previous free block in the list (free blocks only)
+  uint16_t flags; // page flags
+  uint8_t  order; // order of the free block (free blocks only)
+  uint16_t refs;  // extra references to an allocated page (see pmm_ref())
+  union {
+    uint16_t maps; // number of page entries that map the page (user VMA and the task area only)
+    uint16_t used; // used entries of a page table (see pmm_table())
+  };
+  void *owner; // owner of the page (see the page flags)
+} page_t;
+
 // physical memory manager functions
 
-int32_t  pmm_init();                              // initialize PMM, required before using other PMM functions
-uint64_t pmm_alloc(uint64_t num, uint64_t align); // allocate specific amount of pages, aligned to a specific boundry
-int32_t  pmm_free(uint64_t paddr, uint64_t num);  // free specific amount of pages, starting at a given address
-bool     pmm_is_allocated(uint64_t paddr);        // check if the page at the given physical address is allocated
+int32_t   pmm_init();                                    // initialize PMM, required before using other PMM functions
+uint64_t  pmm_alloc(uint64_t num, uint64_t align);       // allocate specific amount of pages, aligned to a specific boundry
+int32_t   pmm_alloc_pages(uint64_t num, uint64_t *list); // allocate specific amount of pages, that are not contiguous
+int32_t   pmm_free(uint64_t paddr, uint64_t num);        // free specific amount of pages, starting at a given address
+bool      pmm_is_allocated(uint64_t paddr);              // check if the page at the given physical address is allocated
+int32_t   pmm_ref(uint64_t paddr);                       // add a reference to an allocated page, so it can be shared
+bool      pmm_is_shared(uint64_t paddr);                 // check if the page at the given physical address is shared
+int32_t   pmm_table(uint64_t paddr, uint16_t used);      // mark an allocated page as a page table with used entries
+uint16_t *pmm_table_used(uint64_t paddr);                // get the used entry counter of a page table (NULL if it has none)
+page_t   *pmm_page(uint64_t paddr);                      // get the page frame database entry of an allocated page
+uint64_t  pmm_alloc_zeroed();                            // allocate a single page that is filled with zeros
+void      pmm_zero_task();                               // kernel task that fills the pre-zeroed page pool
+int32_t   pmm_register();                                // register the pmmstat device
+void      pmm_bench();                                   // run the boot time page allocator benchmark
 
 #endif
@@ -18,23 +18,64 @@
 #define REGION_TYPE_HEAP   (4) // memory region contains heap memory
 #define REGION_TYPE_STACK  (5) // memory region contains program stack
 
+// memory region protection flags (same as the PROT_* flags used by mmap())
+#define REGION_PROT_NONE  (0)      // memory region cannot be accessed
+#define REGION_PROT_READ  (1)      // memory region can be read
+#define REGION_PROT_WRITE (1 << 1) // memory region can be written
+#define REGION_PROT_EXEC  (1 << 2) // memory region can be executed
+
 #ifndef __ASSEMBLY__
 
-// describes a memory region
+/*
+
+ * describes a memory region
+
+ * user memory regions are demand paged, mapping a region only reserves it's
+ * virtual addresses, and every page is loaded on the first access (see
+ * region_fault()), pages of the file backed regions are read from the file,
+ * rest of the pages are filled with zeros
+
+ * stack regions grow down, every stack region reserves the pages it can grow
+ * to, and an unmapped guard page below them, so an access right below the
+ * region grows it (see region_grow()), and a stack overflow hits the guard
+ * page instead of silently overwriting the memory below the stack, heap regions
+ * grow up in the same way, but only when they are resized (see region_resize())
+
+*/
 typedef struct region {
-  uint8_t        type;  // memory region type (what it's used for)
-  uint8_t        vma;   // memory region VMA
-  void          *vaddr; // memory region virtual start address
-  uint64_t       paddr; // memory region physical start address
-  uint64_t       num;   // number of pages in the region
-  struct region *next;  // next memory region
+  uint8_t          type;   // memory region type (what it's used for)
+  uint8_t          vma;    // memory region VMA
+  uint8_t          prot;   // memory region protection (see REGION_PROT_*, defaults to the type's protection)
+  void            *vaddr;  // memory region virtual start address
+  uint64_t        *paddr;  // physical address of every page in the region (0 if the page is not loaded yet)
+  uint64_t         num;    // number of pages in the region
+  uint64_t         max;    // max number of pages the region can grow to (stack and heap regions only)
+  struct vfs_node *file;   // file the region is loaded from (NULL if it's not file backed)
+  uint64_t         offset; // offset of the region's contents in the file
+  uint64_t         size;   // size of the region's contents in the file
+  struct region   *next;   // next memory region
 } region_t;
 
 region_t   *region_new(uint8_t type, uint8_t vma, void *vaddr, uint64_t num); // create a new memory region
 const char *region_name(region_t *mem);                                       // get the name of the region
 region_t   *region_copy(region_t *mem);                                       // copy a memory region with it's contents
+region_t   *region_share(region_t *mem);                                      // copy a memory region, share it's pages (copy-on-write)
+int32_t     region_fault(region_t *mem, void *vaddr, bool write);             // handle a page fault in a memory region
+int32_t     region_limit(region_t *mem, uint64_t max);                        // set the max size of a stack or a heap region
+int32_t     region_grow(region_t *mem, void *vaddr);                          // grow a stack region down to the address
+int32_t     region_resize(region_t *mem, uint64_t num);                       // resize a heap region
+region_t   *region_split(region_t *mem, uint64_t num);                        // split the region after num pages
+int32_t     region_protect(region_t *mem, uint8_t prot);                      // change the protection of the region
 void        region_free(region_t *mem);                                       // free the memory region
 
+/*
+
+ * set the file the region is loaded from, size bytes starting from the offset
+ * in the file are loaded to the start of the region, rest of it is zero filled
+
+*/
+int32_t region_file(region_t *mem, struct vfs_node *file, uint64_t offset, uint64_t size);
+
 #define region_each(list) slist_foreach(list, region_t)
 region_t *region_find(region_t **head, uint8_t type, uint8_t vma); // find a memory region in a memory region list
 int32_t   region_del(region_t **head, region_t *mem);              // delete a memory region from a memory region list
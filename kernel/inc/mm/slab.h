@@ -0,0 +1,39 @@
+#pragma once
+#include "types.h"
+
+#ifndef __ASSEMBLY__
+
+/*
+
+ * object cache, each cache hands out fixed size objects that are carved
+ * out of single page slabs, see mm/slab.c for more information
+
+ * caches are statically defined with the slab_cache() macro, so they can
+ * be used before anything else is initialized
+
+*/
+typedef struct slab_cache {
+  const char        *name;    // name of the cache
+  uint8_t            flags;   // cache flags
+  uint64_t           size;    // size of a single object (aligned)
+  uint64_t           count;   // number of objects in a single slab
+  uint64_t           offset;  // offset of the first object in a slab
+  struct slab       *partial; // slabs with some free objects
+  struct slab       *full;    // slabs with no free objects
+  struct slab       *empty;   // a single spare empty slab
+  struct slab_cache *next;    // next cache in the cache list
+} slab_cache_t;
+
+#define SLAB_CACHE_TAGS (1 << 0) // keep a 16 bit tag for every object
+
+#define slab_cache(n, s)        {.name = n, .size = s}
+#define slab_cache_tagged(n, s) {.name = n, .size = s, .flags = SLAB_CACHE_TAGS}
+
+void         *slab_alloc(slab_cache_t *cache);      // allocate an object from the cache
+void          slab_free(void *obj);                 // free an object allocated from a cache
+bool          slab_owns(void *obj);                 // check if the object is allocated from a cache
+slab_cache_t *slab_cache_of(void *obj);             // get the cache the object is allocated from
+slab_cache_t *slab_cache_next(slab_cache_t *cache); // get the next cache in the list of used caches
+uint16_t     *slab_tag(void *obj);                  // get the tag of an object from a tagged cache
+
+#endif
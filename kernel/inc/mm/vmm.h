@@ -13,29 +13,74 @@
 #define VMM_ATTR_USER     (1 << 3) // pages should be user pages (ring 3)
 #define VMM_ATTR_SAVE     (1 << 4) // pages should not free hysical pages when unmapped
 #define VMM_ATTR_REUSE    (1 << 5) // pages should reuse already mapped memory
+#define VMM_ATTR_CONTIG   (1 << 6) // pages should be physically contiguous
 
 // virutal memory areas
 #define VMM_VMA_KERNEL (1)
 #define VMM_VMA_USER   (2)
 
+#define VMM_VMA_USER_START (0x0000000000000000 + PAGE_SIZE) // 0x0 can be interpreted with NULL
+#define VMM_VMA_USER_END   (0x00007fffffffffff)
+
+#define VMM_VMA_KERNEL_START (0xffff800000000000)
+#define VMM_VMA_KERNEL_END   (BOOT_KERNEL_START_VADDR)
+
+/*
+
+ * all the available physical memory is mapped to the start of the kernel VMA
+ * (see vmm_direct_init()), the direct map has it's own 64 TiB window, which is
+ * not managed by the VMM's free ranges, so no other mapping is placed in it
+
+*/
+#define VMM_DIRECT_START (0xffff800000000000)
+#define VMM_DIRECT_END   (0xffffc00000000000)
+
+/*
+
+ * task area is a part of the kernel VMA that is not shared between the VMMs,
+ * so every VMM can map different pages to the same addresses in this area (such
+ * as the kernel stack of the task), it's not managed by the VMM's free ranges
+
+*/
+#define VMM_TASK_START (0xfffffe8000000000)
+#define VMM_TASK_END   (0xffffff0000000000)
+
 #ifndef __ASSEMBLY__
 
 int32_t vmm_init();                                  // setup all the required stuff for the VMM
 void   *vmm_new();                                   // create a new VMM
-#define vmm_free(vmm) (pmm_free(((uint64_t)vmm), 1)) // free the given VMM
+void    vmm_free(void *vmm);                         // free the given VMM
 void   *vmm_get();                                   // get the current VMM
-int32_t vmm_sync(void *vmm);                         // sync the VMM with the current VMM
 int32_t vmm_switch(void *vmm);                       // switch to a different VMM
 
 uint64_t vmm_resolve(void *vaddr); // resolve a virtual address to a physical address
 uint8_t  vmm_vma(void *vaddr);     // get the VMA of the virtual address's page
 
+int32_t vmm_direct_init(); // map all the available physical memory to the direct map
+
+#define phys_to_virt(paddr) ((void *)((uint64_t)(paddr) + VMM_DIRECT_START)) // get the direct map address of a physical address
+#define virt_to_phys(vaddr) (vmm_resolve((void *)(vaddr)))                  // get the physical address of a virtual address
+
 #define vmm_calc(size)  (div_ceil(size, PAGE_SIZE)) // calculate min page count for a given amount of memory
 #define vmm_align(size) (round_up(size, PAGE_SIZE)) // round up given size to a page size
 
-void   *vmm_map(uint64_t num, uint64_t align, uint32_t attr); // map num amount of physically aligned pages
+void   *vmm_map(uint64_t num, uint64_t align, uint32_t attr); // map num amount of pages (physically aligned, if align is set)
 int32_t vmm_unmap(void *vaddr, uint64_t num, uint32_t attr); // unmap num amount of pages from the given virtual address
 int32_t vmm_modify(void *vaddr, uint64_t num, uint32_t attr); // modify the attributes of num amount of pages
+int32_t vmm_set(void *vaddr, uint64_t num, uint64_t flags);   // set the given page entry flags of num amount of pages
+int32_t vmm_clear(void *vaddr, uint64_t num, uint64_t flags); // clear the given page entry flags of num amount of pages
+
+/*
+
+ * reserve num amount of virtual pages without mapping them, so they can be
+ * mapped later, if vaddr is 0, available virtual addresses in the VMA selected
+ * by the given attributes are used
+
+*/
+void   *vmm_reserve(uint64_t vaddr, uint64_t num, uint32_t attr);
+int32_t vmm_release(void *vaddr, uint64_t num); // release num amount of reserved (but not mapped) virtual pages
+bool    vmm_is_free(void *vaddr, uint64_t num, uint8_t vma);   // check if num amount of virtual pages in the VMA are free
+bool    vmm_vma_range(uint8_t vma, void *vaddr, uint64_t num); // check if num amount of virtual pages are in the VMA
 
 /*
 
@@ -16,27 +16,74 @@
 extern task_t *task_current;
 #define current (task_current)
 
+// software interrupt vector used to call the scheduler, so it's not counted as a timer tick
+#define SCHED_INT (0x80)
+
+/*
+
+ * call the scheduler, the kernel stack pointer is saved to the current task
+ * (task_t::ksp), as the interrupt stack is shared by all the tasks, and it may
+ * be reused before we get to run this task again, current task is loaded again
+ * after the interrupt, since we may be running as a new task (see sys_fork())
+
+*/
 #define sched()                                                                                                        \
-  __asm__("mov %%rsp, %%rax\n"                                                                                         \
-          "mov %0, %%rsp\n"                                                                                            \
-          "push %%rax\n"                                                                                               \
-          "int %1\n"                                                                                                   \
-          "pop %%rsp\n" ::"r"((uint64_t)im_stack()),                                                                   \
-      "i"(pic_to_int(PIC_IRQ_TIMER))                                                                                   \
-      : "rax")
-#define sched_prio(p)  (task_current->prio = p)
-#define sched_state(s) (task_current->state = s)
-#define sched_wait()                                                                                                   \
-  do {                                                                                                                 \
-    sched_state(TASK_STATE_WAIT);                                                                                      \
-    sched();                                                                                                           \
-  } while (0)
+  __asm__ volatile("mov task_current, %%rax\n"                                                                         \
+                   "mov %%rsp, %c0(%%rax)\n"                                                                           \
+                   "mov %1, %%rsp\n"                                                                                   \
+                   "int %2\n"                                                                                          \
+                   "mov task_current, %%rax\n"                                                                         \
+                   "mov %c0(%%rax), %%rsp\n" ::"i"(__builtin_offsetof(task_t, ksp)),                                   \
+      "r"((uint64_t)im_stack()),                                                                                       \
+      "i"(SCHED_INT)                                                                                                   \
+      : "rax", "memory")
+#define sched_prio(p)     (task_current->prio = p)
+#define sched_state(s)    (task_current->state = s)
+#define sched_sleepable() (NULL != task_current && !im_handling()) // check if the current task can block
 #define sched_hold() sched_state(TASK_STATE_HOLD)
 #define sched_done() sched_state(TASK_STATE_SAVE)
-int32_t sched_init();                             // initialize the scheduler
-task_t *sched_find(pid_t pid);                    // find a task by it's PID
-int32_t sched_exit(int32_t exit_code);            // exit the current task
-task_t *sched_next(task_t *task);                 // get the next task in the task list
-task_t *sched_child(task_t *task, task_t *child); // get the next child of the task
+
+/*
+
+ * give up the rest of the time slice, and wait for the next timer interrupt to
+ * switch to the next task, used by the kernel tasks (see sched_kernel()), which
+ * are preempted by the timer interrupt like the user tasks
+
+*/
+#define sched_yield()                                                                                                  \
+  do {                                                                                                                 \
+    task_current->ticks = 0;                                                                                           \
+    __asm__ volatile("sti\nhlt\n");                                                                                    \
+  } while (0)
+
+int32_t sched_init();                                                  // initialize the scheduler
+int32_t sched_kernel(const char *name, void (*entry)(), uint8_t prio); // create and start a new kernel task
+task_t *sched_find(pid_t pid);                                         // find a task by it's PID
+int32_t sched_exit(int32_t exit_code);                                 // exit the current task
+task_t *sched_next(task_t *task);                                      // get the next task in the task list
+task_t *sched_child(task_t *task, task_t *child);                      // get the next child of the task
+
+/*
+
+ * block the current task on the wait queue until the condition is true, the
+ * condition is checked with the interrupts disabled, so a wakeup from an
+ * interrupt handler can't be missed between the check and the sleep
+
+ * if the current task can't block (interrupt handlers), this just polls the
+ * condition, which is fine as long as the condition is a hardware state
+
+*/
+#define waitq_sleep(wq, cond)                                                                                          \
+  do {                                                                                                                 \
+    uint64_t __flags = 0;                                                                                              \
+    im_save(__flags);                                                                                                  \
+    while (!(cond))                                                                                                    \
+      __waitq_sleep(wq);                                                                                               \
+    im_restore(__flags);                                                                                               \
+  } while (0)
+
+void    __waitq_sleep(waitq_t *wq);   // block the current task on the wait queue (interrupts should be disabled)
+task_t *waitq_wake_one(waitq_t *wq); // wake up the first task in the wait queue
+void    waitq_wake_all(waitq_t *wq); // wake up all the tasks in the wait queue
 
 #endif
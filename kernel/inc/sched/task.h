@@ -1,9 +1,14 @@
 #pragma once
 
 #include "fs/vfs.h"
+#include "core/timer.h"
 
 #include "mm/region.h"
+#include "mm/paging.h"
+#include "mm/arena.h"
 #include "mm/heap.h"
+#include "mm/slab.h"
+#include "mm/vmm.h"
 
 #include "config.h"
 #include "limits.h"
@@ -15,6 +20,16 @@
 #define TASK_PRIO_MAX (63)
 #define TASK_PRIO_MIN (1)
 
+/*
+
+ * kernel stack of the user tasks is placed in the task area, so it's at the
+ * same address in every VMM, first page of the task area is it's guard page
+ * (see task_stack_alloc())
+
+*/
+#define TASK_KERNEL_STACK_START (VMM_TASK_START + PAGE_SIZE)
+#define TASK_KERNEL_STACK_END   (TASK_KERNEL_STACK_START + CONFIG_TASK_STACK_PAGES * PAGE_SIZE)
+
 #ifndef __ASSEMBLY__
 
 // different task states
@@ -22,14 +37,15 @@ enum {
   TASK_STATE_HOLD,  // task is on holding the scheduler, keep it running
   TASK_STATE_READY, // task is ready to run
   TASK_STATE_SAVE,  // task should be saved, don't modify the registers
-  TASK_STATE_WAIT,  // task is waiting on something, should be moved to end of to the queue
+  TASK_STATE_WAIT,  // task is blocked on a wait queue, should not be added back to the run queue
   TASK_STATE_DEAD,  // task is dead, should be removed from the queue
   TASK_STATE_FORK,  // task should be forked
 };
 
 // different task priorities
 enum {
-  TASK_PRIO_LOW = 1,
+  TASK_PRIO_IDLE = 0, // idle task (never in the run queue) and the background kernel tasks
+  TASK_PRIO_LOW  = 1,
   TASK_PRIO_HIGH,
   TASK_PRIO_CR1TIKAL,
 };
@@ -47,6 +63,19 @@ typedef struct task_waitq {
   struct task_waitq *next;
 } task_waitq_t;
 
+/*
+
+ * wait queue, list of tasks that are blocked until an event happens (see
+ * waitq_sleep()), tasks are linked with their run queue links, as a blocked
+ * task is never in the run queue, the event source wakes them up with
+ * waitq_wake_one() or waitq_wake_all(), which adds them back to the run queue
+
+*/
+typedef struct waitq {
+  struct task *head; // first task in the wait queue
+  struct task *tail; // last task in the wait queue
+} waitq_t;
+
 // task files (open files)
 typedef struct {
   vfs_node_t *node;   // VFS node for this file
@@ -87,15 +116,22 @@ typedef struct task {
   pid_t pid, ppid, cpid;    // PID, parent PID and last child PID
 
   task_regs_t regs;      // saved task registers
+  void       *ksp;       // saved kernel stack pointer (see sched())
   uint8_t     ticks;     // current tick counter for this task
-  uint8_t     state : 4; // state of this task (see the enum above)
-  uint8_t     prio  : 6; // task priority (also sse the enum above)
+  uint8_t     state  : 4; // state of this task (see the enum above)
+  uint8_t     prio   : 6; // task priority (also sse the enum above)
+  uint8_t     queued : 1; // task is in the run queue (see sched/sched.c)
 
   task_sighand_t sighand[SIG_MAX]; // signal handlers
   task_sigset_t *signal;           // signal queue
 
   task_waitq_t *waitq_head; // wait queue head
   task_waitq_t *waitq_tail; // wait queue tail
+  waitq_t       wait;       // tasks waiting for the children to exit (see sys_wait())
+
+  timer_t timer; // sleep timer (see timer_sleep())
+  waitq_t sleep; // task waits here while the sleep timer is pending
+  timer_t alarm; // alarm timer (see sys_alarm())
 
   int32_t      fd_last;                      // last used file descriptor
   task_file_t *files[CONFIG_TASK_FILES_MAX]; // open files
@@ -105,13 +141,17 @@ typedef struct task {
 
   region_t *mem; // memory region list
   void     *vmm; // VMM used for this task
-  bool      old; // is the VMM up-to-date
+  void     *brk; // program break (end of the heap region, see task_mem_brk())
+
+  struct task *next; // next task in the task list
+  struct task *prev; // previous task in the task list
 
-  struct task *next; // next task in the task queue
-  struct task *prev; // previous task in the task queue
+  struct task *run_next; // next task in the run queue (or the wait queue)
+  struct task *run_prev; // previous task in the run queue (or the wait queue)
 } task_t;
 
 task_t *task_new();                                  // create a new task
+task_t *task_kernel(void (*entry)());                // create a new kernel task that runs the entry function
 task_t *task_copy();                                 // copy the task
 void    task_free(task_t *task);                     // free a given task
 int32_t task_switch(task_t *task);                   // switch to given task's VMM
@@ -123,25 +163,32 @@ int32_t task_rename(task_t *task, const char *name); // rename the task
   (region_find(&task->mem, type, vma)) // find the given memory region from task's memory region list
 int32_t task_mem_del(
     task_t *task, region_t *reg); // remove and unmap a memory region from the task's memory region list
+int32_t task_mem_fault(
+    task_t *task, void *vaddr, uint64_t error); // handle a page fault in one of the task's memory regions
+int32_t task_mem_heap(task_t *task);            // create a new heap region for the task's program break
+void   *task_mem_brk(task_t *task, void *brk);  // move the task's program break, returns the new program break
+int32_t task_mem_map(task_t *task, void **vaddr, uint64_t num, uint8_t prot, bool fixed); // map anonymous memory
+int32_t task_mem_unmap(task_t *task, void *vaddr, uint64_t num);             // unmap memory from the task's regions
+int32_t task_mem_protect(task_t *task, void *vaddr, uint64_t num, uint8_t prot); // change the protection of memory
 
 // sched/signal.c
 int32_t task_signal_setup();                                             // setup the default signal handlers
 int32_t task_signal_set(task_t *task, int32_t sig, task_sighand_t hand); // set a signal handler for the task
 int32_t task_signal_add(task_t *task, int32_t sig);                      // add a signal to the task's signal queue
 int32_t task_signal_pop(task_t *task);                                   // get and handle the next signal in the queue
-#define task_signal_clear(task) slist_clear(&(task)->signal, heap_free, task_sigset_t) // free the entire signal queue
+#define task_signal_clear(task) slist_clear(&(task)->signal, slab_free, task_sigset_t) // free the entire signal queue
 
 // sched/waitq.c
 int32_t       task_waitq_add(task_t *task, task_t *child); // create a new waitq from the child and add to task's waitq
 task_waitq_t *task_waitq_pop(task_t *task);                // get next waitq in the task's wait queue
-#define task_waitq_free(waitq)    (heap_free(waitq))       // free a waitq object
+#define task_waitq_free(waitq)    (slab_free(waitq))       // free a waitq object
 #define task_waitq_clear(task)    slist_clear(&(task)->waitq_head, task_waitq_free, task_waitq_t) // free the entire waitq
 #define task_waitq_is_empty(task) ((task)->waitq_head == NULL) // check if the waitq is empty
 
 // sched/stack.c
 int32_t  task_stack_alloc(task_t *task);                           // allocate a stack for the given task
 uint64_t task_stack_add(task_t *task, void *value, uint64_t size); // add a value to the task's stack
-int32_t task_stack_add_list(task_t *task, char *list[], uint64_t limit, void **stack); // add a list to the task's stack
+int64_t task_stack_args(task_t *task, char *argv[], char *envp[], arena_t *arena, void **image); // build argv/envp for the task's stack
 void   *task_stack_get(task_t *task, uint8_t vma);
 
 // sched/file.c
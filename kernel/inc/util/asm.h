@@ -17,6 +17,15 @@ uint64_t _get_cr4();
 void     _msr_write(uint32_t msr, uint64_t val);
 uint64_t _msr_read(uint32_t msr);
 
+uint64_t _rdtsc();
+
+#define CPUID_EAX 0 // index of the EAX register in the _cpuid() output
+#define CPUID_EBX 1 // index of the EBX register in the _cpuid() output
+#define CPUID_ECX 2 // index of the ECX register in the _cpuid() output
+#define CPUID_EDX 3 // index of the EDX register in the _cpuid() output
+
+void _cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]); // run CPUID, store EAX, EBX, ECX and EDX to regs
+
 void _hang();
 
 #endif
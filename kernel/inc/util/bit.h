@@ -2,3 +2,11 @@
 
 #define bit_set(t, b, v) (t) = (((t) & ~(1 << (b))) | (((v) << (b)) & (1 << (b))))
 #define bit_get(t, b)    (((t) >> (b)) & 1)
+
+// index of the highest set bit, value should not be zero
+#define bit_last(v)                                                                                                    \
+  ({                                                                                                                   \
+    uint64_t __last = 0;                                                                                               \
+    __asm__("bsr %1, %0" : "=r"(__last) : "rm"((uint64_t)(v)));                                                        \
+    __last;                                                                                                            \
+  })
@@ -80,7 +80,7 @@
         if (entry != cur->next)                                                                                        \
           continue;                                                                                                    \
         if (NULL != cur->next->next)                                                                                   \
-          cur->next->next->prev = cur->prev;                                                                           \
+          cur->next->next->prev = cur;                                                                                 \
         cur->next = cur->next->next;                                                                                   \
         break;                                                                                                         \
       }                                                                                                                \
@@ -0,0 +1,37 @@
+#pragma once
+#include "types.h"
+
+#ifndef __ASSEMBLY__
+
+/*
+
+ * address ordered range tree, see util/range.c
+
+ * every node describes a range (start and size), the tree is ordered
+ * by the start address, and each node also stores the size of the largest
+ * range in it's subtree, so we can find a free range that fits a given
+ * size in O(log n)
+
+ * nodes are not allocated by the tree, the caller owns them, so they can
+ * be stored anywhere, even in the free memory the range describes
+
+*/
+typedef struct range {
+  uint64_t      start; // start address of the range
+  uint64_t      size;  // size of the range
+  uint64_t      max;   // largest range size in the subtree
+  struct range *left;  // ranges with lower addresses
+  struct range *right; // ranges with higher addresses
+} range_t;
+
+#define range_end(r)      ((r)->start + (r)->size)
+#define range_largest(rt) (NULL == (rt) ? 0 : (rt)->max)
+
+void     range_insert(range_t **root, range_t *node); // insert a range to the tree
+void     range_remove(range_t **root, range_t *node); // remove a range from the tree
+range_t *range_fit(range_t *root, uint64_t size, uint64_t align); // find the lowest range that fits
+range_t *range_floor(range_t *root, uint64_t addr); // find the range with the largest start <= addr
+range_t *range_ceil(range_t *root, uint64_t addr);  // find the range with the smallest start >= addr
+uint64_t range_count(range_t *root);                // count the ranges in the tree
+
+#endif
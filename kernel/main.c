@@ -34,17 +34,21 @@
 #include "sched/task.h"
 
 #include "core/serial.h"
+#include "core/clock.h"
+#include "core/timer.h"
 #include "core/pci.h"
 #include "core/pic.h"
 #include "core/ps2.h"
 #include "core/tty.h"
 #include "core/im.h"
 
+#include "mm/heap.h"
 #include "mm/pmm.h"
 #include "mm/vmm.h"
 
 #include "syscall.h"
 #include "fs/vfs.h"
+#include "config.h"
 #include "video.h"
 
 void entry() {
@@ -66,6 +70,14 @@ void entry() {
   if ((err = pmm_init()) != 0)
     panic("Failed to initialize physical memory manager: %s", strerror(err));
 
+  // map all the available physical memory to the kernel VMA
+  if ((err = vmm_direct_init()) != 0)
+    panic("Failed to create the physical memory direct map: %s", strerror(err));
+
+  // run the page allocator benchmark (if enabled)
+  if (CONFIG_BENCH)
+    pmm_bench();
+
   // initialize framebuffer video driver
   if ((err = video_init(VIDEO_MODE_FRAMEBUFFER)) != 0)
     pfail("Failed to initialize the framebuffer video mode: %s", strerror(err));
@@ -101,6 +113,10 @@ void entry() {
   // enable the interrupts
   im_enable();
 
+  // start the timer tick
+  if ((err = timer_init()) != 0)
+    panic("Failed to initialize the timer: %s", strerror(err));
+
   // initialize the scheduler
   if ((err = sched_init()) != 0)
     panic("Failed to start the scheduler: %s", strerror(err));
@@ -108,6 +124,10 @@ void entry() {
   // make current task (us) critikal
   sched_prio(TASK_PRIO_CR1TIKAL);
 
+  // start the kernel task that fills the pre-zeroed page pool, it only runs when there is nothing else to run
+  if ((err = sched_kernel("zero", pmm_zero_task, TASK_PRIO_IDLE)) != 0)
+    pfail("Failed to start the page zeroing task: %s", strerror(err));
+
   /*
 
    * load ACPI, some devices we are gonna load/register next may need to use
@@ -117,6 +137,10 @@ void entry() {
   if ((err = acpi_load()) != 0)
     pfail("Failed to load ACPI: %s", strerror(err));
 
+  // select the clock source (some of them are found with ACPI) and read the wall clock
+  if ((err = clock_init()) != 0)
+    pfail("Failed to initialize the clock: %s", strerror(err));
+
   // initialize peripheral component interconnect (PCI) devices
   if ((err = pci_init()) != 0)
     pfail("Failed to initialize PCI: %s", strerror(err));
@@ -129,6 +153,12 @@ void entry() {
   if ((err = serial_register()) != 0)
     pfail("Failed to register serial devices: %s", strerror(err));
 
+  if ((err = heap_register()) != 0)
+    pfail("Failed to register the heap device: %s", strerror(err));
+
+  if ((err = pmm_register()) != 0)
+    pfail("Failed to register the PMM device: %s", strerror(err));
+
   /*
 
    * look for an available root filesystem and mount it
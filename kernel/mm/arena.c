@@ -0,0 +1,66 @@
+#include "mm/arena.h"
+#include "mm/paging.h"
+#include "mm/pmm.h"
+#include "mm/vmm.h"
+
+#include "util/math.h"
+#include "util/mem.h"
+
+#include "errno.h"
+#include "types.h"
+
+/*
+
+ * arena pages are allocated as a single contiguous block and accessed through
+ * the direct map, so creating and freeing an arena are both a single PMM call
+ * regardless of how many buffers are allocated from it, and the allocations
+ * do not depend on the state (fragmentation) of the heap
+
+ * buffers are aligned to 8 bytes, and they are not zeroed
+
+*/
+
+#define ARENA_ALIGN (8)
+
+int32_t arena_init(arena_t *arena, uint64_t size) {
+  if (NULL == arena)
+    return -EINVAL;
+
+  bzero(arena, sizeof(arena_t));
+
+  if (size == 0)
+    return 0;
+
+  arena->num = div_ceil(size, PAGE_SIZE);
+
+  if ((arena->paddr = pmm_alloc(arena->num, 0)) == 0) {
+    arena->num = 0;
+    return -ENOMEM;
+  }
+
+  return 0;
+}
+
+void *arena_alloc(arena_t *arena, uint64_t size) {
+  void *buf = NULL;
+
+  if (NULL == arena || size > arena->num * PAGE_SIZE - arena->pos)
+    return NULL;
+
+  buf = phys_to_virt(arena->paddr) + arena->pos;
+  arena->pos += round_up(size, ARENA_ALIGN);
+
+  // the last buffer may not be aligned to the end of the arena
+  if (arena->pos > arena->num * PAGE_SIZE)
+    arena->pos = arena->num * PAGE_SIZE;
+
+  return buf;
+}
+
+void arena_free(arena_t *arena) {
+  if (NULL == arena || arena->num == 0)
+    return;
+
+  pmm_free(arena->paddr, arena->num);
+  bzero(arena, sizeof(arena_t));
+}
@@ -1,10 +1,15 @@
 #include "mm/heap.h"
+#include "mm/slab.h"
 #include "mm/vmm.h"
 
+#include "fs/devfs.h"
+
+#include "util/range.h"
 #include "util/printk.h"
 #include "util/panic.h"
 #include "util/math.h"
 #include "util/mem.h"
+#include "util/string.h"
 
 #include "errno.h"
 #include "types.h"
@@ -13,269 +18,518 @@
 #define heap_warn(f, ...) pwarn("Heap: " f, ##__VA_ARGS__)
 #define heap_debg(f, ...) pdebg("Heap: " f, ##__VA_ARGS__)
 
-#define HEAP_CHUNK_MAGIC     0xa71e394b53a81759
-#define HEAP_CHUNK_DATA_SIZE (16)
-#define HEAP_CHUNK_META_SIZE (sizeof(struct heap_chunk) - HEAP_CHUNK_DATA_SIZE)
-#define HEAP_CHUNK_PER_PAGE  (PAGE_SIZE / sizeof(struct heap_chunk))
+#define HEAP_CHUNK_MAGIC  0xa71e394b
+#define HEAP_PAGES_MAGIC  0x3c0ffa8e
+#define HEAP_CHUNK_ALIGN  (16)
+#define HEAP_CHUNK_HEADER (sizeof(struct heap_chunk))
+#define HEAP_CHUNK_MIN    (round_up(sizeof(range_t), HEAP_CHUNK_ALIGN))
+#define HEAP_CHUNK_MAX    (PAGE_SIZE - HEAP_CHUNK_HEADER)
 
 /*
 
- * free memory is split into chunks, each chunk consists of these
- * two fields:
- * - meta (16 bytes): stores metadata information about the chunk
- * - data (16 bytes): actual data stored in the chunk
+ * heap memory is split into chunks, a chunk is either used or free
+
+ * a used chunk starts with a small header, which stores a magic value
+ * that's used to verify the chunk when it's later feed to heap_free(),
+ * the allocation site (see heap_sites) and the size of the entire chunk
+ * (header included), rest of the chunk is the actual data
 
- * when the chunk is free (not used) "meta" stores the next and previous
- * chunk's address (so it points to the next and the previous chunk), which
- * creates a doubly linked list
+ * a free chunk stores a range tree node (see util/range.c) in itself, all
+ * the free chunks are kept in an address ordered range tree, so we can find
+ * a free chunk that fits the allocation, and the free chunks that are next
+ * to the chunk we are freeing in O(log n), which lets us merge (coalesce)
+ * the neighbouring free chunks into a single free chunk
 
- * when memory is allocated, we combine these small chunks together and remove
- * them from this doubly linked list of chunks, so when the chunk is used (not
- * free) "meta" stores a magic value that's used to verify the allocated chunk
- * when later it's feed to heap_free, and it also stores the combined chunk's
- * size
+ * allocations larger than a page do not use the chunks at all, they are
+ * directly mapped with vmm_map(), header of these allocations store a
+ * different magic value and the page count instead of the size
 
  * also thompson loot lama huge chungus amongus
 
 */
 
 struct heap_chunk {
-  uint64_t meta[2];                    // metadata information about the current chunk
-  char     data[HEAP_CHUNK_DATA_SIZE]; // data in the chunk
+  uint32_t magic; // used to verify the chunk
+  uint32_t site;  // allocation site index
+  uint64_t size;  // size of the chunk (or the page count)
 };
 
-#define __heap_chunk_meta_next(chunk)           ((struct heap_chunk *)chunk->meta[0])
-#define __heap_chunk_meta_next_set(chunk, next) (chunk->meta[0] = (uint64_t)(next))
+#define __heap_chunk_from_mem(mem)    ((struct heap_chunk *)((void *)(mem) - HEAP_CHUNK_HEADER))
+#define __heap_chunk_to_mem(chunk)    ((void *)(chunk) + HEAP_CHUNK_HEADER)
+#define __heap_chunk_data_size(chunk) ((chunk)->size - HEAP_CHUNK_HEADER)
 
-#define __heap_chunk_meta_prev(chunk)           ((struct heap_chunk *)chunk->meta[1])
-#define __heap_chunk_meta_prev_set(chunk, prev) (chunk->meta[1] = (uint64_t)(prev))
+range_t *heap_free_root = NULL; // address ordered tree of free chunks
 
-#define __heap_chunk_meta_size(chunk)           (chunk->meta[1])
-#define __heap_chunk_meta_size_set(chunk, size) (chunk->meta[1] = (uint64_t)(size))
+/*
 
-#define __heap_chunk_is_magical(chunk) (chunk->meta[0] == HEAP_CHUNK_MAGIC)
-#define __heap_chunk_data_clear(chunk) (bzero((chunk)->data, HEAP_CHUNK_DATA_SIZE))
+ * heap statistics, these are reported by the heapstat device
 
-struct heap_chunk *heap_chunk_first = NULL;
-struct heap_chunk *heap_chunk_last  = NULL;
+ * free chunk count and free bytes are updated as the free chunk tree is
+ * modified, so the device doesn't need to walk the entire tree
 
-int32_t __heap_extend() {
-  struct heap_chunk *cur = vmm_map(1, 0, 0);
+*/
+struct heap_stats {
+  uint64_t used;        // bytes used by the live allocations
+  uint64_t free;        // bytes in the free chunks
+  uint64_t free_chunks; // number of free chunks
+  uint64_t pages;       // pages obtained by extending the heap
+  uint64_t allocs;      // total number of allocations
+  uint64_t frees;       // total number of frees
+} heap_stats;
 
-  if (NULL == cur) {
-    heap_fail("failed to allocate a new page for extending the heap");
-    return -EFAULT;
-  }
+/*
 
-  if (NULL == heap_chunk_first)
-    heap_chunk_first = cur;
+ * every allocation is accounted to it's allocation site, which is the
+ * return address of the heap_alloc() (or heap_realloc()) call, sites are
+ * stored in a fixed size open addressing hash table, so the accounting
+ * never needs to allocate memory itself
 
-  if (NULL != heap_chunk_last)
-    __heap_chunk_meta_next_set(heap_chunk_last, cur);
+ * index of the allocation's site is stored in the chunk header, or in the
+ * object's slab tag for the size class allocations, so when freed, we can
+ * find the site in O(1)
 
-  __heap_chunk_meta_prev_set(cur, heap_chunk_last);
+ * first entry is reserved for the allocations we can't track, which only
+ * happens when the table is full
 
-  for (uint8_t i = 0; i < HEAP_CHUNK_PER_PAGE; i++, cur++) {
-    __heap_chunk_data_clear(cur);
-    if (i != 0)
-      __heap_chunk_meta_prev_set(cur, cur - 1);
-    __heap_chunk_meta_next_set(cur, cur + 1);
-  }
+*/
+struct heap_site {
+  void    *caller; // return address of the caller
+  uint64_t live;   // number of live allocations
+  uint64_t total;  // total number of allocations
+  uint64_t bytes;  // bytes used by the live allocations
+};
+
+#define HEAP_SITE_MAX (512)
+struct heap_site heap_sites[HEAP_SITE_MAX];
+
+uint16_t __heap_site(void *caller) {
+  uint64_t indx = ((uint64_t)caller * 0x9e3779b97f4a7c15) >> 55;
+
+  for (uint16_t i = 0; i < HEAP_SITE_MAX; i++, indx = (indx + 1) % HEAP_SITE_MAX) {
+    if (indx == 0)
+      continue;
+
+    if (heap_sites[indx].caller == caller)
+      return indx;
 
-  __heap_chunk_meta_next_set((heap_chunk_last = cur - 1), NULL);
+    if (NULL == heap_sites[indx].caller) {
+      heap_sites[indx].caller = caller;
+      return indx;
+    }
+  }
 
   return 0;
 }
 
-struct heap_chunk *__heap_chunk_next(struct heap_chunk *cur) {
-  if (NULL == heap_chunk_first || NULL == heap_chunk_last)
-    __heap_extend();
+void __heap_account_alloc(uint16_t site, uint64_t bytes) {
+  heap_sites[site].live++;
+  heap_sites[site].total++;
+  heap_sites[site].bytes += bytes;
 
-  if (NULL == cur)
-    return heap_chunk_first;
+  heap_stats.allocs++;
+  heap_stats.used += bytes;
+}
 
-  if (NULL == __heap_chunk_meta_next(cur))
-    __heap_extend();
+void __heap_account_free(uint16_t site, uint64_t bytes) {
+  heap_sites[site].live--;
+  heap_sites[site].bytes -= bytes;
 
-  return __heap_chunk_meta_next(cur);
+  heap_stats.frees++;
+  heap_stats.used -= bytes;
 }
 
-void *heap_alloc(uint64_t size) {
-  struct heap_chunk *cur = NULL, *start = NULL, *end = NULL;
-  uint64_t           total_size = 0;
-
-  for (cur = __heap_chunk_next(cur); NULL != cur && total_size < size; end = cur, cur = __heap_chunk_next(cur)) {
-    // first chunk? we can only use the "data" part of the chunk for storing data
-    if (NULL == start) {
-      total_size += HEAP_CHUNK_DATA_SIZE;
-      start = cur;
-      continue;
-    }
+/*
 
-    /*
+ * small allocations don't use the chunks, they are served from the size
+ * class slab caches (see mm/slab.c), allocation is rounded up to the
+ * smallest size class it fits in, so both heap_alloc() and heap_free()
+ * are O(1) for them, only the allocations larger than the largest size
+ * class go through the free chunk tree
 
-     * make sure the chunk is contiguous with the previous one
-     * if not, we'll need a new starting point, we can't fit the
-     * allocation here
+*/
+slab_cache_t heap_caches[] = {
+    slab_cache_tagged("heap-16", 16),
+    slab_cache_tagged("heap-32", 32),
+    slab_cache_tagged("heap-48", 48),
+    slab_cache_tagged("heap-64", 64),
+    slab_cache_tagged("heap-96", 96),
+    slab_cache_tagged("heap-128", 128),
+    slab_cache_tagged("heap-192", 192),
+    slab_cache_tagged("heap-256", 256),
+    slab_cache_tagged("heap-384", 384),
+    slab_cache_tagged("heap-512", 512),
+    slab_cache_tagged("heap-768", 768),
+    slab_cache_tagged("heap-1024", 1024),
+};
 
-    */
-    if (end + 1 != cur) {
-      total_size = 0;
-      start      = NULL;
-      continue;
-    }
+#define HEAP_CACHE_COUNT (sizeof(heap_caches) / sizeof(heap_caches[0]))
+#define HEAP_CACHE_MAX   (1024)
+
+slab_cache_t *__heap_cache(uint64_t size) {
+  if (size > HEAP_CACHE_MAX)
+    return NULL;
+
+  for (uint8_t i = 0; i < HEAP_CACHE_COUNT; i++)
+    if (size <= heap_caches[i].size)
+      return &heap_caches[i];
+
+  return NULL;
+}
+
+// add a free range to the free chunk tree, merge it with it's neighbours
+void __heap_free_range(uint64_t start, uint64_t size) {
+  range_t *cur = NULL;
 
-    // not the first chunk, so we can use the entire chunk for storing data
-    total_size += sizeof(struct heap_chunk);
+  heap_stats.free += size;
+
+  // merge with the previous free chunk, if it ends where this one starts
+  if (NULL != (cur = range_floor(heap_free_root, start)) && range_end(cur) == start) {
+    range_remove(&heap_free_root, cur);
+    heap_stats.free_chunks--;
+    start = cur->start;
+    size += cur->size;
   }
 
-  if (NULL == cur || size > total_size) {
-    heap_fail("%u byte allocation failed", size);
-    return NULL;
+  // merge with the next free chunk, if it starts where this one ends
+  if (NULL != (cur = range_ceil(heap_free_root, start + size)) && cur->start == start + size) {
+    range_remove(&heap_free_root, cur);
+    heap_stats.free_chunks--;
+    size += cur->size;
   }
 
-  /*
+  cur        = (void *)start;
+  cur->start = start;
+  cur->size  = size;
 
-   * this removes the previous chunk's reference to start chunk
-   * so this is basically: start->prev->next = end->next
+  range_insert(&heap_free_root, cur);
+  heap_stats.free_chunks++;
+}
 
-  */
-  if ((cur = __heap_chunk_meta_prev(start)) != NULL)
-    __heap_chunk_meta_next_set(cur, __heap_chunk_meta_next(end));
+// take size bytes from the start of a free chunk, rest stays free
+uint64_t __heap_take_range(range_t *range, uint64_t size) {
+  uint64_t start = range->start, total = range->size;
 
-  /*
+  range_remove(&heap_free_root, range);
+  heap_stats.free_chunks--;
 
-   * this removes the next chunk's reference to end chunk
-   * so this is basically: end->next->prev = start->prev
+  // remaining part is too small to be a free chunk, use the entire chunk
+  if (total - size < HEAP_CHUNK_MIN) {
+    heap_stats.free -= total;
+    return total;
+  }
 
-  */
-  if ((cur = __heap_chunk_meta_next(end)) != NULL)
-    __heap_chunk_meta_prev_set(cur, __heap_chunk_meta_prev(start));
+  range        = (void *)start + size;
+  range->start = start + size;
+  range->size  = total - size;
 
-  // if start is the first chunk, set first chunk to end->next
-  if (heap_chunk_first == start)
-    heap_chunk_first = __heap_chunk_meta_next(end);
+  range_insert(&heap_free_root, range);
+  heap_stats.free_chunks++;
+  heap_stats.free -= size;
 
-  // if end is the last chunk, set last chunk to start->prev
-  if (heap_chunk_last == end)
-    heap_chunk_last = __heap_chunk_meta_prev(start);
+  return size;
+}
 
-  // setup start chunk's metadata
-  start->meta[0] = HEAP_CHUNK_MAGIC;
-  start->meta[1] = total_size;
+int32_t __heap_extend() {
+  void *page = vmm_map(1, 0, 0);
 
-  return (void *)start + HEAP_CHUNK_META_SIZE;
-}
+  if (NULL == page) {
+    heap_fail("failed to allocate a new page for extending the heap");
+    return -EFAULT;
+  }
 
-void *heap_realloc(void *mem, uint64_t size) {
-  struct heap_chunk *realloc_start = NULL, *realloc_end = NULL;
-  struct heap_chunk *start = NULL, *cur = NULL;
-  uint64_t           total_size = 0;
+  __heap_free_range((uint64_t)page, PAGE_SIZE);
+  heap_stats.pages++;
+
+  return 0;
+}
 
-  start       = mem - HEAP_CHUNK_META_SIZE;
-  realloc_end = mem + __heap_chunk_meta_size(start) - sizeof(struct heap_chunk);
+void *__heap_alloc_pages(uint64_t size, uint16_t site) {
+  uint64_t           num   = vmm_calc(size + HEAP_CHUNK_HEADER);
+  struct heap_chunk *chunk = vmm_map(num, 0, 0);
 
-  if (HEAP_CHUNK_META_SIZE > (uint64_t)mem || !__heap_chunk_is_magical(start)) {
-    panic("Attempt to reallocate an invalid chunk");
+  if (NULL == chunk) {
+    heap_fail("failed to map %u pages for a %u byte allocation", num, size);
     return NULL;
   }
 
-  if ((total_size = __heap_chunk_meta_size(start)) >= size)
-    return mem;
+  chunk->magic = HEAP_PAGES_MAGIC;
+  chunk->site  = site;
+  chunk->size  = num;
 
-  // attempt to extend the memory buffer by moving the end chunk
-  for (cur = heap_chunk_first; size > total_size && cur != NULL; cur = __heap_chunk_meta_next(cur)) {
-    /*
+  __heap_account_alloc(site, num * PAGE_SIZE);
+  return __heap_chunk_to_mem(chunk);
+}
 
-     * check if the current chunk is contiguous with the end chunk
-     * if so move end chunk to current chunk and extend the size of
-     * the memory buffer by a single chunk
+void *__heap_alloc(uint64_t size, void *caller) {
+  struct heap_chunk *chunk = NULL;
+  slab_cache_t      *cache = NULL;
+  range_t           *range = NULL;
+  uint16_t           site  = __heap_site(caller);
+  uint16_t          *tag   = NULL;
+  void              *obj   = NULL;
+
+  // see if we can use a size class cache
+  if (NULL != (cache = __heap_cache(size))) {
+    if (NULL == (obj = slab_alloc(cache)))
+      return NULL;
+
+    // only the tagged caches keep the allocation site
+    if (NULL != (tag = slab_tag(obj))) {
+      *tag = site;
+      __heap_account_alloc(site, cache->size);
+    }
 
-    */
+    return obj;
+  }
 
-    if (realloc_end + 1 != cur)
-      continue;
+  // allocations larger than a page directly use the pages
+  if (size > HEAP_CHUNK_MAX)
+    return __heap_alloc_pages(size, site);
 
-    realloc_end = cur;
-    total_size += sizeof(struct heap_chunk);
+  size = round_up(size + HEAP_CHUNK_HEADER, HEAP_CHUNK_ALIGN);
 
-    if (NULL == realloc_start)
-      realloc_start = realloc_end;
+  // find the lowest free chunk that fits, extend the heap if there is none
+  while (NULL == (range = range_fit(heap_free_root, size, 0))) {
+    if (__heap_extend() != 0) {
+      heap_fail("%u byte allocation failed", size);
+      return NULL;
+    }
   }
 
+  chunk        = (void *)range->start;
+  chunk->size  = __heap_take_range(range, size);
+  chunk->magic = HEAP_CHUNK_MAGIC;
+  chunk->site  = site;
+
+  __heap_account_alloc(site, chunk->size);
+  return __heap_chunk_to_mem(chunk);
+}
+
+void *heap_alloc(uint64_t size) {
+  return __heap_alloc(size, __builtin_return_address(0));
+}
+
+void *heap_realloc(void *mem, uint64_t size) {
+  struct heap_chunk *chunk = NULL;
+  slab_cache_t      *cache = NULL;
+  range_t           *next  = NULL;
+  uint64_t           cur = 0, need = 0, end = 0;
+  void              *new = NULL;
+
+  if (NULL == mem)
+    return __heap_alloc(size, __builtin_return_address(0));
+
   /*
 
-   * if we fail to extend the buffer by moving the end chunk then we'll
-   * allocate a new buffer with the new size and copy old buffer's content
-   * to the new buffer, then heap_free() the old buffer
+   * if the memory is allocated from a size class cache, we cannot extend
+   * it, so move it to a larger allocation (unless it already fits)
 
   */
-  if (size > total_size) {
-    cur = heap_alloc(size);
-    memcpy(cur, mem, __heap_chunk_meta_size(start));
-    heap_free(mem);
-    return cur;
+  if (NULL != (cache = slab_cache_of(mem))) {
+    if (cache->size >= size)
+      return mem;
+
+    cur = cache->size;
+    goto move;
   }
 
+  if (HEAP_CHUNK_HEADER > (uint64_t)mem) {
+    panic("Attempt to reallocate an invalid chunk");
+    return NULL;
+  }
+
+  chunk = __heap_chunk_from_mem(mem);
+
+  // allocation directly uses the pages, see if it still fits in them
+  if (chunk->magic == HEAP_PAGES_MAGIC) {
+    if ((cur = chunk->size * PAGE_SIZE - HEAP_CHUNK_HEADER) >= size)
+      return mem;
+    goto move;
+  }
+
+  if (chunk->magic != HEAP_CHUNK_MAGIC) {
+    panic("Attempt to reallocate an invalid chunk");
+    return NULL;
+  }
+
+  if ((cur = __heap_chunk_data_size(chunk)) >= size)
+    return mem;
+
   /*
 
-   * this part is similar to heap_alloc(), we just remove references
-   * to the new chunks we allocated
+   * attempt to extend the chunk in place, this is only possible if the
+   * chunk right after it is free and it's large enough for the rest
 
   */
-  if ((cur = __heap_chunk_meta_prev(realloc_start)) != NULL)
-    __heap_chunk_meta_next_set(cur, __heap_chunk_meta_next(realloc_end));
+  if (size <= HEAP_CHUNK_MAX) {
+    need = round_up(size + HEAP_CHUNK_HEADER, HEAP_CHUNK_ALIGN);
+    end  = (uint64_t)chunk + chunk->size;
+    next = range_ceil(heap_free_root, end);
+
+    if (NULL != next && next->start == end && chunk->size + next->size >= need) {
+      need = __heap_take_range(next, need - chunk->size);
 
-  if ((cur = __heap_chunk_meta_next(realloc_end)) != NULL)
-    __heap_chunk_meta_prev_set(cur, __heap_chunk_meta_prev(realloc_start));
+      chunk->size += need;
+      heap_sites[chunk->site].bytes += need;
+      heap_stats.used += need;
 
-  if (heap_chunk_first == realloc_end)
-    heap_chunk_first = __heap_chunk_meta_next(realloc_end);
+      return mem;
+    }
+  }
 
-  if (heap_chunk_last == realloc_start)
-    heap_chunk_last = __heap_chunk_meta_prev(realloc_start);
+move:
+  /*
 
-  // update the size of the chunk
-  __heap_chunk_meta_size(start) = total_size;
-  return mem;
+   * if we fail to extend the buffer in place, then we'll allocate a new
+   * buffer with the new size and copy old buffer's content to the new
+   * buffer, then heap_free() the old buffer
+
+  */
+  if (NULL != (new = __heap_alloc(size, __builtin_return_address(0)))) {
+    memcpy(new, mem, cur);
+    heap_free(mem);
+  }
+
+  return new;
 }
 
 void heap_free(void *mem) {
+  struct heap_chunk *chunk = NULL;
+  slab_cache_t      *cache = NULL;
+  uint16_t          *tag   = NULL;
+
   if (NULL == mem)
     return;
 
-  struct heap_chunk *start = NULL, *end = NULL, *cur = NULL;
+  // free the memory allocated from a size class cache
+  if (NULL != (cache = slab_cache_of(mem))) {
+    if (NULL != (tag = slab_tag(mem)))
+      __heap_account_free(*tag, cache->size);
 
-  start = mem - HEAP_CHUNK_META_SIZE;
-  end   = mem + __heap_chunk_meta_size(start) - sizeof(struct heap_chunk);
+    return slab_free(mem);
+  }
 
-  if (HEAP_CHUNK_META_SIZE > (uint64_t)mem || !__heap_chunk_is_magical(start))
+  if (HEAP_CHUNK_HEADER > (uint64_t)mem)
     return panic("Attempt to free an invalid chunk");
 
-  for (cur = start; cur <= end; cur++) {
-    if (cur != start)
-      __heap_chunk_meta_prev_set(cur, cur - 1);
-    __heap_chunk_meta_next_set(cur, cur + 1);
+  chunk = __heap_chunk_from_mem(mem);
+
+  // unmap the pages used by the large allocation
+  if (chunk->magic == HEAP_PAGES_MAGIC) {
+    __heap_account_free(chunk->site, chunk->size * PAGE_SIZE);
+    chunk->magic = 0;
+    vmm_unmap(chunk, chunk->size, 0);
+    return;
   }
 
-  __heap_chunk_meta_prev_set(start, NULL);
-  __heap_chunk_meta_next_set(end, NULL);
+  if (chunk->magic != HEAP_CHUNK_MAGIC)
+    return panic("Attempt to free an invalid chunk");
+
+  __heap_account_free(chunk->site, chunk->size);
+  chunk->magic = 0;
+
+  __heap_free_range((uint64_t)chunk, chunk->size);
+}
+
+/*
+
+ * heapstat device, reading it returns a text report of the heap statistics
+ * and the allocation sites, report is generated on every read, and only the
+ * part that falls into the requested range is copied to the buffer, so we
+ * don't need to allocate (and affect the heap state) while reporting
+
+*/
+struct heap_report {
+  char    *buf;    // buffer the report is copied to
+  uint64_t offset; // offset of the buffer in the report
+  uint64_t size;   // size of the buffer
+  uint64_t pos;    // current position in the report
+};
+
+void __heap_report_str(struct heap_report *report, char *str) {
+  for (; *str != 0; str++, report->pos++)
+    if (report->pos >= report->offset && report->pos < report->offset + report->size)
+      report->buf[report->pos - report->offset] = *str;
+}
+
+void __heap_report_num(struct heap_report *report, char *name, uint64_t num, char *end) {
+  char str[21];
+
+  itou(num, str);
+
+  if (NULL != name)
+    __heap_report_str(report, name);
+
+  __heap_report_str(report, str);
+  __heap_report_str(report, end);
+}
+
+int32_t __heapstat_open(fs_inode_t *inode) {
+  return 0;
+}
+
+int32_t __heapstat_close(fs_inode_t *inode) {
+  return 0;
+}
+
+int64_t __heapstat_read(fs_inode_t *inode, uint64_t offset, uint64_t size, void *buffer) {
+  struct heap_report report = {.buf = buffer, .offset = offset, .size = size, .pos = 0};
+  uint64_t           frag   = 0;
+  char               addr[17];
+
+  // fragmentation is the percentage of the free memory outside the largest free chunk
+  if (heap_stats.free != 0)
+    frag = 100 - (range_largest(heap_free_root) * 100) / heap_stats.free;
 
-  for (cur = heap_chunk_first; cur != NULL; cur = __heap_chunk_meta_next(cur)) {
-    if (start > cur)
-      __heap_chunk_meta_prev_set(start, cur);
+  __heap_report_num(&report, "used: ", heap_stats.used, "\n");
+  __heap_report_num(&report, "free: ", heap_stats.free, "\n");
+  __heap_report_num(&report, "free chunks: ", heap_stats.free_chunks, "\n");
+  __heap_report_num(&report, "largest free: ", range_largest(heap_free_root), "\n");
+  __heap_report_num(&report, "fragmentation: ", frag, "%\n");
+  __heap_report_num(&report, "pages: ", heap_stats.pages, "\n");
+  __heap_report_num(&report, "allocs: ", heap_stats.allocs, "\n");
+  __heap_report_num(&report, "frees: ", heap_stats.frees, "\n");
 
-    if (__heap_chunk_meta_prev(start) == __heap_chunk_meta_prev(cur) && end < cur)
-      __heap_chunk_meta_next_set(end, cur);
+  __heap_report_str(&report, "\ncaller live total bytes\n");
+
+  for (uint16_t i = 0; i < HEAP_SITE_MAX; i++) {
+    if (heap_sites[i].total == 0)
+      continue;
+
+    itoh((uint64_t)heap_sites[i].caller, addr);
+
+    __heap_report_str(&report, "0x");
+    __heap_report_str(&report, addr);
+    __heap_report_num(&report, " ", heap_sites[i].live, " ");
+    __heap_report_num(&report, NULL, heap_sites[i].total, " ");
+    __heap_report_num(&report, NULL, heap_sites[i].bytes, "\n");
   }
 
-  if ((cur = __heap_chunk_meta_prev(start)) != NULL)
-    __heap_chunk_meta_next_set(cur, start);
-  else
-    heap_chunk_first = start;
+  if (report.pos <= offset)
+    return 0;
+
+  return report.pos - offset > size ? size : report.pos - offset;
+}
 
-  if ((cur = __heap_chunk_meta_next(end)) != NULL)
-    __heap_chunk_meta_prev_set(cur, end);
-  else
-    heap_chunk_last = end;
+int64_t __heapstat_write(fs_inode_t *inode, uint64_t offset, uint64_t size, void *buffer) {
+  return -EPERM;
+}
+
+devfs_ops_t heapstat_ops = {
+    .open  = __heapstat_open,
+    .close = __heapstat_close,
+    .read  = __heapstat_read,
+    .write = __heapstat_write,
+};
+
+int32_t heap_register() {
+  int32_t err = 0;
+
+  if ((err = devfs_device_register("heapstat", &heapstat_ops, MODE_USRR)) < 0) {
+    heap_fail("failed to register the heapstat device: %s", strerror(err));
+    return err;
+  }
+
+  heap_debg("registered the heapstat device");
+  return 0;
 }
@@ -2,24 +2,27 @@
 #include "boot/multiboot.h"
 
 #include "util/printk.h"
+#include "util/string.h"
+#include "util/math.h"
+#include "util/asm.h"
 #include "util/mem.h"
 
+#include "sched/sched.h"
+#include "fs/devfs.h"
+#include "core/im.h"
+
 #include "mm/pmm.h"
 #include "mm/vmm.h"
 
+#include "config.h"
 #include "errno.h"
 #include <stdint.h>
 
 #define pmm_fail(f, ...) pfail("PMM: " f, ##__VA_ARGS__)
 #define pmm_warn(f, ...) pwarn("PMM: " f, ##__VA_ARGS__)
+#define pmm_info(f, ...) pinfo("PMM: " f, ##__VA_ARGS__)
 #define pmm_debg(f, ...) pdebg("PMM: " f, ##__VA_ARGS__)
 
-// describes a posion in the bitmap
-typedef struct {
-  uint8_t  bit;
-  uint64_t index;
-} pmm_bm_pos_t;
-
 // describes a memory region/area
 struct pmm_reg {
   uint64_t start, end, pos;
@@ -27,6 +30,8 @@ struct pmm_reg {
 
 struct multiboot_tag_mmap *pmm_mmap_tag = NULL;            // mmap multiboot tag
 uint64_t                  *pmm_bm = NULL, pmm_bm_size = 0; // used to store the bitmap address and size
+page_t                    *pmm_frames     = NULL;          // page frame database (see pmm.h)
+uint64_t                   pmm_frames_num = 0;             // page count of the free memory region
 struct pmm_reg             pmm_reg_known[] =
     {
         {0xA0000, 0xBFFFF}, // VGA, https://wiki.osdev.org/VGA_Hardware
@@ -51,45 +56,272 @@ struct pmm_reg             pmm_reg_known[] =
     (reg)->end   = round_down((reg)->end, PAGE_SIZE);                                                                  \
   } while (0)
 
-#define PMM_BM_ENTRY_BIT_SIZE      (sizeof(uint64_t) * 8)
-#define __pmm_bm_is_ready()        (pmm_bm != NULL && pmm_bm_size != 0)
-#define __pmm_bm_get_max_index()   (pmm_bm_size / 8)
-#define __pmm_bm_pos_reset(pos)    bzero(pos, sizeof(pmm_bm_pos_t));
-#define __pmm_bm_pos_to_addr(pos)  (pmm_reg_free.start + ((pos)->bit + (pos)->index * PMM_BM_ENTRY_BIT_SIZE) * PAGE_SIZE)
-#define __pmm_bm_pos_set(pos)      (pmm_bm[(pos)->index] |= ((uint64_t)1 << (pos)->bit))
-#define __pmm_bm_pos_clear(pos)    (pmm_bm[(pos)->index] &= ~((uint64_t)1 << (pos)->bit))
-#define __pmm_bm_pos_get(pos)      ((pmm_bm[(pos)->index] >> (pos)->bit) & 1)
-#define __pmm_bm_pos_is_valid(pos) (__pmm_bm_get_max_index() > (pos)->index)
-
-bool __pmm_bm_pos_from_addr(pmm_bm_pos_t *pos, uint64_t addr) {
-  if (NULL == pos || !__pmm_bm_is_ready())
-    return false;
+/*
+
+ * bitmap stores a single bit for every page in the free memory region,
+ * bit is set (1) if the page is allocated, or if it's not usable (holes in
+ * the memory map, kernel binary etc.), these are all marked once at
+ * pmm_init(), so we never need to check the memory map again
+
+ * all the bitmap operations work on entire entries (64 bits) at once, a
+ * search skips over the entries that are completely set (or clear), and
+ * finds the first matching bit in an entry with a single tzcnt/bsf
+
+*/
 
-  addr -= pmm_reg_free.start;
-  addr /= PAGE_SIZE;
+#define __pmm_frame_base()          (pmm_reg_free.start / PAGE_SIZE)
+#define __pmm_frame_to_addr(indx)   (pmm_reg_free.start + (uint64_t)(indx) * PAGE_SIZE)
+#define __pmm_frame_from_addr(addr) (((addr) - pmm_reg_free.start) / PAGE_SIZE)
 
-  pos->index = addr / PMM_BM_ENTRY_BIT_SIZE;
-  pos->bit   = addr % PMM_BM_ENTRY_BIT_SIZE;
+#define PMM_BM_ENTRY_BIT_SIZE (sizeof(uint64_t) * 8)
+#define __pmm_bm_is_ready()   (pmm_bm != NULL && pmm_bm_size != 0)
+#define __pmm_bm_get(indx)    ((pmm_bm[(indx) / PMM_BM_ENTRY_BIT_SIZE] >> ((indx) % PMM_BM_ENTRY_BIT_SIZE)) & 1)
+#define __pmm_bm_mask(indx, bits)                                                                                      \
+  (((bits) == PMM_BM_ENTRY_BIT_SIZE ? ~(uint64_t)0 : (((uint64_t)1 << (bits)) - 1)) << ((indx) % PMM_BM_ENTRY_BIT_SIZE))
 
-  return __pmm_bm_pos_is_valid(pos);
+// number of bits we can process in the entry that contains indx
+uint64_t __pmm_bm_bits(uint64_t indx, uint64_t num) {
+  uint64_t bits = PMM_BM_ENTRY_BIT_SIZE - indx % PMM_BM_ENTRY_BIT_SIZE;
+  return bits > num ? num : bits;
 }
 
-int32_t __pmm_bm_pos_next(pmm_bm_pos_t *pos) {
-  if (!__pmm_bm_is_ready())
-    return -EFAULT;
+// set (or clear) num bits starting from indx
+void __pmm_bm_fill(uint64_t indx, uint64_t num, bool set) {
+  uint64_t bits = 0;
+
+  for (; num > 0; indx += bits, num -= bits) {
+    bits = __pmm_bm_bits(indx, num);
 
-  // if we reached the end of the current uint64_t, move onto next one
-  if (++pos->bit >= PMM_BM_ENTRY_BIT_SIZE) {
-    pos->bit = 0;
-    pos->index++;
+    if (set)
+      pmm_bm[indx / PMM_BM_ENTRY_BIT_SIZE] |= __pmm_bm_mask(indx, bits);
+    else
+      pmm_bm[indx / PMM_BM_ENTRY_BIT_SIZE] &= ~__pmm_bm_mask(indx, bits);
   }
+}
 
-  // check we reached the end
-  if (pos->index >= __pmm_bm_get_max_index())
-    return -ERANGE;
+// check if all the num bits starting from indx are set
+bool __pmm_bm_is_set(uint64_t indx, uint64_t num) {
+  uint64_t bits = 0, mask = 0;
+
+  for (; num > 0; indx += bits, num -= bits) {
+    bits = __pmm_bm_bits(indx, num);
+    mask = __pmm_bm_mask(indx, bits);
+
+    if ((pmm_bm[indx / PMM_BM_ENTRY_BIT_SIZE] & mask) != mask)
+      return false;
+  }
+
+  return true;
+}
+
+// find the first set (or clear) bit starting from indx, returns the page count if there is none
+uint64_t __pmm_bm_find(uint64_t indx, bool set) {
+  uint64_t entry = 0;
+
+  while (indx < pmm_frames_num) {
+    entry = pmm_bm[indx / PMM_BM_ENTRY_BIT_SIZE];
+
+    // look for a set bit in both cases
+    if (!set)
+      entry = ~entry;
+
+    // ignore the bits before the index
+    entry &= ~(uint64_t)0 << (indx % PMM_BM_ENTRY_BIT_SIZE);
+    indx = round_down(indx, PMM_BM_ENTRY_BIT_SIZE);
+
+    if (entry != 0) {
+      indx += __builtin_ctzl(entry);
+      break;
+    }
+
+    indx += PMM_BM_ENTRY_BIT_SIZE;
+  }
+
+  return indx < pmm_frames_num ? indx : pmm_frames_num;
+}
+
+// set (or clear) the bits for all the pages between two physical addresses
+void __pmm_bm_fill_range(uint64_t start, uint64_t end, bool set) {
+  // when setting include the partial pages, when clearing exclude them
+  start = set ? round_down(start, PAGE_SIZE) : round_up(start, PAGE_SIZE);
+  end   = set ? round_up(end, PAGE_SIZE) : round_down(end, PAGE_SIZE);
+
+  if (start < pmm_reg_free.start)
+    start = pmm_reg_free.start;
+
+  if (end > pmm_reg_free.end)
+    end = pmm_reg_free.end;
+
+  if (end > start)
+    __pmm_bm_fill(__pmm_frame_from_addr(start), (end - start) / PAGE_SIZE, set);
+}
+
+/*
+
+ * buddy allocator
+
+ * free pages are grouped into blocks, a block of order k contains 2^k
+ * contiguous pages and it's aligned to 2^k pages (in physical address, not
+ * relative to the start of the free memory region), every order has it's
+ * own list of free blocks
+
+ * to allocate 2^k pages, we take a block from the smallest order list that
+ * is not empty, and split it in half until we get a block of order k, the
+ * other halves are placed on the lower order lists
+
+ * every block has a "buddy", which is the other half of the higher order
+ * block it was split from, address of the buddy is found by just flipping
+ * the k'th bit of the page number, when a block is freed and it's buddy is
+ * also free, they are merged back into a single higher order block
+
+ * since the free pages are not mapped, we cannot store the list links in
+ * the pages themselves, so they are stored in the page frame database
+ * (pmm_frames), entries are indexed by the page number relative to the start
+ * of the free memory region, and only the first page of a free block is
+ * used for the list links
+
+ * bitmap is still the source of truth for whether a page is allocated or
+ * not, buddy allocator only speeds up finding the free pages
+
+*/
 
-  // return the value stored in the new position
-  return __pmm_bm_pos_get(pos);
+#define PMM_ORDER_MAX  (10)         // max block order (4 MiB)
+#define PMM_FRAME_NONE (0xffffffff) // used to mark the end of a list
+
+uint32_t pmm_free_lists[PMM_ORDER_MAX + 1]; // free block lists for every order
+
+#define __pmm_frame_is_free(indx, o)                                                                                   \
+  ((pmm_frames[indx].flags & PAGE_FLAG_FREE) && pmm_frames[indx].order == (o))
+
+void __pmm_list_add(uint32_t indx, uint8_t order) {
+  page_t *frame = &pmm_frames[indx];
+
+  frame->order = order;
+  frame->flags |= PAGE_FLAG_FREE;
+  frame->prev = PMM_FRAME_NONE;
+  frame->next = pmm_free_lists[order];
+
+  if (PMM_FRAME_NONE != frame->next)
+    pmm_frames[frame->next].prev = indx;
+
+  pmm_free_lists[order] = indx;
+}
+
+void __pmm_list_del(uint32_t indx) {
+  page_t *frame = &pmm_frames[indx];
+
+  if (PMM_FRAME_NONE != frame->prev)
+    pmm_frames[frame->prev].next = frame->next;
+  else
+    pmm_free_lists[frame->order] = frame->next;
+
+  if (PMM_FRAME_NONE != frame->next)
+    pmm_frames[frame->next].prev = frame->prev;
+
+  frame->flags &= ~PAGE_FLAG_FREE;
+  frame->next = frame->prev = PMM_FRAME_NONE;
+}
+
+// add a free block to the lists, merge it with it's buddies
+void __pmm_buddy_free(uint64_t indx, uint8_t order) {
+  uint64_t base = __pmm_frame_base(), buddy = 0;
+
+  for (; order < PMM_ORDER_MAX; order++) {
+    buddy = (base + indx) ^ ((uint64_t)1 << order);
+
+    // buddy should be in the page frame database, and it should be a free block of the same order
+    if (buddy < base || (buddy -= base) + ((uint64_t)1 << order) > pmm_frames_num)
+      break;
+
+    if (!__pmm_frame_is_free(buddy, order))
+      break;
+
+    __pmm_list_del(buddy);
+
+    if (buddy < indx)
+      indx = buddy;
+  }
+
+  __pmm_list_add(indx, order);
+}
+
+// add all the pages in a range to the lists as the largest possible blocks
+void __pmm_buddy_free_range(uint64_t indx, uint64_t num) {
+  uint64_t base = __pmm_frame_base();
+  uint8_t  order = 0;
+
+  while (num > 0) {
+    // largest block that is aligned at this page
+    order = (base + indx) == 0 ? PMM_ORDER_MAX : __builtin_ctzl(base + indx);
+
+    if (order > PMM_ORDER_MAX)
+      order = PMM_ORDER_MAX;
+
+    // and that is not larger than the range
+    while (((uint64_t)1 << order) > num)
+      order--;
+
+    __pmm_buddy_free(indx, order);
+
+    indx += (uint64_t)1 << order;
+    num -= (uint64_t)1 << order;
+  }
+}
+
+// remove a block from the lists, and split it until it's the requested order
+uint64_t __pmm_buddy_alloc(uint8_t order) {
+  uint8_t  cur  = order;
+  uint64_t indx = 0;
+
+  // find the smallest free block that is large enough
+  while (cur <= PMM_ORDER_MAX && PMM_FRAME_NONE == pmm_free_lists[cur])
+    cur++;
+
+  if (cur > PMM_ORDER_MAX)
+    return PMM_FRAME_NONE;
+
+  __pmm_list_del(indx = pmm_free_lists[cur]);
+
+  // put the upper halves back to the lists
+  while (cur > order) {
+    cur--;
+    __pmm_list_add(indx + ((uint64_t)1 << cur), cur);
+  }
+
+  return indx;
+}
+
+// remove all the pages in a range from the lists, range should be free
+void __pmm_buddy_take_range(uint64_t indx, uint64_t num) {
+  uint64_t base = __pmm_frame_base(), head = 0, end = indx + num;
+  uint8_t  order = 0;
+
+  while (indx < end) {
+    // find the free block that contains the page
+    for (order = 0; order <= PMM_ORDER_MAX; order++) {
+      head = ((base + indx) & ~(((uint64_t)1 << order) - 1)) - base;
+
+      if (head <= indx && __pmm_frame_is_free(head, order))
+        break;
+    }
+
+    if (order > PMM_ORDER_MAX) {
+      pmm_warn("page 0x%p is not in a free block", __pmm_frame_to_addr(indx));
+      indx++;
+      continue;
+    }
+
+    __pmm_list_del(head);
+
+    // put back the parts of the block that are outside of the range
+    if (head < indx)
+      __pmm_buddy_free_range(head, indx - head);
+
+    if (head + ((uint64_t)1 << order) > end)
+      __pmm_buddy_free_range(end, head + ((uint64_t)1 << order) - end);
+
+    indx = head + ((uint64_t)1 << order);
+  }
 }
 
 bool __pmm_is_free_memory(uint64_t addr) {
@@ -124,6 +356,8 @@ bool __pmm_is_free_memory(uint64_t addr) {
 }
 
 int32_t pmm_init() {
+  uint64_t *bm = NULL, free = 0;
+
   // make sure the structure that stores free memory region is clean
   bzero(&pmm_reg_free, sizeof(pmm_reg_free));
 
@@ -168,13 +402,50 @@ int32_t pmm_init() {
   pmm_debg("bitmapping 0x%p - 0x%p with %u bytes", pmm_reg_free.start, pmm_reg_free.end, pmm_bm_size);
 
   // allocate memory for the bitmap
-  if ((pmm_bm = vmm_map(pmm_bm_size / PAGE_SIZE, 0, 0)) == NULL) {
+  if ((bm = vmm_map(pmm_bm_size / PAGE_SIZE, 0, 0)) == NULL) {
     pmm_fail("failed to allocate the bitmap (size: %u)", pmm_bm_size);
     return -EFAULT;
   }
 
-  // clear out the bitmap
-  bzero(pmm_bm, pmm_bm_size);
+  // allocate memory for the page frame database (before the bitmap is ready, so it's also a no bitmap allocation)
+  pmm_frames_num = __pmm_reg_size(&pmm_reg_free) / PAGE_SIZE;
+
+  if ((pmm_frames = vmm_map(vmm_calc(pmm_frames_num * sizeof(page_t)), 0, 0)) == NULL) {
+    pmm_fail("failed to allocate the page frame database (count: %u)", pmm_frames_num);
+    return -EFAULT;
+  }
+
+  // clear out the bitmap and the page frame database
+  bzero(pmm_bm = bm, pmm_bm_size);
+  bzero(pmm_frames, pmm_frames_num * sizeof(page_t));
+
+  /*
+
+   * mark all the pages that we cannot use as allocated (1) in the bitmap
+   * so we start with every page set, and only clear the ones that are in
+   * an available memory map entry, then we set the pages of the known
+   * memory regions, kernel binary and the multiboot info again
+
+   * all of these pages are also marked as reserved in the page frame
+   * database, so pmm_free() can reject them
+
+  */
+  __pmm_bm_fill(0, pmm_frames_num, true);
+
+  __pmm_foreach_mb_mmap_entry() {
+    if (MULTIBOOT_MEMORY_AVAILABLE == map->type)
+      __pmm_bm_fill_range(map->addr, map->addr + map->len, false);
+  }
+
+  __pmm_foreach_reg_known() {
+    __pmm_bm_fill_range(reg->start, reg->end, true);
+  }
+
+  __pmm_bm_fill_range(BOOT_KERNEL_START_PADDR, BOOT_KERNEL_END_PADDR, true);
+  __pmm_bm_fill_range(BOOT_MB_INFO_START_PADDR, BOOT_MB_INFO_END_PADDR, true);
+
+  for (uint64_t indx = __pmm_bm_find(0, true); indx < pmm_frames_num; indx = __pmm_bm_find(indx + 1, true))
+    pmm_frames[indx].flags |= PAGE_FLAG_RSVD;
 
   /*
 
@@ -184,12 +455,20 @@ int32_t pmm_init() {
    * not available (1) so they won't be allocated again and we'll be able to free them
 
   */
-  pmm_bm_pos_t pos;
-  __pmm_bm_pos_reset(&pos);
+  __pmm_bm_fill_range(pmm_reg_free.start, pmm_reg_free.pos, true);
+
+  // add all the free pages to the buddy allocator lists
+  for (uint8_t i = 0; i <= PMM_ORDER_MAX; i++)
+    pmm_free_lists[i] = PMM_FRAME_NONE;
 
-  for (; pmm_reg_free.pos > __pmm_bm_pos_to_addr(&pos); __pmm_bm_pos_next(&pos))
-    __pmm_bm_pos_set(&pos);
+  for (uint64_t start = __pmm_bm_find(0, false), end = 0; start < pmm_frames_num;
+      start = __pmm_bm_find(end, false)) {
+    end = __pmm_bm_find(start, true);
+    __pmm_buddy_free_range(start, end - start);
+    free += end - start;
+  }
 
+  pmm_debg("added %u free pages to the buddy allocator", free);
   return 0;
 }
 
@@ -218,7 +497,47 @@ uint64_t __pmm_alloc_no_bm(uint64_t num, uint64_t align) {
   return start;
 }
 
-uint64_t pmm_alloc(uint64_t num, uint64_t align) {
+// find a run of num clear bits in the bitmap, first page's address should be aligned to pages
+uint64_t __pmm_bm_find_run(uint64_t num, uint64_t pages) {
+  uint64_t start = 0, end = 0;
+
+  for (start = __pmm_bm_find(0, false); start < pmm_frames_num; start = __pmm_bm_find(end, false)) {
+    // align the physical address of the first page
+    start = round_up(__pmm_frame_base() + start, pages) - __pmm_frame_base();
+
+    if (start >= pmm_frames_num)
+      break;
+
+    // end of the free run
+    if ((end = __pmm_bm_find(start, true)) - start >= num)
+      return start;
+
+    // aligned start is not free, continue from the next page
+    if (end == start)
+      end++;
+  }
+
+  return pmm_frames_num;
+}
+
+// find num free pages without the buddy allocator
+uint64_t __pmm_alloc_no_buddy(uint64_t num, uint64_t align) {
+  uint64_t start = __pmm_bm_find_run(num, align > PAGE_SIZE ? align / PAGE_SIZE : 1);
+
+  if (start >= pmm_frames_num) {
+    pmm_fail("failed to allocate %u pages", num);
+    return NULL;
+  }
+
+  // remove the pages from the buddy allocator lists
+  __pmm_buddy_take_range(start, num);
+  return __pmm_frame_to_addr(start);
+}
+
+uint64_t __pmm_alloc(uint64_t num, uint64_t align) {
+  uint64_t indx = 0, pages = 0;
+  uint8_t  order = 0;
+
   if (align != 0 && ((PAGE_SIZE > align && PAGE_SIZE % align != 0) || (align > PAGE_SIZE && align % PAGE_SIZE != 0))) {
     pmm_fail("requested invalid alignment (0x%x)", align);
     return NULL;
@@ -227,75 +546,549 @@ uint64_t pmm_alloc(uint64_t num, uint64_t align) {
   if (!__pmm_bm_is_ready())
     return __pmm_alloc_no_bm(num, align);
 
-  uint64_t     start = 0, cur = 0;
-  int32_t      val = 0;
-  pmm_bm_pos_t pos;
+  if (num == 0)
+    return NULL;
 
-  __pmm_bm_pos_reset(&pos);
+  /*
 
-  for (val = __pmm_bm_pos_get(&pos); num > cur; val = __pmm_bm_pos_next(&pos)) {
-    // check if we were able to get the next entry in the bitmap
-    if (val < 0)
-      break;
+   * blocks are aligned to their size, so the smallest block that is large
+   * enough for both the page count and the alignment satisfies the request
 
-    if (cur == 0 && (start = __pmm_bm_pos_to_addr(&pos)) % (align ? align : 1) != 0)
-      continue;
+  */
+  pages = align > PAGE_SIZE ? align / PAGE_SIZE : 1;
 
-    // if the next entry is used reset the cur counter
-    if (val || !__pmm_is_free_memory(__pmm_bm_pos_to_addr(&pos)))
-      cur = 0;
-    else
-      cur++;
+  if (num > pages)
+    pages = num;
+
+  while (((uint64_t)1 << order) < pages)
+    order++;
+
+  // too large for the buddy allocator, or the alignment is not a power of two
+  if (order > PMM_ORDER_MAX || (align > PAGE_SIZE && (align & (align - 1)) != 0)) {
+    if ((indx = __pmm_alloc_no_buddy(num, align)) != NULL)
+      __pmm_bm_fill(__pmm_frame_from_addr(indx), num, true);
+    return indx;
   }
 
-  if (cur != num) {
-    pmm_fail("failed to allocate %u pages", num);
+  // callers may retry with a smaller block (see vmm_map()), so this is not an error yet
+  if (PMM_FRAME_NONE == (indx = __pmm_buddy_alloc(order))) {
+    pmm_debg("failed to allocate %u pages", num);
     return NULL;
   }
 
+  // give back the pages we don't need
+  if (((uint64_t)1 << order) > num)
+    __pmm_buddy_free_range(indx + num, ((uint64_t)1 << order) - num);
+
   // make sure the pages we are allocating are set as not available (1) in the bitmap
-  for (__pmm_bm_pos_from_addr(&pos, start), cur = 0; num > cur; cur++, __pmm_bm_pos_next(&pos))
-    __pmm_bm_pos_set(&pos);
+  __pmm_bm_fill(indx, num, true);
+  return __pmm_frame_to_addr(indx);
+}
 
-  return start;
+/*
+
+ * allocate num pages that don't need to be physically contiguous, and store
+ * the physical address of every page in the list, starting from the first one
+
+ * we always take the largest free block that is not larger than what's left,
+ * so the pages still end up being contiguous most of the time, but when the
+ * memory is fragmented we can still use the smaller blocks
+
+*/
+int32_t __pmm_alloc_pages(uint64_t num, uint64_t *list) {
+  uint64_t indx = 0, cur = 0, i = 0;
+  uint8_t  order = PMM_ORDER_MAX;
+
+  if (NULL == list)
+    return -EINVAL;
+
+  // no buddy allocator yet, allocate one page at a time
+  if (!__pmm_bm_is_ready()) {
+    for (; cur < num; cur++)
+      if ((list[cur] = __pmm_alloc_no_bm(1, 0)) == NULL)
+        return -ENOMEM;
+    return 0;
+  }
+
+  while (cur < num) {
+    // largest order that is not larger than what's left
+    while (((uint64_t)1 << order) > num - cur)
+      order--;
+
+    // no block that is large enough, try a smaller order
+    if (PMM_FRAME_NONE == (indx = __pmm_buddy_alloc(order))) {
+      if (order == 0)
+        goto fail;
+      order--;
+      continue;
+    }
+
+    __pmm_bm_fill(indx, (uint64_t)1 << order, true);
+
+    for (i = 0; i < ((uint64_t)1 << order); i++)
+      list[cur++] = __pmm_frame_to_addr(indx + i);
+  }
+
+  return 0;
+
+fail:
+  pmm_fail("failed to allocate %u pages (allocated %u)", num, cur);
+
+  // free the pages we have allocated
+  for (i = 0; i < cur; i++) {
+    __pmm_bm_fill(__pmm_frame_from_addr(list[i]), 1, false);
+    __pmm_buddy_free(__pmm_frame_from_addr(list[i]), 0);
+  }
+
+  return -ENOMEM;
 }
 
 bool pmm_is_allocated(uint64_t paddr) {
-  pmm_bm_pos_t pos;
+  uint64_t indx = __pmm_frame_from_addr(paddr);
 
-  // try to obtain the bitmap position from the given address
-  if (!__pmm_bm_pos_from_addr(&pos, paddr))
+  // make sure the address is in the bitmap
+  if (!__pmm_bm_is_ready() || paddr < pmm_reg_free.start || indx >= pmm_frames_num)
     return false;
 
   // return the value stored in that position (1 = allocted, 0 = free)
-  return __pmm_bm_pos_get(&pos);
+  return __pmm_bm_get(indx);
 }
 
-int32_t pmm_free(uint64_t paddr, uint64_t num) {
-  pmm_bm_pos_t pos;
-  int32_t      val = 0;
+int32_t __pmm_free(uint64_t paddr, uint64_t num) {
+  uint64_t indx = __pmm_frame_from_addr(paddr);
 
-  // try to obtain the bitmap position from the given address
-  if (!__pmm_bm_pos_from_addr(&pos, paddr))
+  // make sure the address is in the bitmap
+  if (!__pmm_bm_is_ready() || paddr < pmm_reg_free.start || paddr % PAGE_SIZE != 0)
     return -EFAULT;
 
-  // loop through "num" pages and mark them as free in the bitmap
-  for (val = __pmm_bm_pos_get(&pos); num > 0; num--, val = __pmm_bm_pos_next(&pos)) {
-    // if we reach the end of the bitmap, fail with a warning
-    if (val < 0) {
-      pmm_warn("attempted to free a page that is not in the bitmap");
-      return -ERANGE;
-    }
+  // if we reach the end of the bitmap, fail with a warning
+  if (indx + num > pmm_frames_num) {
+    pmm_warn("attempted to free a page that is not in the bitmap");
+    return -ERANGE;
+  }
+
+  // if any of the pages is already marked as free, also fail with a warning
+  if (!__pmm_bm_is_set(indx, num)) {
+    pmm_warn("attempted double free (0x%p - 0x%p)", paddr, paddr + num * PAGE_SIZE);
+    return -EFAULT;
+  }
 
-    // if the page is already marked as free, also fail with a warning
-    if (!val) {
-      pmm_warn("attempted double free (0x%p)", __pmm_bm_pos_to_addr(&pos));
+  // pages we cannot use are never allocated, so they cannot be freed
+  for (uint64_t i = indx; i < indx + num; i++) {
+    if (pmm_frames[i].flags & PAGE_FLAG_RSVD) {
+      pmm_warn("attempted to free a reserved page (0x%p)", __pmm_frame_to_addr(i));
       return -EFAULT;
     }
+  }
+
+  /*
+
+   * shared pages just lose a reference, rest of the pages are marked as free (0)
+   * in the bitmap, and given back to the buddy allocator, in runs of pages that
+   * are not shared
+
+  */
+  for (uint64_t i = indx, start = indx; i <= indx + num; i++) {
+    // the page is actually freed, so reset it's entry in the page frame database
+    if (i < indx + num && pmm_frames[i].refs == 0) {
+      pmm_frames[i].flags = 0;
+      pmm_frames[i].maps  = 0;
+      pmm_frames[i].owner = NULL;
+      continue;
+    }
+
+    if (i > start) {
+      __pmm_bm_fill(start, i - start, false);
+      __pmm_buddy_free_range(start, i - start);
+    }
+
+    if (i < indx + num)
+      pmm_frames[i].refs--;
+
+    start = i + 1;
+  }
+
+  return 0;
+}
+
+/*
+
+ * pre-zeroed page pool
+
+ * most of the pages we allocate (page tables, demand paged user memory) should
+ * be filled with zeros, clearing a page on the allocation path is slow, so a
+ * background kernel task (see pmm_zero_task()) keeps a small pool of pages
+ * that are already cleared, pmm_alloc_zeroed() hands out the pages from the
+ * pool first, and only clears the page itself if the pool is empty
+
+ * the kernel task runs with the idle priority, so it only uses the CPU time
+ * that no other task wants, and when we are out of memory, it blocks until a
+ * page is freed (see pmm_free()) instead of polling the allocator
+
+*/
+
+#define PMM_ZERO_MAX (CONFIG_MM_ZERO_PAGES) // max page count in the pool
+
+uint64_t pmm_zero_pool[PMM_ZERO_MAX];    // pre-zeroed pages
+uint64_t pmm_zero_count = 0;             // page count in the pool
+bool     pmm_zero_oom   = false;         // kernel task is waiting for a free page
+waitq_t  pmm_zero_wait  = {NULL, NULL}; // kernel task waits here while the pool is full (or we are out of memory)
+
+struct pmm_zero_stats {
+  uint64_t hits;   // allocations served from the pool
+  uint64_t misses; // allocations that had to clear the page
+  uint64_t zeroed; // pages cleared by the kernel task
+} pmm_zero_stats;
+
+// fill the page with zeros (using the direct map)
+void __pmm_zero(uint64_t paddr) {
+  uint64_t *page = phys_to_virt(paddr), count = PAGE_SIZE / sizeof(uint64_t);
+  __asm__ volatile("rep stosq" : "+D"(page), "+c"(count) : "a"(0) : "memory");
+}
+
+// take a page from the pool, returns 0 if the pool is empty
+uint64_t __pmm_zero_take() {
+  uint64_t paddr = 0;
+
+  if (pmm_zero_count == 0)
+    return 0;
+
+  paddr = pmm_zero_pool[--pmm_zero_count];
+  pmm_frames[__pmm_frame_from_addr(paddr)].flags &= ~PAGE_FLAG_ZERO;
+
+  // wake up the kernel task once half of the pool is used, so it's not woken up for every page
+  if (pmm_zero_count <= PMM_ZERO_MAX / 2 && NULL != pmm_zero_wait.head)
+    waitq_wake_one(&pmm_zero_wait);
+
+  return paddr;
+}
+
+/*
+
+ * PMM is used by the interrupt handlers (such as the scheduler, see task_copy())
+ * and by the kernel tasks, which can be preempted (see sched_kernel()), so the
+ * allocator functions run with the interrupts disabled
+
+*/
+uint64_t pmm_alloc(uint64_t num, uint64_t align) {
+  uint64_t flags = 0, paddr = 0;
+
+  im_save(flags);
+
+  // if we are out of memory, the pre-zeroed pages can still be used
+  if ((paddr = __pmm_alloc(num, align)) == 0 && num == 1)
+    paddr = __pmm_zero_take();
+
+  im_restore(flags);
+  return paddr;
+}
+
+int32_t pmm_alloc_pages(uint64_t num, uint64_t *list) {
+  uint64_t flags = 0;
+  int32_t  err   = 0;
+
+  im_save(flags);
+  err = __pmm_alloc_pages(num, list);
+  im_restore(flags);
+
+  return err;
+}
+
+int32_t pmm_free(uint64_t paddr, uint64_t num) {
+  uint64_t flags = 0;
+  int32_t  err   = 0;
+
+  im_save(flags);
+
+  // wake up the kernel task if it's waiting for a page to fill the pool with
+  if ((err = __pmm_free(paddr, num)) == 0 && pmm_zero_oom) {
+    pmm_zero_oom = false;
+    waitq_wake_one(&pmm_zero_wait);
+  }
+
+  im_restore(flags);
+  return err;
+}
+
+uint64_t pmm_alloc_zeroed() {
+  uint64_t flags = 0, paddr = 0;
+
+  im_save(flags);
+
+  if ((paddr = __pmm_zero_take()) != 0) {
+    pmm_zero_stats.hits++;
+    im_restore(flags);
+    return paddr;
+  }
+
+  pmm_zero_stats.misses++;
+  paddr = __pmm_alloc(1, 0);
+
+  im_restore(flags);
+
+  // pool is empty, so clear the page now
+  if (paddr != 0)
+    __pmm_zero(paddr);
+
+  return paddr;
+}
+
+void pmm_zero_task() {
+  uint64_t flags = 0, paddr = 0;
+
+  while (true) {
+    // pool is full, block until it's used (see __pmm_zero_take())
+    waitq_sleep(&pmm_zero_wait, pmm_zero_count < PMM_ZERO_MAX);
+
+    /*
+
+     * don't use pmm_alloc(), when we are out of memory it takes the page from
+     * the pool, so we would just put the same page back and never stop, block
+     * until a page is freed instead (see pmm_free())
+
+    */
+    im_save(flags);
+
+    if ((paddr = __pmm_alloc(1, 0)) == 0)
+      pmm_zero_oom = true;
+
+    im_restore(flags);
+
+    if (paddr == 0) {
+      waitq_sleep(&pmm_zero_wait, !pmm_zero_oom);
+      continue;
+    }
+
+    // clear the page with the interrupts enabled, only this task adds pages to the pool
+    __pmm_zero(paddr);
+
+    im_save(flags);
+
+    pmm_frames[__pmm_frame_from_addr(paddr)].flags |= PAGE_FLAG_ZERO;
+    pmm_zero_pool[pmm_zero_count++] = paddr;
+    pmm_zero_stats.zeroed++;
+
+    im_restore(flags);
+  }
+}
+
+/*
 
-    // otherwise mark the page as free (0) in the bitmap
-    __pmm_bm_pos_clear(&pos);
+ * pages can be shared (for example between a forked task and it's parent), a
+ * shared page has an extra reference for every additional owner, pmm_free()
+ * drops a reference, and the page is only freed when the last owner frees it
+
+*/
+int32_t pmm_ref(uint64_t paddr) {
+  uint64_t indx = __pmm_frame_from_addr(paddr), flags = 0;
+
+  if (!pmm_is_allocated(paddr) || paddr % PAGE_SIZE != 0)
+    return -EFAULT;
+
+  if (pmm_frames[indx].flags & PAGE_FLAG_RSVD)
+    return -EFAULT;
+
+  if (pmm_frames[indx].refs == UINT16_MAX) {
+    pmm_warn("too many references to the page 0x%p", paddr);
+    return -EOVERFLOW;
   }
 
+  im_save(flags);
+  pmm_frames[indx].refs++;
+  im_restore(flags);
+
+  return 0;
+}
+
+bool pmm_is_shared(uint64_t paddr) {
+  return pmm_is_allocated(paddr) && pmm_frames[__pmm_frame_from_addr(paddr)].refs != 0;
+}
+
+/*
+
+ * VMM keeps track of the used entries of the page tables, so it can find out
+ * if a page table is empty without scanning all of it's entries, the counter
+ * is stored with the frame of the page table, till the page table is freed
+
+*/
+int32_t pmm_table(uint64_t paddr, uint16_t used) {
+  uint64_t indx = __pmm_frame_from_addr(paddr);
+
+  if (!pmm_is_allocated(paddr) || paddr % PAGE_SIZE != 0)
+    return -EFAULT;
+
+  if (pmm_frames[indx].flags & PAGE_FLAG_RSVD)
+    return -EFAULT;
+
+  pmm_frames[indx].flags |= PAGE_FLAG_TABLE;
+  pmm_frames[indx].used = used;
+  return 0;
+}
+
+uint16_t *pmm_table_used(uint64_t paddr) {
+  uint64_t indx = __pmm_frame_from_addr(paddr);
+
+  if (!pmm_is_allocated(paddr) || !(pmm_frames[indx].flags & PAGE_FLAG_TABLE))
+    return NULL;
+
+  return &pmm_frames[indx].used;
+}
+
+page_t *pmm_page(uint64_t paddr) {
+  uint64_t indx = __pmm_frame_from_addr(paddr);
+
+  if (!pmm_is_allocated(paddr) || pmm_frames[indx].flags & PAGE_FLAG_RSVD)
+    return NULL;
+
+  return &pmm_frames[indx];
+}
+
+/*
+
+ * pmmstat device, reading it returns a text report of the free pages and the
+ * pre-zeroed page pool statistics, report is small so it's generated on the
+ * stack with every read, and only the requested part is copied to the buffer
+
+*/
+
+void __pmm_report_num(char *report, uint64_t *len, char *name, uint64_t num) {
+  char str[21];
+
+  itou(num, str);
+
+  for (char *c = name; *c != 0; c++)
+    report[(*len)++] = *c;
+
+  for (char *c = str; *c != 0; c++)
+    report[(*len)++] = *c;
+
+  report[(*len)++] = '\n';
+}
+
+int32_t __pmmstat_open(fs_inode_t *inode) {
   return 0;
 }
+
+int32_t __pmmstat_close(fs_inode_t *inode) {
+  return 0;
+}
+
+int64_t __pmmstat_read(fs_inode_t *inode, uint64_t offset, uint64_t size, void *buffer) {
+  uint64_t free = 0, len = 0, flags = 0;
+  char     report[256];
+
+  im_save(flags);
+
+  for (uint8_t order = 0; order <= PMM_ORDER_MAX; order++)
+    for (uint32_t indx = pmm_free_lists[order]; PMM_FRAME_NONE != indx; indx = pmm_frames[indx].next)
+      free += (uint64_t)1 << order;
+
+  im_restore(flags);
+
+  __pmm_report_num(report, &len, "free pages: ", free);
+  __pmm_report_num(report, &len, "zero pool: ", pmm_zero_count);
+  __pmm_report_num(report, &len, "zero hits: ", pmm_zero_stats.hits);
+  __pmm_report_num(report, &len, "zero misses: ", pmm_zero_stats.misses);
+  __pmm_report_num(report, &len, "zeroed: ", pmm_zero_stats.zeroed);
+
+  if (len <= offset)
+    return 0;
+
+  if (len - offset < size)
+    size = len - offset;
+
+  memcpy(buffer, report + offset, size);
+  return size;
+}
+
+int64_t __pmmstat_write(fs_inode_t *inode, uint64_t offset, uint64_t size, void *buffer) {
+  return -EPERM;
+}
+
+devfs_ops_t pmmstat_ops = {
+    .open  = __pmmstat_open,
+    .close = __pmmstat_close,
+    .read  = __pmmstat_read,
+    .write = __pmmstat_write,
+};
+
+int32_t pmm_register() {
+  int32_t err = 0;
+
+  if ((err = devfs_device_register("pmmstat", &pmmstat_ops, MODE_USRR)) < 0) {
+    pmm_fail("failed to register the pmmstat device: %s", strerror(err));
+    return err;
+  }
+
+  pmm_debg("registered the pmmstat device");
+  return 0;
+}
+
+/*
+
+ * boot time page allocator benchmark, only runs if it's enabled in the
+ * configuration, it fills the free memory up to 10%, 50% and 90% with
+ * single page allocations, and at each level it measures the average cost
+ * (in cycles) of allocating and freeing a single page, allocating and
+ * freeing an aligned 16 page block, and scanning the bitmap for 16 free
+ * contiguous pages (which is what the allocations that are too large for
+ * the buddy allocator do)
+
+*/
+
+#define PMM_BENCH_ROUNDS (1000)
+
+void pmm_bench() {
+  uint64_t  levels[] = {10, 50, 90}, total = 0, used = 0, cycles[3], start = 0, paddr = 0;
+  uint64_t *pages    = NULL;
+
+  // count the free pages
+  for (uint8_t order = 0; order <= PMM_ORDER_MAX; order++)
+    for (uint32_t indx = pmm_free_lists[order]; PMM_FRAME_NONE != indx; indx = pmm_frames[indx].next)
+      total += (uint64_t)1 << order;
+
+  // used to store the allocated pages
+  if (NULL == (pages = vmm_map(vmm_calc(total * sizeof(uint64_t)), 0, 0))) {
+    pmm_fail("failed to allocate memory for the benchmark");
+    return;
+  }
+
+  pmm_info("benchmarking with %u free pages (%u rounds)", total, PMM_BENCH_ROUNDS);
+
+  for (uint8_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+    // fill the memory up to the level
+    for (; used < total * levels[i] / 100; used++)
+      if (NULL == (pages[used] = pmm_alloc(1, 0)))
+        break;
+
+    bzero(cycles, sizeof(cycles));
+
+    for (uint64_t r = 0; r < PMM_BENCH_ROUNDS; r++) {
+      start = _rdtsc();
+      paddr = pmm_alloc(1, 0);
+      pmm_free(paddr, 1);
+      cycles[0] += _rdtsc() - start;
+
+      start = _rdtsc();
+      paddr = pmm_alloc(16, 16 * PAGE_SIZE);
+      pmm_free(paddr, 16);
+      cycles[1] += _rdtsc() - start;
+
+      start = _rdtsc();
+      __pmm_bm_find_run(16, 1);
+      cycles[2] += _rdtsc() - start;
+    }
+
+    pmm_info("%u%% used: 1 page: %u cycles, 16 pages: %u cycles, bitmap scan: %u cycles",
+        levels[i],
+        cycles[0] / PMM_BENCH_ROUNDS,
+        cycles[1] / PMM_BENCH_ROUNDS,
+        cycles[2] / PMM_BENCH_ROUNDS);
+  }
+
+  // free all the pages we allocated
+  while (used > 0)
+    pmm_free(pages[--used], 1);
+
+  vmm_unmap(pages, vmm_calc(total * sizeof(uint64_t)), 0);
+}
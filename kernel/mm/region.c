@@ -1,7 +1,11 @@
 #include "mm/region.h"
+#include "mm/paging.h"
 #include "mm/heap.h"
+#include "mm/slab.h"
 #include "mm/vmm.h"
 
+#include "fs/vfs.h"
+
 #include "util/printk.h"
 #include "util/list.h"
 #include "util/mem.h"
@@ -12,22 +16,40 @@
 struct region_type_data {
   uint8_t     type;
   const char *name;
-  uint32_t    attr;
+  uint8_t     prot;
 };
 
 struct region_type_data region_type_data[] = {
-    {REGION_TYPE_CODE,   "CODE",      0               },
-    {REGION_TYPE_RDONLY, "READ_ONLY", VMM_ATTR_RDONLY },
-    {REGION_TYPE_DATA,   "DATA",      VMM_ATTR_NO_EXEC},
-    {REGION_TYPE_HEAP,   "HEAP",      VMM_ATTR_NO_EXEC},
-    {REGION_TYPE_STACK,  "STACK",     VMM_ATTR_NO_EXEC},
+    {REGION_TYPE_CODE,   "CODE",      REGION_PROT_READ | REGION_PROT_WRITE | REGION_PROT_EXEC},
+    {REGION_TYPE_RDONLY, "READ_ONLY", REGION_PROT_READ | REGION_PROT_EXEC                    },
+    {REGION_TYPE_DATA,   "DATA",      REGION_PROT_READ | REGION_PROT_WRITE                   },
+    {REGION_TYPE_HEAP,   "HEAP",      REGION_PROT_READ | REGION_PROT_WRITE                   },
+    {REGION_TYPE_STACK,  "STACK",     REGION_PROT_READ | REGION_PROT_WRITE                   },
 };
 
-#define __region_attr(type) (region_type_data[type - 1].attr | VMM_ATTR_REUSE)
+// object cache for the memory region structures
+slab_cache_t region_cache = slab_cache("region", sizeof(region_t));
+
+#define __region_prot(type) (region_type_data[type - 1].prot)
 #define __region_name(type) (region_type_data[type - 1].name)
 
+// VMM attributes for the protection of the region
+#define __region_attr(prot)                                                                                            \
+  (((prot) & REGION_PROT_WRITE ? 0 : VMM_ATTR_RDONLY) | ((prot) & REGION_PROT_EXEC ? 0 : VMM_ATTR_NO_EXEC) |           \
+      VMM_ATTR_REUSE)
+
+// VMM attributes used to map the region
+#define __region_map_attr(mem)                                                                                         \
+  (__region_attr((mem)->prot) | VMM_ATTR_SAVE | ((mem)->vma == VMM_VMA_USER ? VMM_ATTR_USER : 0))
+
+// number of reserved pages below the region (pages a stack can grow to and the guard page)
+#define __region_below(mem) (REGION_TYPE_STACK == (mem)->type ? (mem)->max - (mem)->num + 1 : 0)
+
+// number of reserved pages above the region (pages a heap can grow to)
+#define __region_above(mem) (REGION_TYPE_HEAP == (mem)->type ? (mem)->max - (mem)->num : 0)
+
 region_t *region_new(uint8_t type, uint8_t vma, void *vaddr, uint64_t num) {
-  region_t *new = heap_alloc(sizeof(region_t));
+  region_t *new = slab_alloc(&region_cache);
 
   if (NULL == new)
     return NULL;
@@ -37,10 +59,106 @@ region_t *region_new(uint8_t type, uint8_t vma, void *vaddr, uint64_t num) {
   new->vma   = vma;
   new->vaddr = vaddr;
   new->num   = num;
+  new->max   = num;
+  new->prot  = __region_prot(type);
 
   return new;
 }
 
+int32_t region_file(region_t *mem, struct vfs_node *file, uint64_t offset, uint64_t size) {
+  if (NULL == mem || NULL == file || mem->vma != VMM_VMA_USER || size > mem->num * PAGE_SIZE)
+    return -EINVAL;
+
+  int32_t err = 0;
+
+  // region keeps it's own reference to the file, so it can be loaded after the file is closed
+  if ((err = vfs_reopen(file)) != 0)
+    return err;
+
+  mem->file   = file;
+  mem->offset = offset;
+  mem->size   = size;
+
+  return 0;
+}
+
+/*
+
+ * physical pages of a region are not contiguous, so the region stores the
+ * physical address of every page, however most of the time the pages are
+ * still contiguous, so these helpers work with runs of contiguous pages
+
+ * pages that are not loaded yet (with 0 physical address) also form runs
+
+*/
+uint64_t __region_run(region_t *mem, uint64_t i) {
+  uint64_t num = 1;
+
+  while (i + num < mem->num && mem->paddr[i + num] == (mem->paddr[i] == 0 ? 0 : mem->paddr[i] + num * PAGE_SIZE))
+    num++;
+
+  return num;
+}
+
+// obtain the physical address of every page of the mapped region
+int32_t __region_resolve(region_t *mem, void *vaddr) {
+  if (NULL == vaddr)
+    return -EFAULT;
+
+  if (NULL == mem->paddr && NULL == (mem->paddr = heap_alloc(mem->num * sizeof(uint64_t))))
+    return -ENOMEM;
+
+  for (uint64_t i = 0; i < mem->num; i++)
+    mem->paddr[i] = vmm_resolve(vaddr + i * PAGE_SIZE);
+
+  return 0;
+}
+
+// reserve the virtual addresses for the region without loading any of it's pages
+int32_t __region_reserve(region_t *mem) {
+  uint64_t below = __region_below(mem), above = __region_above(mem), vaddr = 0;
+
+  if (NULL == (mem->paddr = heap_alloc(mem->num * sizeof(uint64_t))))
+    return -ENOMEM;
+
+  // reserved pages below the region are placed right before it's start address
+  if (NULL != mem->vaddr)
+    vaddr = (uint64_t)mem->vaddr - below * PAGE_SIZE;
+
+  if ((vaddr = (uint64_t)vmm_reserve(vaddr, below + mem->num + above, __region_map_attr(mem))) == 0) {
+    heap_free(mem->paddr);
+    mem->paddr = NULL;
+    return -ENOMEM;
+  }
+
+  bzero(mem->paddr, mem->num * sizeof(uint64_t));
+  mem->vaddr = (void *)vaddr + below * PAGE_SIZE;
+
+  return 0;
+}
+
+// allocate a new page for the region, and load it's contents
+int32_t __region_load(region_t *mem, uint64_t i) {
+  uint64_t paddr = 0, pos = i * PAGE_SIZE, size = 0;
+  int64_t  err   = 0;
+
+  if ((paddr = pmm_alloc_zeroed()) == 0)
+    return -ENOMEM;
+
+  // read the part of the page that is in the file, rest of it stays zero filled
+  if (NULL != mem->file && pos < mem->size) {
+    size = mem->size - pos > PAGE_SIZE ? PAGE_SIZE : mem->size - pos;
+
+    if ((err = vfs_read(mem->file, mem->offset + pos, size, phys_to_virt(paddr))) < 0) {
+      pmm_free(paddr, 1);
+      return err;
+    }
+  }
+
+  mem->paddr[i] = paddr;
+  return 0;
+}
+
 void region_free(region_t *mem) {
   if (NULL == mem)
     return;
@@ -52,11 +170,21 @@ void region_free(region_t *mem) {
    * it uses vmm_unmap with SAVE attribute
 
   */
-  if (mem->paddr != 0)
-    pmm_free(mem->paddr, mem->num);
+  for (uint64_t i = 0, num = 0; NULL != mem->paddr && i < mem->num; i += num) {
+    num = __region_run(mem, i);
+
+    // skip the pages that are not loaded
+    if (mem->paddr[i] != 0)
+      pmm_free(mem->paddr[i], num);
+  }
+
+  // drop the region's reference to the file
+  if (NULL != mem->file)
+    vfs_close(mem->file);
 
-  // free the memory region object
-  heap_free(mem);
+  // free the page list and the memory region object
+  heap_free(mem->paddr);
+  slab_free(mem);
 }
 
 const char *region_name(region_t *mem) {
@@ -120,70 +248,447 @@ region_t *region_find(region_t **head, uint8_t type, uint8_t vma) {
   return NULL;
 }
 
+/*
+
+ * loaded pages of a region are mapped with the region's attributes, then the
+ * pages that should not be accessible at all, and the shared pages, which
+ * should stay read-only so they are copied on the first write, are restricted
+
+*/
+void __region_restrict(region_t *mem) {
+  for (uint64_t i = 0; i < mem->num; i++) {
+    if (mem->paddr[i] == 0)
+      continue;
+
+    if (REGION_PROT_NONE == mem->prot)
+      vmm_clear(mem->vaddr + i * PAGE_SIZE, 1, PTE_FLAG_P);
+
+    else if (pmm_is_shared(mem->paddr[i]))
+      vmm_clear(mem->vaddr + i * PAGE_SIZE, 1, PTE_FLAG_RW);
+  }
+}
+
 int32_t region_map(region_t *mem) {
   if (NULL == mem)
     return -EINVAL;
 
   void    *vaddr = NULL;
-  uint64_t attr  = 0;
+  uint64_t attr = __region_map_attr(mem), below = __region_below(mem), above = __region_above(mem), num = 0;
+  int32_t  err  = 0;
 
-  // setup the VMM attributes for the memory region
-  attr |= __region_attr(mem->type) | VMM_ATTR_SAVE;
-  attr |= (mem->vma == VMM_VMA_USER ? VMM_ATTR_USER : 0);
+  // user regions are demand paged, so just reserve the vaddr (see region_fault())
+  if (NULL == mem->paddr && VMM_VMA_USER == mem->vma)
+    return __region_reserve(mem);
 
-  // if vaddr is NULL, use vmm_map() to get a free vaddr
-  if (NULL == mem->vaddr) {
-    vaddr = mem->vaddr = vmm_map(mem->num, 0, attr);
-    mem->paddr         = vmm_resolve(mem->vaddr);
+  // kernel stacks are not demand paged, but they still need the guard page below them
+  if (NULL == mem->paddr && REGION_TYPE_STACK == mem->type) {
+    if ((err = __region_reserve(mem)) != 0)
+      return err;
+
+    return __region_resolve(mem, vmm_map_vaddr((uint64_t)mem->vaddr, mem->num, 0, attr));
   }
 
-  // if paddr is NULL, map the specified vaddr to a free paddr
-  else if (mem->paddr == 0) {
-    vaddr      = vmm_map_vaddr((uint64_t)mem->vaddr, mem->num, 0, attr);
-    mem->paddr = vmm_resolve(vaddr);
+  // if vaddr is NULL, use vmm_map() to get a free vaddr
+  if (NULL == mem->vaddr)
+    return __region_resolve(mem, mem->vaddr = vmm_map(mem->num, 0, attr));
+
+  // if paddr is NULL, map the specified vaddr to free pages
+  if (NULL == mem->paddr)
+    return __region_resolve(mem, vmm_map_vaddr((uint64_t)mem->vaddr, mem->num, 0, attr));
+
+  // reserve the pages below and above the region again (if any)
+  if (below != 0 && NULL == vmm_reserve((uint64_t)mem->vaddr - below * PAGE_SIZE, below, attr))
+    return -EFAULT;
+
+  if (above != 0 && NULL == vmm_reserve((uint64_t)mem->vaddr + mem->num * PAGE_SIZE, above, attr))
+    return -EFAULT;
+
+  // if we already have vaddr and paddr, just map the pages to exact vaddr again
+  for (uint64_t i = 0; i < mem->num; i += num) {
+    num   = __region_run(mem, i);
+    vaddr = mem->vaddr + i * PAGE_SIZE;
+
+    // pages that are not loaded yet are only reserved
+    if (mem->paddr[i] == 0)
+      vaddr = vmm_reserve((uint64_t)vaddr, num, attr);
+    else
+      vaddr = vmm_map_exact(mem->paddr[i], (uint64_t)vaddr, num, attr);
+
+    // check the result of the mapping
+    if (NULL == vaddr)
+      return -EFAULT;
   }
 
-  // if we already have vaddr and paddr, just map the paddr to exact vaddr again
-  else
-    vaddr = vmm_map_exact(mem->paddr, (uint64_t)mem->vaddr, mem->num, attr);
+  // shared pages should stay read-only, so they are copied on the first write (see region_fault())
+  if (mem->vma == VMM_VMA_USER)
+    __region_restrict(mem);
 
-  // check the result of the mapping
-  return NULL == vaddr ? -EFAULT : 0;
+  return 0;
 }
 
 int32_t region_unmap(region_t *mem) {
   if (NULL == mem)
     return -EINVAL;
-  return vmm_unmap(mem->vaddr, mem->num, VMM_ATTR_SAVE);
+
+  uint64_t num = 0;
+  int32_t  err = 0;
+
+  // region is not mapped
+  if (NULL == mem->paddr)
+    return 0;
+
+  // unmap the loaded pages, and release the addresses of the pages that are not loaded
+  for (uint64_t i = 0; i < mem->num; i += num) {
+    num = __region_run(mem, i);
+
+    if (mem->paddr[i] == 0)
+      err = vmm_release(mem->vaddr + i * PAGE_SIZE, num);
+    else
+      err = vmm_unmap(mem->vaddr + i * PAGE_SIZE, num, VMM_ATTR_SAVE);
+
+    if (err != 0)
+      return err;
+  }
+
+  // release the pages below and above the region (if any)
+  if ((num = __region_below(mem)) != 0 && (err = vmm_release(mem->vaddr - num * PAGE_SIZE, num)) != 0)
+    return err;
+
+  if ((num = __region_above(mem)) != 0)
+    return vmm_release(mem->vaddr + mem->num * PAGE_SIZE, num);
+
+  return 0;
 }
 
 region_t *region_copy(region_t *mem) {
   if (NULL == mem)
     return NULL;
 
-  void     *vaddr = NULL;
-  region_t *copy  = NULL;
+  region_t *copy = NULL;
 
-  if ((vaddr = vmm_map(mem->num, 0, 0)) == NULL)
-    goto end;
+  if ((copy = slab_alloc(&region_cache)) == NULL)
+    return NULL;
 
-  if ((copy = heap_alloc(sizeof(region_t))) == NULL)
-    goto end;
+  // setup the new copied region structure
+  bzero(copy, sizeof(region_t));
+  copy->type  = mem->type;
+  copy->vaddr = mem->vaddr;
+  copy->vma   = mem->vma;
+  copy->num   = mem->num;
+  copy->max   = mem->max;
+  copy->prot  = mem->prot;
 
-  // copy the original region to the new one
-  memcpy(vaddr, mem->vaddr, mem->num * PAGE_SIZE);
+  // allocate new pages for the copy
+  if (NULL == (copy->paddr = heap_alloc(mem->num * sizeof(uint64_t))))
+    goto fail;
 
-  // setup the new copied region structure
+  if (pmm_alloc_pages(mem->num, copy->paddr) != 0)
+    goto fail;
+
+  // copy the original region to the new pages, using the direct map
+  for (uint64_t i = 0; i < mem->num; i++)
+    memcpy(phys_to_virt(copy->paddr[i]), mem->vaddr + i * PAGE_SIZE, PAGE_SIZE);
+
+  return copy;
+
+fail:
+  heap_free(copy->paddr);
+  slab_free(copy);
+  return NULL;
+}
+
+/*
+
+ * copy-on-write
+
+ * instead of copying the contents of the region, the copy shares the same
+ * physical pages with the original region, every page gets an extra reference
+ * (see pmm_ref()) and it's mapped as read-only in both of the regions, so the
+ * first write to a shared page causes a page fault, and region_fault() gives
+ * the region that caused the fault it's own copy of the page
+
+ * the region should be mapped in the current VMM
+
+*/
+region_t *region_share(region_t *mem) {
+  if (NULL == mem || NULL == mem->paddr)
+    return NULL;
+
+  region_t *copy = NULL;
+  uint64_t  i = 0, num = 0;
+
+  if ((copy = slab_alloc(&region_cache)) == NULL)
+    return NULL;
+
+  // setup the new shared region structure
   bzero(copy, sizeof(region_t));
   copy->type  = mem->type;
   copy->vaddr = mem->vaddr;
   copy->vma   = mem->vma;
-  copy->paddr = vmm_resolve(vaddr);
   copy->num   = mem->num;
+  copy->max   = mem->max;
+  copy->prot  = mem->prot;
+
+  if (NULL == (copy->paddr = heap_alloc(mem->num * sizeof(uint64_t))))
+    goto fail;
+
+  memcpy(copy->paddr, mem->paddr, mem->num * sizeof(uint64_t));
 
-end:
-  if (NULL != vaddr)
-    vmm_unmap(vaddr, mem->num, VMM_ATTR_SAVE);
+  // add a reference for the copy to every loaded page
+  for (; i < mem->num; i++)
+    if (mem->paddr[i] != 0 && pmm_ref(mem->paddr[i]) != 0)
+      goto fail;
+
+  // pages that are not loaded yet are loaded from the same file
+  if (NULL != mem->file && region_file(copy, mem->file, mem->offset, mem->size) != 0)
+    goto fail;
+
+  // original region should not be able to write to the shared pages either
+  for (i = 0; i < mem->num; i += num) {
+    num = __region_run(mem, i);
+
+    if (mem->paddr[i] != 0)
+      vmm_clear(mem->vaddr + i * PAGE_SIZE, num, PTE_FLAG_RW);
+  }
 
   return copy;
+
+fail:
+  // drop the references we added
+  while (i > 0)
+    if (mem->paddr[--i] != 0)
+      pmm_free(mem->paddr[i], 1);
+
+  heap_free(copy->paddr);
+  slab_free(copy);
+  return NULL;
+}
+
+/*
+
+ * handles a page fault caused by an access to the region, if the page is not
+ * loaded yet, it's loaded (demand paging), if it's a write to a shared page,
+ * the page is copied (copy-on-write)
+
+*/
+int32_t region_fault(region_t *mem, void *vaddr, bool write) {
+  if (NULL == mem || NULL == mem->paddr || mem->vaddr > vaddr)
+    return -EINVAL;
+
+  uint64_t i = (vaddr - mem->vaddr) / PAGE_SIZE, paddr = 0, attr = __region_map_attr(mem);
+  int32_t  err = 0;
+
+  if (i >= mem->num)
+    return -EINVAL;
+
+  // we cannot access a region with no access, or write to a read-only region
+  if (REGION_PROT_NONE == mem->prot || (write && !(mem->prot & REGION_PROT_WRITE)))
+    return -EFAULT;
+
+  // load the page if it's not loaded yet
+  if (mem->paddr[i] == 0 && (err = __region_load(mem, i)) != 0)
+    return err;
+
+  /*
+
+   * if the page is still shared, copy it to a new page, which is only used by
+   * this region, and drop our reference to the shared page, otherwise other
+   * owners already got their own copies, so we can just make the page writeable
+
+  */
+  if (write && pmm_is_shared(mem->paddr[i])) {
+    if (NULL == (paddr = pmm_alloc(1, 0)))
+      return -ENOMEM;
+
+    memcpy(phys_to_virt(paddr), phys_to_virt(mem->paddr[i]), PAGE_SIZE);
+    pmm_free(mem->paddr[i], 1);
+    mem->paddr[i] = paddr;
+  }
+
+  // shared pages are mapped as read-only till they are written to
+  if (pmm_is_shared(mem->paddr[i]))
+    attr |= VMM_ATTR_RDONLY;
+
+  if (NULL == vmm_map_exact(mem->paddr[i], (uint64_t)mem->vaddr + i * PAGE_SIZE, 1, attr))
+    return -EFAULT;
+
+  return 0;
+}
+
+int32_t region_limit(region_t *mem, uint64_t max) {
+  // max size can only be changed before the region is mapped
+  if (NULL == mem || NULL != mem->paddr || max < mem->num)
+    return -EINVAL;
+
+  if (REGION_TYPE_STACK != mem->type && REGION_TYPE_HEAP != mem->type)
+    return -EINVAL;
+
+  mem->max = max;
+  return 0;
+}
+
+/*
+
+ * grows a stack region down, so it contains the given address, the pages the
+ * region grows to are already reserved when the region is mapped, so this only
+ * extends the page list, new pages are loaded on the first access like any
+ * other page of the region (see region_fault())
+
+ * if the address is in the guard page (or below it) the stack overflowed, and
+ * the region cannot grow any further
+
+*/
+int32_t region_grow(region_t *mem, void *vaddr) {
+  if (NULL == mem || NULL == mem->paddr || REGION_TYPE_STACK != mem->type)
+    return -EINVAL;
+
+  uint64_t *paddr = NULL, num = 0;
+
+  // region already contains the address
+  if (vaddr >= mem->vaddr)
+    return 0;
+
+  // number of pages needed to reach the address
+  num = ((uint64_t)(mem->vaddr - vaddr) + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  if (mem->num + num > mem->max)
+    return -EFAULT;
+
+  if (NULL == (paddr = heap_alloc((mem->num + num) * sizeof(uint64_t))))
+    return -ENOMEM;
+
+  // new pages are placed at the start of the list, and they are not loaded yet
+  bzero(paddr, num * sizeof(uint64_t));
+  memcpy(paddr + num, mem->paddr, mem->num * sizeof(uint64_t));
+  heap_free(mem->paddr);
+
+  mem->paddr = paddr;
+  mem->vaddr -= num * PAGE_SIZE;
+  mem->num += num;
+
+  return 0;
+}
+
+/*
+
+ * resizes a heap region, heap grows up, and the pages it can grow to are
+ * reserved when the region is mapped, so growing only extends the page list,
+ * pages that are removed while shrinking are freed, but their addresses stay
+ * reserved, so the region can grow back to it's max size
+
+*/
+int32_t region_resize(region_t *mem, uint64_t num) {
+  if (NULL == mem || NULL == mem->paddr || REGION_TYPE_HEAP != mem->type || num == 0 || num > mem->max)
+    return -EINVAL;
+
+  uint64_t *paddr = NULL, i = num, run = 0;
+  void     *vaddr = NULL;
+  int32_t   err   = 0;
+
+  // free the loaded pages after the new end
+  for (; i < mem->num; i += run) {
+    run   = __region_run(mem, i);
+    vaddr = mem->vaddr + i * PAGE_SIZE;
+
+    if (mem->paddr[i] == 0)
+      continue;
+
+    if ((err = vmm_unmap(vaddr, run, VMM_ATTR_SAVE)) != 0)
+      return err;
+
+    if (NULL == vmm_reserve((uint64_t)vaddr, run, __region_map_attr(mem)))
+      return -EFAULT;
+
+    pmm_free(mem->paddr[i], run);
+  }
+
+  // new pages are placed at the end of the list, and they are not loaded yet
+  if (num > mem->num) {
+    if (NULL == (paddr = heap_realloc(mem->paddr, num * sizeof(uint64_t))))
+      return -ENOMEM;
+
+    bzero(paddr + mem->num, (num - mem->num) * sizeof(uint64_t));
+    mem->paddr = paddr;
+  }
+
+  mem->num = num;
+  return 0;
+}
+
+/*
+
+ * splits a mapped user region in two, first num pages stay in the region, and
+ * rest of the pages are moved to a new region (which is returned), pages stay
+ * mapped, so the new region should be added to the same list as the region
+
+ * stack and heap regions reserve the pages they can grow to, so they cannot
+ * be split
+
+*/
+region_t *region_split(region_t *mem, uint64_t num) {
+  if (NULL == mem || NULL == mem->paddr || mem->vma != VMM_VMA_USER || num == 0 || num >= mem->num)
+    return NULL;
+
+  if (REGION_TYPE_STACK == mem->type || REGION_TYPE_HEAP == mem->type)
+    return NULL;
+
+  uint64_t  offset = num * PAGE_SIZE;
+  region_t *tail   = NULL;
+
+  if (NULL == (tail = region_new(mem->type, mem->vma, mem->vaddr + offset, mem->num - num)))
+    return NULL;
+
+  tail->prot = mem->prot;
+
+  if (NULL == (tail->paddr = heap_alloc(tail->num * sizeof(uint64_t))))
+    goto fail;
+
+  memcpy(tail->paddr, mem->paddr + num, tail->num * sizeof(uint64_t));
+
+  // rest of the region's contents in the file are loaded to the new region
+  if (NULL != mem->file && mem->size > offset &&
+      region_file(tail, mem->file, mem->offset + offset, mem->size - offset) != 0)
+    goto fail;
+
+  if (NULL != mem->file && mem->size > offset)
+    mem->size = offset;
+
+  mem->num = num;
+  return tail;
+
+fail:
+  heap_free(tail->paddr);
+  slab_free(tail);
+  return NULL;
+}
+
+/*
+
+ * changes the protection of the region, if the region is already mapped, it's
+ * loaded pages are mapped again with the new attributes
+
+*/
+int32_t region_protect(region_t *mem, uint8_t prot) {
+  if (NULL == mem || mem->vma != VMM_VMA_USER)
+    return -EINVAL;
+
+  uint64_t num = 0;
+  void    *vaddr = NULL;
+
+  mem->prot = prot;
+
+  // region is not mapped
+  if (NULL == mem->paddr)
+    return 0;
+
+  for (uint64_t i = 0; i < mem->num; i += num) {
+    num   = __region_run(mem, i);
+    vaddr = mem->vaddr + i * PAGE_SIZE;
+
+    if (mem->paddr[i] != 0 && NULL == vmm_map_exact(mem->paddr[i], (uint64_t)vaddr, num, __region_map_attr(mem)))
+      return -EFAULT;
+  }
+
+  __region_restrict(mem);
+  return 0;
 }
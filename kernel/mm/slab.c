@@ -0,0 +1,259 @@
+#include "mm/slab.h"
+#include "mm/vmm.h"
+#include "mm/pmm.h"
+
+#include "util/printk.h"
+#include "util/panic.h"
+#include "util/math.h"
+
+#include "errno.h"
+#include "types.h"
+
+#define slab_fail(f, ...) pfail("Slab: " f, ##__VA_ARGS__)
+#define slab_debg(f, ...) pdebg("Slab: " f, ##__VA_ARGS__)
+
+/*
+
+ * slab allocator
+
+ * every cache hands out objects of a single size, these objects are
+ * carved out of slabs, and each slab is a single page that is obtained
+ * with vmm_map(), a slab starts with a small header, which is followed by
+ * all the objects
+
+ * free objects in a slab are linked together with a singly linked list,
+ * the first 8 bytes of a free object points to the next free object, so
+ * both allocating and freeing an object is just a list push/pop
+
+ * since slabs are page aligned, the header of the slab an object belongs
+ * to is found by just rounding the object address down to a page boundary
+
+ * slabs are kept in two lists, partial slabs (have free objects) and full
+ * slabs (no free objects), when a slab becomes empty it's unmapped, except
+ * we keep a single spare empty slab around, so a cache that goes back and
+ * forth between N and N+1 slabs doesn't remap a page every time
+
+ * caches created with SLAB_CACHE_TAGS also store a 16 bit tag for each
+ * object, tags are placed in an array right after the slab header, so the
+ * objects themselves are not touched, callers can use the tags to store
+ * small bits of information about an object (see slab_tag())
+
+*/
+
+#define SLAB_MAGIC       0x5ab1ca7e0b1ec75a
+#define SLAB_ALIGN       (16)
+#define SLAB_HEADER_SIZE ((sizeof(struct slab) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+
+struct slab {
+  uint64_t      magic; // used to verify the slab
+  slab_cache_t *cache; // cache the slab belongs to
+  struct slab  *next;  // next slab in the list
+  struct slab  *prev;  // previous slab in the list
+  void         *free;  // first free object
+  uint64_t      used;  // number of used objects
+};
+
+slab_cache_t *slab_cache_head = NULL; // list of caches that have been used
+
+#define __slab_from_obj(obj)  ((struct slab *)((uint64_t)(obj) & ~((uint64_t)PAGE_SIZE - 1)))
+#define __slab_is_valid(slab) ((slab)->magic == SLAB_MAGIC)
+#define __slab_obj_next(obj)  (*(void **)(obj))
+
+void __slab_list_add(struct slab **head, struct slab *slab) {
+  slab->prev = NULL;
+  slab->next = *head;
+
+  if (NULL != *head)
+    (*head)->prev = slab;
+
+  *head = slab;
+}
+
+void __slab_list_del(struct slab **head, struct slab *slab) {
+  if (NULL != slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *head = slab->next;
+
+  if (NULL != slab->next)
+    slab->next->prev = slab->prev;
+
+  slab->next = slab->prev = NULL;
+}
+
+int32_t __slab_cache_setup(slab_cache_t *cache) {
+  // objects should be able to at least hold the free list pointer
+  if (cache->size < SLAB_ALIGN)
+    cache->size = SLAB_ALIGN;
+
+  cache->size   = round_up(cache->size, SLAB_ALIGN);
+  cache->count  = (PAGE_SIZE - SLAB_HEADER_SIZE) / cache->size;
+  cache->offset = SLAB_HEADER_SIZE;
+
+  // make room for the tag array, which is placed before the objects
+  if (cache->flags & SLAB_CACHE_TAGS) {
+    for (; cache->count > 0; cache->count--) {
+      cache->offset = SLAB_HEADER_SIZE + round_up(cache->count * sizeof(uint16_t), SLAB_ALIGN);
+
+      if (cache->offset + cache->count * cache->size <= PAGE_SIZE)
+        break;
+    }
+  }
+
+  if (cache->count == 0) {
+    slab_fail("%s cache object size is too large (%u)", cache->name, cache->size);
+    return -EINVAL;
+  }
+
+  // add the cache to the cache list
+  cache->next     = slab_cache_head;
+  slab_cache_head = cache;
+
+  slab_debg("setup %s cache (size: %u, count: %u)", cache->name, cache->size, cache->count);
+  return 0;
+}
+
+struct slab *__slab_new(slab_cache_t *cache) {
+  struct slab *slab = vmm_map(1, 0, 0);
+  void        *obj  = NULL;
+  page_t      *page = NULL;
+
+  if (NULL == slab) {
+    slab_fail("failed to map a new slab for the %s cache", cache->name);
+    return NULL;
+  }
+
+  // mark the page as a slab in the page frame database
+  if (NULL != (page = pmm_page(vmm_resolve(slab)))) {
+    page->flags |= PAGE_FLAG_SLAB;
+    page->owner = cache;
+  }
+
+  slab->magic = SLAB_MAGIC;
+  slab->cache = cache;
+  slab->next  = slab->prev = NULL;
+  slab->free  = NULL;
+  slab->used  = 0;
+
+  // link all the objects to the free list (starting from the last one)
+  for (uint64_t i = cache->count; i > 0; i--) {
+    obj                  = (void *)slab + cache->offset + (i - 1) * cache->size;
+    __slab_obj_next(obj) = slab->free;
+    slab->free           = obj;
+  }
+
+  return slab;
+}
+
+void *slab_alloc(slab_cache_t *cache) {
+  struct slab *slab = NULL;
+  void        *obj  = NULL;
+
+  if (NULL == cache)
+    return NULL;
+
+  // first time using the cache, calculate the object size & count
+  if (cache->count == 0 && __slab_cache_setup(cache) != 0)
+    return NULL;
+
+  // get a slab with free objects
+  if (NULL == (slab = cache->partial)) {
+    if (NULL != (slab = cache->empty))
+      cache->empty = NULL;
+    else if (NULL == (slab = __slab_new(cache)))
+      return NULL;
+
+    __slab_list_add(&cache->partial, slab);
+  }
+
+  // pop an object from the free list
+  obj        = slab->free;
+  slab->free = __slab_obj_next(obj);
+  slab->used++;
+
+  // if there are no more free objects, move the slab to the full list
+  if (NULL == slab->free) {
+    __slab_list_del(&cache->partial, slab);
+    __slab_list_add(&cache->full, slab);
+  }
+
+  return obj;
+}
+
+void slab_free(void *obj) {
+  struct slab  *slab  = NULL;
+  slab_cache_t *cache = NULL;
+
+  if (NULL == obj)
+    return;
+
+  if (!__slab_is_valid(slab = __slab_from_obj(obj)))
+    return panic("Attempt to free an invalid slab object");
+
+  cache = slab->cache;
+
+  // if the slab was full, it now has a free object, so move it to the partial list
+  if (NULL == slab->free) {
+    __slab_list_del(&cache->full, slab);
+    __slab_list_add(&cache->partial, slab);
+  }
+
+  // push the object to the free list
+  __slab_obj_next(obj) = slab->free;
+  slab->free           = obj;
+
+  if (--slab->used != 0)
+    return;
+
+  // slab is empty, keep it as the spare slab or unmap it
+  __slab_list_del(&cache->partial, slab);
+
+  if (NULL == cache->empty) {
+    cache->empty = slab;
+    return;
+  }
+
+  slab->magic = 0;
+  vmm_unmap(slab, 1, 0);
+}
+
+bool slab_owns(void *obj) {
+  struct slab *slab = NULL;
+
+  if (NULL == obj)
+    return false;
+
+  // the slab header is never handed out as an object
+  if ((uint64_t)obj % PAGE_SIZE < SLAB_HEADER_SIZE)
+    return false;
+
+  if (!__slab_is_valid(slab = __slab_from_obj(obj)))
+    return false;
+
+  // neither is the tag array
+  return (uint64_t)obj % PAGE_SIZE >= slab->cache->offset;
+}
+
+slab_cache_t *slab_cache_of(void *obj) {
+  return slab_owns(obj) ? __slab_from_obj(obj)->cache : NULL;
+}
+
+slab_cache_t *slab_cache_next(slab_cache_t *cache) {
+  return NULL == cache ? slab_cache_head : cache->next;
+}
+
+uint16_t *slab_tag(void *obj) {
+  struct slab *slab = NULL;
+  uint16_t    *tags = NULL;
+
+  if (!slab_owns(obj))
+    return NULL;
+
+  slab = __slab_from_obj(obj);
+
+  if (!(slab->cache->flags & SLAB_CACHE_TAGS))
+    return NULL;
+
+  tags = (void *)slab + SLAB_HEADER_SIZE;
+  return &tags[((uint64_t)obj - (uint64_t)slab - slab->cache->offset) / slab->cache->size];
+}
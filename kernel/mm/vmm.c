@@ -1,11 +1,12 @@
-#include "sched/sched.h"
-#include "sched/task.h"
+#include "boot/multiboot.h"
 
 #include "mm/paging.h"
+#include "mm/slab.h"
 #include "mm/vmm.h"
 #include "mm/pmm.h"
 
 #include "util/string.h"
+#include "util/range.h"
 #include "util/printk.h"
 #include "util/mem.h"
 #include "util/bit.h"
@@ -18,13 +19,6 @@
 #define vmm_warn(f, ...) pwarn("VMM: " f, ##__VA_ARGS__)
 #define vmm_debg(f, ...) pdebg("VMM: " f, ##__VA_ARGS__)
 
-// virtual memory areas
-#define VMM_VMA_USER_START (0x0000000000000000 + PAGE_SIZE) // 0x0 can be interpreted with NULL
-#define VMM_VMA_USER_END   (0x00007fffffffffff)
-
-#define VMM_VMA_KERNEL_START (0xffff800000000000)
-#define VMM_VMA_KERNEL_END   (BOOT_KERNEL_START_VADDR)
-
 // some helper macros
 #define vmm_vma_does_contain(addr)                                                                                     \
   ((VMM_VMA_KERNEL_END > addr && addr >= VMM_VMA_KERNEL_START) ||                                                      \
@@ -64,6 +58,356 @@
 #define vmm_pt_index(vaddr) ((vaddr >> 12) & 0x1FF)
 #define vmm_pt_entry(vaddr) (vmm_pt_vaddr(vaddr)[vmm_pt_index(vaddr)])
 
+// 2 MiB pages (PD entries with the PS flag)
+#define VMM_LARGE_PAGE_COUNT (PTE_COUNT)
+#define VMM_LARGE_PAGE_SIZE  (VMM_LARGE_PAGE_COUNT * PAGE_SIZE)
+
+#define __vmm_is_large_aligned(addr) ((addr) % VMM_LARGE_PAGE_SIZE == 0)
+#define __vmm_large_fits(paddr, vaddr, num)                                                                            \
+  (__vmm_is_large_aligned(paddr) && __vmm_is_large_aligned(vaddr) && (num) >= VMM_LARGE_PAGE_COUNT)
+
+uint64_t vmm_direct_end = 0; // end of the direct map (0 if it is not mapped yet)
+
+/*
+
+ * only the available memory map entries are direct mapped, so the window has
+ * holes, mapped parts of the window are kept in a range tree, entries that do
+ * not fit in VMM_DIRECT_MAX nodes are still mapped, but they are not tracked,
+ * so they are resolved by walking the tables
+
+*/
+#define VMM_DIRECT_MAX (32)
+
+range_t *vmm_direct = NULL;                  // direct mapped parts of the window
+range_t  vmm_direct_ranges[VMM_DIRECT_MAX]; // nodes of the direct map range tree
+uint64_t vmm_direct_count = 0;               // used nodes of the direct map range tree
+
+// check if the address is in the direct map window
+#define __vmm_direct_window(vaddr) ((vaddr) >= VMM_DIRECT_START && VMM_DIRECT_END > (vaddr))
+
+// check if the address is in a direct mapped part of the window
+bool __vmm_direct_contains(uint64_t vaddr) {
+  range_t *node = NULL;
+
+  if (!__vmm_direct_window(vaddr) || vmm_direct_end <= vaddr)
+    return false;
+
+  return NULL != (node = range_floor(vmm_direct, vaddr)) && range_end(node) > vaddr;
+}
+
+#define VMM_RECURSIVE_START (vmm_indexes_to_addr(510, 0, 0, 0)) // start of the recursive paging area
+#define VMM_RECURSIVE_END   (vmm_indexes_to_addr(511, 0, 0, 0)) // end of the recursive paging area
+
+// check if the address is in the task area (see VMM_TASK_START)
+#define __vmm_task_contains(vaddr) ((vaddr) >= VMM_TASK_START && VMM_TASK_END > (vaddr))
+
+// check if the page tables of the address are shared between all the VMMs
+#define __vmm_is_shared(vaddr) ((vaddr) >= VMM_VMA_KERNEL_START && !__vmm_task_contains(vaddr))
+
+// shared pages are global pages, so they are invalidated for all the PCIDs
+#define __vmm_global(vaddr) (__vmm_is_shared(vaddr) ? PTE_FLAG_G : 0)
+
+/*
+
+ * every VMM (address space) has it's own PML4, and it's own user VMA, so
+ * each one also keeps track of the free virtual address ranges in it's user
+ * VMA, kernel VMA is shared between all the VMMs, so there's a single list
+ * of free ranges for the kernel VMA
+
+ * free ranges are stored in a range tree (see util/range.c), so finding a
+ * free range for a mapping is O(log n), instead of walking the page tables
+ * for every single page
+
+*/
+struct vmm {
+  uint64_t pml4;  // physical address of the PML4
+  range_t *free;  // free ranges in the user VMA
+  uint16_t pcid;  // process-context identifier (PCID) of the VMM
+  uint64_t gen;   // PCID generation the PCID belongs to
+  bool     flush; // should the TLB entries of the PCID be flushed with the next switch
+};
+
+/*
+
+ * process-context identifiers (PCIDs)
+
+ * if supported, every VMM gets a PCID, which tags the VMM's TLB entries, so
+ * the TLB entries are not flushed when switching between the VMMs, PCID 0
+ * belongs to the VMM created by the bootloader
+
+ * there are only 4096 PCIDs, when we run out, a new generation is started, and
+ * all the VMMs from the older generations get a new PCID on their next switch,
+ * a PCID may have TLB entries left from it's previous owner, so every VMM flushes
+ * the entries of it's PCID the first time it's switched to with that PCID
+
+ * kernel VMA is shared between all the VMMs, so the shared kernel pages are
+ * mapped as global pages, which means invlpg invalidates them for all the PCIDs
+
+*/
+#define VMM_PCID_MAX     (4095)
+#define VMM_CR3_NO_FLUSH (1UL << 63) // don't flush the PCID's TLB entries when writing to CR3
+
+#define VMM_INVPCID_ADDR   (0) // invalidate an address for a PCID
+#define VMM_INVPCID_SINGLE (1) // invalidate all the entries of a PCID, except the global ones
+#define VMM_INVPCID_ALL    (2) // invalidate all the entries of all the PCIDs, including the global ones
+
+bool     vmm_pcid      = false; // are PCIDs enabled
+bool     vmm_invpcid   = false; // is INVPCID supported
+uint16_t vmm_pcid_next = 1;     // next available PCID
+uint64_t vmm_pcid_gen  = 1;     // current PCID generation
+
+#define vmm_invpcid(type, pcid, addr)                                                                                  \
+  do {                                                                                                                 \
+    struct {                                                                                                           \
+      uint64_t id, vaddr;                                                                                              \
+    } __desc = {pcid, addr};                                                                                           \
+    __asm__ volatile("invpcid %0, %1\n" ::"m"(__desc), "r"((uint64_t)(type)) : "memory");                               \
+  } while (0)
+
+slab_cache_t vmm_cache       = slab_cache("vmm", sizeof(struct vmm));
+slab_cache_t vmm_range_cache = slab_cache("vmm_range", sizeof(range_t));
+
+range_t    *vmm_kernel_free = NULL;         // free ranges in the kernel VMA
+range_t     vmm_kernel_ranges[3];           // initial free ranges (kernel VMA and the first user VMA)
+struct vmm  vmm_kernel  = {0};              // VMM created by the bootloader
+struct vmm *vmm_current = &vmm_kernel;      // currently used VMM
+
+// get the free range tree for the VMA that contains the address
+#define __vmm_ranges(vaddr) ((vaddr) >= VMM_VMA_KERNEL_START ? &vmm_kernel_free : &vmm_current->free)
+
+// free range nodes may be static (initial ranges), only the ones from the cache are freed
+void __vmm_range_put(range_t *node) {
+  if (slab_owns(node))
+    slab_free(node);
+}
+
+void __vmm_range_clear(range_t *node) {
+  if (NULL == node)
+    return;
+
+  __vmm_range_clear(node->left);
+  __vmm_range_clear(node->right);
+  __vmm_range_put(node);
+}
+
+/*
+
+ * remove [start, end) from a free range, parts of the range that are outside
+ * of the removed area are put back, if both sides are put back, we need an
+ * extra node, which is taken from spare, if node is not used anymore, it's
+ * added to the unused list (so it can be freed after we are done with the tree)
+
+*/
+void __vmm_range_cut(range_t **root, range_t *node, uint64_t start, uint64_t end, range_t **spare, range_t **unused) {
+  uint64_t node_start = node->start, node_end = range_end(node);
+
+  range_remove(root, node);
+
+  // put back the part before the removed area
+  if (start > node_start) {
+    node->size = start - node_start;
+    range_insert(root, node);
+    node = NULL;
+  }
+
+  // put back the part after the removed area
+  if (end < node_end) {
+    if (NULL == node) {
+      node   = *spare;
+      *spare = NULL;
+    }
+
+    node->start = end;
+    node->size  = node_end - end;
+    range_insert(root, node);
+    node = NULL;
+  }
+
+  if (NULL != node) {
+    node->left = *unused;
+    *unused    = node;
+  }
+}
+
+// find a free range of size bytes and remove it from the tree
+uint64_t __vmm_range_alloc(range_t **root, uint64_t size, uint64_t align) {
+  range_t *node = NULL, *spare = NULL, *unused = NULL;
+  uint64_t start = 0;
+
+  // page alignment is always satisfied
+  if (align <= PAGE_SIZE)
+    align = 0;
+
+  /*
+
+   * aligned allocations may split a free range in two, so we need a spare
+   * node, it's allocated first as the allocation itself may modify the tree
+
+  */
+  if (align != 0 && NULL == (spare = slab_alloc(&vmm_range_cache)))
+    return 0;
+
+  if (NULL != (node = range_fit(*root, size, align))) {
+    start = align != 0 ? round_up(node->start, align) : node->start;
+    __vmm_range_cut(root, node, start, start + size, &spare, &unused);
+  }
+
+  __vmm_range_put(spare);
+  __vmm_range_put(unused);
+
+  return start;
+}
+
+// remove all the free ranges in [start, end) from the tree
+int32_t __vmm_range_take(range_t **root, uint64_t start, uint64_t end) {
+  range_t *node = NULL, *next = NULL, *spare = NULL, *unused = NULL;
+
+  // if a single range contains the whole area, it's split in two
+  if (NULL != (node = range_floor(*root, start)) && node->start < start && range_end(node) > end &&
+      NULL == (spare = slab_alloc(&vmm_range_cache)))
+    return -ENOMEM;
+
+  // start from the range that contains the start address (if any)
+  if (NULL == (node = range_floor(*root, start)) || range_end(node) <= start)
+    node = range_ceil(*root, start);
+
+  for (; NULL != node && node->start < end; node = next) {
+    next = range_ceil(*root, range_end(node));
+    __vmm_range_cut(root,
+        node,
+        node->start > start ? node->start : start,
+        range_end(node) < end ? range_end(node) : end,
+        &spare,
+        &unused);
+  }
+
+  __vmm_range_put(spare);
+
+  for (; NULL != unused; unused = next) {
+    next = unused->left;
+    __vmm_range_put(unused);
+  }
+
+  return 0;
+}
+
+// add [start, end) to the tree, merge it with the free ranges next to it
+int32_t __vmm_range_free(range_t **root, uint64_t start, uint64_t end) {
+  range_t *before = NULL, *after = NULL, *node = NULL;
+
+  while (true) {
+    before = range_floor(*root, start);
+    after  = range_ceil(*root, start);
+
+    if ((NULL != before && range_end(before) > start) || (NULL != after && after->start < end)) {
+      vmm_warn("attempt to free an already free range (0x%p - 0x%p)", start, end);
+      __vmm_range_put(node);
+      return -EFAULT;
+    }
+
+    before = NULL != before && range_end(before) == start ? before : NULL;
+    after  = NULL != after && after->start == end ? after : NULL;
+
+    /*
+
+     * if we cannot merge it, we need a new node, allocating it may modify
+     * the tree, so we need to check the neighbours again after that
+
+    */
+    if (NULL != before || NULL != after || NULL != node)
+      break;
+
+    if (NULL == (node = slab_alloc(&vmm_range_cache)))
+      return -ENOMEM;
+  }
+
+  if (NULL != after)
+    range_remove(root, after);
+
+  if (NULL != before) {
+    range_remove(root, before);
+    before->size = (NULL != after ? range_end(after) : end) - before->start;
+    range_insert(root, before);
+    __vmm_range_put(after);
+  }
+
+  else if (NULL != after) {
+    after->size += after->start - start;
+    after->start = start;
+    range_insert(root, after);
+  }
+
+  else {
+    node->start = start;
+    node->size  = end - start;
+    range_insert(root, node);
+    node = NULL;
+  }
+
+  __vmm_range_put(node);
+  return 0;
+}
+
+// clip [start, end) to the VMA that contains the start address
+bool __vmm_range_clip(uint64_t *start, uint64_t *end) {
+  bool kernel = *start >= VMM_VMA_KERNEL_START;
+
+  // free ranges of the task area are not tracked
+  if (__vmm_task_contains(*start))
+    return false;
+
+  if (*start < (kernel ? VMM_VMA_KERNEL_START : VMM_VMA_USER_START))
+    *start = kernel ? VMM_VMA_KERNEL_START : VMM_VMA_USER_START;
+
+  if (*end > (kernel ? VMM_VMA_KERNEL_END : VMM_VMA_USER_END))
+    *end = kernel ? VMM_VMA_KERNEL_END : VMM_VMA_USER_END;
+
+  return *end > *start;
+}
+
+// check if a single free range contains all of [start, end)
+bool __vmm_range_is_free(range_t *root, uint64_t start, uint64_t end) {
+  range_t *node = range_floor(root, start);
+  return NULL != node && range_end(node) >= end;
+}
+
+/*
+
+ * mark num pages starting from vaddr as used, fails if any of the pages is
+ * already used, unless reuse is set (then only the free pages are marked)
+
+*/
+int32_t __vmm_reserve(uint64_t vaddr, uint64_t num, bool reuse) {
+  uint64_t end = vaddr + num * PAGE_SIZE;
+
+  // direct map window is never reserved by anything other than the direct map
+  if (__vmm_direct_window(vaddr) || __vmm_direct_window(end - 1))
+    return -EFAULT;
+
+  if (!__vmm_range_clip(&vaddr, &end))
+    return 0;
+
+  if (!reuse && !__vmm_range_is_free(*__vmm_ranges(vaddr), vaddr, end)) {
+    vmm_warn("attempt to reserve an already used range (0x%p - 0x%p)", vaddr, end);
+    return -EFAULT;
+  }
+
+  return __vmm_range_take(__vmm_ranges(vaddr), vaddr, end);
+}
+
+// mark num pages starting from vaddr as free
+int32_t __vmm_release(uint64_t vaddr, uint64_t num) {
+  uint64_t end = vaddr + num * PAGE_SIZE;
+
+  if (__vmm_direct_window(vaddr) || __vmm_direct_window(end - 1))
+    return -EFAULT;
+
+  if (!__vmm_range_clip(&vaddr, &end))
+    return 0;
+
+  return __vmm_range_free(__vmm_ranges(vaddr), vaddr, end);
+}
+
 uint64_t *__vmm_entry_from_vaddr(uint64_t vaddr) {
   uint64_t pd_entry = 0;
 
@@ -110,19 +454,151 @@ bool __vmm_is_table_free(uint64_t *table_vaddr) {
   return true;
 }
 
-int32_t __vmm_alert_tasks() {
-  void   *vmm  = vmm_get();
-  task_t *task = NULL;
+/*
+
+ * page tables keep a counter of their used entries (see pmm_table()), so we
+ * can find out if a page table is empty in O(1), instead of scanning all of
+ * it's entries, page tables that are allocated before the PMM is ready (and
+ * the ones created by the bootloader) don't have a counter, so they are scanned
+
+*/
 
-  while (NULL != (task = sched_next(task))) {
-    if (vmm != task->vmm)
-      task->old = true;
+// allocate a new empty page table for the entry, table is the address of the new table (see the table macros)
+uint64_t __vmm_table_alloc(uint64_t *entry, uint64_t flags, uint64_t *table) {
+  // pre-zeroed pages are cleared using the direct map, so they can only be used after it's ready
+  bool     zeroed = vmm_direct_end != 0;
+  uint64_t paddr  = zeroed ? pmm_alloc_zeroed() : pmm_alloc(1, 0);
+
+  if (paddr == 0) {
+    vmm_fail("failed to allocate a new page table");
+    return 0;
   }
 
-  return 0;
+  pmm_table(paddr, 0);
+  *entry = paddr | flags;
+
+  if (!zeroed)
+    bzero(table, PAGE_SIZE);
+
+  return paddr;
+}
+
+// a new entry is used in the page table
+void __vmm_table_get(uint64_t paddr) {
+  uint16_t *used = pmm_table_used(paddr);
+
+  if (NULL != used)
+    (*used)++;
+}
+
+// an entry of the page table is not used anymore, returns true if the table is empty
+bool __vmm_table_put(uint64_t paddr, uint64_t *table_vaddr) {
+  uint16_t *used = pmm_table_used(paddr);
+
+  if (NULL == used || *used == 0)
+    return __vmm_is_table_free(table_vaddr);
+
+  return --(*used) == 0;
+}
+
+/*
+
+ * an entry of the page table at the given level (1 = PT, 2 = PD, 3 = PDPT) that
+ * maps vaddr is no longer used, if the table is now empty, it's freed and the
+ * same is done for the upper level table, returns true if any table is freed
+
+*/
+bool __vmm_table_release(uint64_t vaddr, uint8_t level, bool invalidate) {
+  uint64_t *table = NULL, *parent = NULL, paddr = 0;
+  bool      freed = false;
+  int32_t   err   = 0;
+
+  /*
+
+   * PDPTs of the shared kernel VMA are never freed, as all the VMMs point to
+   * the same PDPTs (see __vmm_share_init())
+
+  */
+  for (; level < PAGING_LEVEL && !(level == 3 && __vmm_is_shared(vaddr)); level++) {
+    switch (level) {
+    case 1:
+      table  = vmm_pt_vaddr(vaddr);
+      paddr  = vmm_pt_paddr(vaddr);
+      parent = &vmm_pd_entry(vaddr);
+      break;
+
+    case 2:
+      table  = vmm_pd_vaddr(vaddr);
+      paddr  = vmm_pd_paddr(vaddr);
+      parent = &vmm_pdpt_entry(vaddr);
+      break;
+
+    default:
+      table  = vmm_pdpt_vaddr(vaddr);
+      paddr  = vmm_pdpt_paddr(vaddr);
+      parent = &vmm_pml4_entry(vaddr);
+      break;
+    }
+
+    if (!__vmm_table_put(paddr, table))
+      break;
+
+    if ((err = pmm_free(paddr, 1)) != 0)
+      vmm_warn("failed to free the page table @ 0x%p: %s", paddr, strerror(err));
+
+    // remove the table, and it's recursive mapping from the TLB
+    *parent = 0;
+    freed   = true;
+
+    if (invalidate)
+      vmm_invlpg(table);
+  }
+
+  return freed;
+}
+
+// give the VMM a new PCID from the current generation
+void __vmm_pcid_alloc(struct vmm *vmm) {
+  // we ran out of PCIDs, start a new generation
+  if (vmm_pcid_next > VMM_PCID_MAX) {
+    vmm_debg("ran out of PCIDs, starting generation %u", ++vmm_pcid_gen);
+    vmm_pcid_next = 1;
+  }
+
+  vmm->pcid  = vmm_pcid_next++;
+  vmm->gen   = vmm_pcid_gen;
+  vmm->flush = true;
+}
+
+// flush all the TLB entries of the current PCID, except the global ones
+void __vmm_flush_current() {
+  // CR3 always reads with the no-flush bit cleared
+  __asm__ volatile("mov %0, %%cr3\n" ::"r"(_get_cr3()) : "memory");
+}
+
+// flush all the TLB entries of all the PCIDs, including the global ones
+void __vmm_flush_all() {
+  uint64_t cr4 = _get_cr4();
+
+  if (vmm_invpcid) {
+    vmm_invpcid(VMM_INVPCID_ALL, 0, 0);
+    return;
+  }
+
+  // changing the global page flag (bit 7 on CR4) flushes all the entries
+  if (cr4 & (1 << 7)) {
+    __asm__ volatile("mov %0, %%cr4\n" ::"r"(cr4 & ~(1 << 7)) : "memory");
+    __asm__ volatile("mov %0, %%cr4\n" ::"r"(cr4) : "memory");
+    return;
+  }
+
+  // there are no global pages (so no PCIDs either), reloading CR3 flushes all the entries
+  __vmm_flush_current();
 }
 
 int32_t vmm_init() {
+  uint32_t regs[4];
+
   /*
 
    * enable the XD page flag (bit 11 on EFER)
@@ -135,72 +611,243 @@ int32_t vmm_init() {
   uint64_t efer = _msr_read(MSR_EFER);
   _msr_write(MSR_EFER, efer | (1 << 11));
 
+  /*
+
+   * enable the write protection (bit 16 on CR0), so the kernel cannot write
+   * to read-only pages either, otherwise writing to a copy-on-write page from
+   * the kernel (during a syscall) would modify the page for all of it's owners
+
+   * this means the kernel takes page faults on user pages, which only works
+   * if the fault frame can be pushed, so the kernel never uses the user stack
+   * as it's own stack (see sys_handler), user pages are only accessed through
+   * pointers while running on the kernel stack
+
+  */
+  __asm__("mov %0, %%cr0\n" ::"r"(_get_cr0() | (1 << 16)));
+
+  // setup the VMM created by the bootloader
+  __asm__("mov %%cr3, %0\n" : "=r"(vmm_kernel.pml4));
+
+  /*
+
+   * enable the global pages (bit 7 on CR4), and the PCIDs (bit 17 on CR4) if
+   * they are supported (CPUID leaf 1, EDX bit 13 and ECX bit 17), PCIDs need
+   * the global pages, as the shared kernel pages should be global (see above)
+
+   * PCIDs can only be enabled while using PCID 0, which is what the bootloader
+   * uses, so the VMM created by the bootloader gets the PCID 0
+
+  */
+  _cpuid(1, 0, regs);
+
+  if (bit_get(regs[CPUID_EDX], 13))
+    __asm__("mov %0, %%cr4\n" ::"r"(_get_cr4() | (1 << 7)));
+
+  if (bit_get(regs[CPUID_EDX], 13) && bit_get(regs[CPUID_ECX], 17)) {
+    __asm__("mov %0, %%cr4\n" ::"r"(_get_cr4() | (1 << 17)));
+    vmm_pcid = true;
+
+    // check if the INVPCID is supported (CPUID leaf 7, EBX bit 10)
+    _cpuid(7, 0, regs);
+    vmm_invpcid = bit_get(regs[CPUID_EBX], 10);
+
+    vmm_debg("enabled PCIDs (INVPCID: %s)", vmm_invpcid ? "supported" : "not supported");
+  }
+
+  /*
+
+   * setup the initial free ranges, whole kernel VMA is free except the direct
+   * map window (at the start of the kernel VMA), the task area and the recursive
+   * paging area (right after the task area), and the whole user VMA is free
+
+   * the direct map window is left out before anything is mapped, so the PMM's
+   * early mappings (see pmm_init()) are never placed in it
+
+  */
+  vmm_kernel_ranges[0].start = VMM_DIRECT_END;
+  vmm_kernel_ranges[0].size  = VMM_TASK_START - VMM_DIRECT_END;
+  vmm_kernel_ranges[1].start = VMM_RECURSIVE_END;
+  vmm_kernel_ranges[1].size  = VMM_VMA_KERNEL_END - VMM_RECURSIVE_END;
+  vmm_kernel_ranges[2].start = VMM_VMA_USER_START;
+  vmm_kernel_ranges[2].size  = VMM_VMA_USER_END - VMM_VMA_USER_START;
+
+  range_insert(&vmm_kernel_free, &vmm_kernel_ranges[0]);
+  range_insert(&vmm_kernel_free, &vmm_kernel_ranges[1]);
+  range_insert(&vmm_kernel.free, &vmm_kernel_ranges[2]);
+
   return 0;
 }
 
-int32_t vmm_sync(void *vmm) {
-  uint64_t pml4_paddr = (uint64_t)vmm, *pml4_vaddr = NULL;
-  vmm_debg("syncing PML4 @ 0x%p", pml4_paddr);
+/*
+
+ * all the PML4 entries of the shared kernel VMA are allocated once during boot
+ * (see __vmm_share_init()), and they are never freed, so all the VMMs point to
+ * the same PDPTs for the kernel VMA, this means a new kernel mapping is visible
+ * in all the VMMs, and the PML4s never need to be synced again after copying
+ * the shared entries to the new VMM's PML4
 
-  // temporarily map old PML4
-  if ((pml4_vaddr = vmm_map_paddr(pml4_paddr, 1, VMM_ATTR_SAVE)) == NULL) {
-    vmm_warn("failed to map the old PML4 @ 0x%p to sync", pml4_paddr);
+*/
+int32_t __vmm_share(struct vmm *vmm) {
+  uint64_t pml4_paddr = vmm->pml4, *pml4_vaddr = phys_to_virt(pml4_paddr);
+
+  // we access the PML4 using the direct map
+  if (!__vmm_direct_contains((uint64_t)pml4_vaddr)) {
+    vmm_warn("PML4 @ 0x%p is not in the direct map", pml4_paddr);
     return -EFAULT;
   }
 
-  // clean the user VMA contents
-  bzero(pml4_vaddr, vmm_pml4_index(VMM_VMA_USER_END) * PTE_SIZE);
-
-  // copy the current PML4's kernel VMA contents
-  memcpy(pml4_vaddr + vmm_pml4_index(VMM_VMA_KERNEL_START),
-      vmm_pml4_vaddr() + vmm_pml4_index(VMM_VMA_KERNEL_START),
-      (PTE_COUNT - vmm_pml4_index(VMM_VMA_KERNEL_START)) * PTE_SIZE);
+  // copy the shared kernel VMA entries, user VMA and the task area belong to the VMM
+  for (uint64_t i = vmm_pml4_index(VMM_VMA_KERNEL_START); i < PTE_COUNT; i++)
+    if (i != vmm_pml4_index(VMM_TASK_START))
+      pml4_vaddr[i] = vmm_pml4_vaddr()[i];
 
   // fix the recursive paging entry
   pml4_vaddr[510] = (uint64_t)pml4_paddr | PTE_FLAGS_DEFAULT;
 
-  // unmap the PML4
-  return vmm_unmap(pml4_vaddr, 1, VMM_ATTR_SAVE);
+  return 0;
+}
+
+/*
+
+ * update the map counts of num pages starting from paddr (see page_t), only
+ * the pages mapped to the VMM's own part (user VMA and the task area) are
+ * counted, shared kernel VMA maps all the physical memory (see vmm_direct_init())
+
+*/
+void __vmm_count_maps(uint64_t paddr, uint64_t num, bool map) {
+  page_t *page = NULL;
+
+  for (; num > 0; num--, paddr += PAGE_SIZE) {
+    if (NULL == (page = pmm_page(paddr)) || page->flags & PAGE_FLAG_TABLE)
+      continue;
+
+    if (map && page->maps < UINT16_MAX)
+      page->maps++;
+
+    else if (!map && page->maps > 0)
+      page->maps--;
+  }
+}
+
+// free the given page table, and all the page tables it points to
+void __vmm_free_table(uint64_t paddr, uint8_t level) {
+  uint64_t *table = phys_to_virt(paddr);
+
+  for (uint16_t i = 0; i < PTE_COUNT; i++) {
+    if (table[i] == 0)
+      continue;
+
+    // PT entries (and the large pages) point to the pages, which are owned by the memory regions
+    if (level == 1)
+      __vmm_count_maps(vmm_entry_to_addr(table[i]), 1, false);
+
+    else if (table[i] & PTE_FLAG_PS)
+      __vmm_count_maps(vmm_entry_to_addr(table[i]), VMM_LARGE_PAGE_COUNT, false);
+
+    else
+      __vmm_free_table(vmm_entry_to_addr(table[i]), level - 1);
+  }
+
+  pmm_free(paddr, 1);
 }
 
 void *vmm_new() {
-  uint64_t pml4_paddr = 0;
+  struct vmm *vmm  = NULL;
+  range_t    *user = NULL;
 
-  // allocate a new PML4
-  if ((pml4_paddr = pmm_alloc(1, 0)) == 0) {
-    vmm_warn("failed to allocate a new PML4");
+  if (NULL == (vmm = slab_alloc(&vmm_cache))) {
+    vmm_warn("failed to allocate a new VMM");
     return NULL;
   }
 
-  // sync the kernel VMA with the current one
-  if (vmm_sync((void *)pml4_paddr) != 0) {
-    vmm_warn("failed to sync new PML4 @ 0x%p", pml4_paddr);
-    pmm_free(pml4_paddr, 1);
-    return NULL;
+  bzero(vmm, sizeof(struct vmm));
+
+  // whole user VMA is free
+  if (NULL == (user = slab_alloc(&vmm_range_cache))) {
+    vmm_warn("failed to allocate the user VMA range for a new VMM");
+    goto fail;
   }
 
-  return (void *)pml4_paddr;
-}
+  user->start = VMM_VMA_USER_START;
+  user->size  = VMM_VMA_USER_END - VMM_VMA_USER_START;
+  range_insert(&vmm->free, user);
 
-void *vmm_get() {
-  void *vmm;
+  // allocate a new PML4 (new VMM has no mappings in the user VMA or in the task area)
+  if ((vmm->pml4 = pmm_alloc_zeroed()) == 0) {
+    vmm_warn("failed to allocate a new PML4");
+    goto fail;
+  }
+
+  // give the new VMM a PCID
+  if (vmm_pcid)
+    __vmm_pcid_alloc(vmm);
 
-  __asm__("mov %%cr3, %%rax\n"
-          "mov %%rax, %0\n" ::"m"(vmm)
-      : "%rax");
+  // share the kernel VMA with the new VMM
+  if (__vmm_share(vmm) != 0) {
+    vmm_warn("failed to share the kernel VMA with new PML4 @ 0x%p", vmm->pml4);
+    goto fail;
+  }
 
   return vmm;
+
+fail:
+  vmm_free(vmm);
+  return NULL;
+}
+
+void vmm_free(void *_vmm) {
+  struct vmm *vmm  = _vmm;
+  uint64_t   *pml4 = NULL;
+
+  // we cannot free the VMM created by the bootloader
+  if (NULL == vmm || &vmm_kernel == vmm)
+    return;
+
+  // free the page tables of the user VMA and the task area, and the PML4 itself
+  if (0 != vmm->pml4) {
+    pml4 = phys_to_virt(vmm->pml4);
+
+    for (uint16_t i = 0; i < PTE_COUNT; i++)
+      if (pml4[i] != 0 && (i < vmm_pml4_index(VMM_VMA_KERNEL_START) || i == vmm_pml4_index(VMM_TASK_START)))
+        __vmm_free_table(vmm_entry_to_addr(pml4[i]), 3);
+
+    pmm_free(vmm->pml4, 1);
+  }
+
+  __vmm_range_clear(vmm->free);
+  slab_free(vmm);
+}
+
+void *vmm_get() {
+  return vmm_current;
 }
 
-int32_t vmm_switch(void *vmm) {
+int32_t vmm_switch(void *_vmm) {
+  struct vmm *vmm = _vmm;
+  uint64_t    cr3 = 0;
+
   if (NULL == vmm)
     return -EINVAL;
 
-  vmm_debg("switching to the PML4 @ 0x%p", vmm);
+  vmm_debg("switching to the PML4 @ 0x%p", vmm->pml4);
+  cr3 = vmm->pml4;
+
+  /*
+
+   * if PCIDs are enabled, the VMM's TLB entries are kept, unless it's a new
+   * PCID, VMMs from older PCID generations get a new PCID first
+
+  */
+  if (vmm_pcid) {
+    if (&vmm_kernel != vmm && vmm_pcid_gen != vmm->gen)
+      __vmm_pcid_alloc(vmm);
+
+    cr3 |= vmm->pcid | (vmm->flush ? 0 : VMM_CR3_NO_FLUSH);
+    vmm->flush = false;
+  }
 
-  __asm__("mov %0, %%rax\n"
-          "mov %%rax, %%cr3\n" ::"m"(vmm)
-      : "%rax");
+  __asm__("mov %0, %%cr3\n" ::"r"(cr3) : "memory");
+  vmm_current = vmm;
 
   return 0;
 }
@@ -208,20 +855,28 @@ int32_t vmm_switch(void *vmm) {
 int32_t vmm_set(void *vaddr, uint64_t num, uint64_t flags) {
   uint64_t *entry = NULL;
 
-  if (NULL == (entry = __vmm_entry_from_vaddr((uint64_t)vaddr)))
-    return -EFAULT;
+  for (; num > 0; num--, vaddr += PAGE_SIZE) {
+    if (NULL == (entry = __vmm_entry_from_vaddr((uint64_t)vaddr)))
+      return -EFAULT;
+
+    *entry |= flags;
+    vmm_invlpg(vaddr);
+  }
 
-  *entry |= flags;
   return 0;
 }
 
 int32_t vmm_clear(void *vaddr, uint64_t num, uint64_t flags) {
   uint64_t *entry = NULL;
 
-  if (NULL == (entry = __vmm_entry_from_vaddr((uint64_t)vaddr)))
-    return -EFAULT;
+  for (; num > 0; num--, vaddr += PAGE_SIZE) {
+    if (NULL == (entry = __vmm_entry_from_vaddr((uint64_t)vaddr)))
+      return -EFAULT;
+
+    *entry &= ~(flags);
+    vmm_invlpg(vaddr);
+  }
 
-  *entry &= ~(flags);
   return 0;
 }
 
@@ -234,6 +889,10 @@ uint8_t vmm_vma(void *vaddr) {
 uint64_t vmm_resolve(void *vaddr) {
   uint64_t *entry = NULL;
 
+  // no need to walk the tables for the direct mapped pages
+  if (__vmm_direct_contains((uint64_t)vaddr))
+    return (uint64_t)vaddr - VMM_DIRECT_START;
+
   if (NULL == (entry = __vmm_entry_from_vaddr((uint64_t)vaddr)))
     return 0;
 
@@ -243,94 +902,217 @@ uint64_t vmm_resolve(void *vaddr) {
   return vmm_entry_to_addr(*entry) | ((uint64_t)vaddr & 0xfff);
 }
 
-int32_t vmm_unmap(void *_vaddr, uint64_t num, uint32_t attr) {
-  uint64_t vaddr = (uint64_t)_vaddr, *entry = NULL;
-  int32_t  err = 0;
+void *__vmm_map_to_paddr_internal(uint64_t paddr, uint64_t vaddr, uint64_t num, uint32_t attr);
+
+/*
+
+ * split the 2 MiB page that contains vaddr into 4 KiB pages, the new PT is
+ * filled before it replaces the 2 MiB page, so the memory stays accessible
+ * during the split
+
+*/
+int32_t __vmm_split(uint64_t vaddr) {
+  uint64_t *entry = &vmm_pd_entry(vaddr), large = *entry, pt_paddr = 0, *pt_vaddr = NULL, flags = 0;
+
+  if (!(large & PTE_FLAG_PS))
+    return 0;
+
+  if ((pt_paddr = pmm_alloc(1, 0)) == 0) {
+    vmm_warn("failed to allocate a new PT to split 0x%p", vaddr);
+    return -ENOMEM;
+  }
+
+  // access the new PT using the direct map, or temporarily map it if the direct map is not ready
+  if (__vmm_direct_contains((uint64_t)phys_to_virt(pt_paddr)))
+    pt_vaddr = phys_to_virt(pt_paddr);
+
+  else if ((pt_vaddr = vmm_map_paddr(pt_paddr, 1, VMM_ATTR_SAVE)) == NULL) {
+    vmm_warn("failed to map the new PT @ 0x%p to split 0x%p", pt_paddr, vaddr);
+    pmm_free(pt_paddr, 1);
+    return -EFAULT;
+  }
+
+  // 4 KiB pages use the same flags as the 2 MiB page
+  flags = vmm_entry_to_flags(large) & ~PTE_FLAG_PS;
+
+  for (uint16_t i = 0; i < PTE_COUNT; i++)
+    pt_vaddr[i] = (vmm_entry_to_addr(large) + i * PAGE_SIZE) | flags;
+
+  // all the entries of the new PT are used
+  pmm_table(pt_paddr, PTE_COUNT);
+
+  if (!__vmm_direct_contains((uint64_t)pt_vaddr))
+    vmm_unmap(pt_vaddr, 1, VMM_ATTR_SAVE);
+
+  // replace the 2 MiB page with the PT
+  *entry = pt_paddr | PTE_FLAGS_DEFAULT | (large & PTE_FLAG_US);
+  vmm_invlpg(vmm_pt_vaddr(vaddr));
+  vmm_invlpg(vaddr);
+
+  vmm_debg("split the 2 MiB page @ 0x%p", vaddr & ~(VMM_LARGE_PAGE_SIZE - 1));
+  return 0;
+}
+
+/*
+
+ * unmapping a large range page by page would flood the TLB with invlpg
+ * instructions, so after VMM_INVLPG_MAX pages we stop invalidating pages one
+ * by one, and flush the whole TLB once, after the entire range is unmapped
+
+*/
+#define VMM_INVLPG_MAX (32)
+
+int32_t __vmm_unmap_internal(uint64_t vaddr, uint64_t num, uint32_t attr) {
+  bool      batch = num > VMM_INVLPG_MAX, shared = __vmm_is_shared(vaddr), freed = false;
+  uint64_t *entry = NULL, step = 1;
+  int32_t   err   = 0;
 
   vmm_debg("unmapping %u pages from 0x%p", num, vaddr);
 
-  for (; num > 0; num--, vaddr += PAGE_SIZE) {
+  for (; num > 0; num -= step, vaddr += step * PAGE_SIZE) {
     if (NULL == (entry = __vmm_entry_from_vaddr(vaddr))) {
       vmm_warn("attempt to unmap an already unmapped page (0x%p)", vaddr);
-      return -EFAULT;
+      err = -EFAULT;
+      break;
     }
 
-    if (*entry & PTE_FLAG_PMM && !(attr & VMM_ATTR_SAVE) && (err = pmm_free(vmm_entry_to_addr(*entry), 1)) != 0) {
-      vmm_warn("failed to free the physical page @ 0x%p", vmm_entry_to_addr(*entry));
-      return err;
-    }
+    step = 1;
 
-    // unmap the page from PT
-    *entry = 0;
-    vmm_invlpg(vaddr);
+    /*
 
-    // free & unmap the PT if it's empty
-    if (__vmm_is_table_free(vmm_pt_vaddr(vaddr))) {
-      if ((err = pmm_free(vmm_pt_paddr(vaddr), 1)) != 0)
-        vmm_warn("failed to free PT @ 0x%p: %s", vmm_pt_paddr(vaddr), strerror(err));
-      *(&vmm_pd_entry(vaddr)) = 0;
-    }
+     * unmap the whole 2 MiB page at once if the range covers it, otherwise
+     * split it so we can unmap the 4 KiB pages we want
+
+    */
+    if (*entry & PTE_FLAG_PS) {
+      if (__vmm_is_large_aligned(vaddr) && num >= VMM_LARGE_PAGE_COUNT)
+        step = VMM_LARGE_PAGE_COUNT;
 
-    // free & unmap the PD if it's empty
-    if (__vmm_is_table_free(vmm_pd_vaddr(vaddr))) {
-      if ((err = pmm_free(vmm_pd_paddr(vaddr), 1)) != 0)
-        vmm_warn("failed to free PD @ 0x%p: %s", vmm_pd_paddr(vaddr), strerror(err));
-      *(&vmm_pdpt_entry(vaddr)) = 0;
+      else if ((err = __vmm_split(vaddr)) != 0)
+        break;
+
+      else
+        entry = __vmm_entry_from_vaddr(vaddr);
     }
 
-    // free & unmap the PDPT if it's empty
-    if (__vmm_is_table_free(vmm_pdpt_vaddr(vaddr))) {
-      if ((err = pmm_free(vmm_pdpt_paddr(vaddr), 1)) != 0)
-        vmm_warn("failed to free PDPT @ 0x%p: %s", vmm_pdpt_paddr(vaddr), strerror(err));
-      *(&vmm_pml4_entry(vaddr)) = 0;
+    if (!shared)
+      __vmm_count_maps(vmm_entry_to_addr(*entry), step, false);
 
-      // we modified PML4, other tasks should sync before switching
-      __vmm_alert_tasks();
+    if (*entry & PTE_FLAG_PMM && !(attr & VMM_ATTR_SAVE) && (err = pmm_free(vmm_entry_to_addr(*entry), step)) != 0) {
+      vmm_warn("failed to free the physical page @ 0x%p", vmm_entry_to_addr(*entry));
+      break;
     }
+
+    // unmap the page from PT (or PD)
+    *entry = 0;
+
+    if (!batch)
+      vmm_invlpg(vaddr);
+
+    // free & unmap the PT (or PD) and the upper level tables if they are empty
+    freed |= __vmm_table_release(vaddr, step == 1 ? 1 : 2, !batch);
   }
 
-  return 0;
+  /*
+
+   * invlpg only invalidates the pages (and the cached page tables) of the
+   * current PCID (unless the page is global), so if we unmapped shared pages
+   * without invlpg, or freed a shared page table, other PCIDs may still have
+   * them cached, otherwise reloading CR3 is enough for a batched unmap
+
+  */
+  if (shared && (batch || (freed && vmm_pcid)))
+    __vmm_flush_all();
+
+  else if (batch)
+    __vmm_flush_current();
+
+  return err;
+}
+
+int32_t vmm_unmap(void *vaddr, uint64_t num, uint32_t attr) {
+  int32_t err = 0;
+
+  if ((err = __vmm_unmap_internal((uint64_t)vaddr, num, attr)) != 0)
+    return err;
+
+  // virtual addresses of the pages can be used again
+  return __vmm_release((uint64_t)vaddr, num);
 }
 
 void *__vmm_map_to_paddr_internal(uint64_t paddr, uint64_t vaddr, uint64_t num, uint32_t attr) {
-  uint64_t *entry = NULL, start = vaddr, flags = __vmm_attr_to_flags(attr, true);
+  uint64_t *entry = NULL, start = vaddr, flags = __vmm_attr_to_flags(attr, true), step = 1;
   bool      invalidate = false;
   int32_t   err        = 0;
 
   vmm_debg("mapping %u pages from 0x%p to 0x%p", num, paddr, vaddr);
 
-  for (; num > 0; num--, vaddr += PAGE_SIZE, paddr += PAGE_SIZE) {
+  for (; num > 0; num -= step, vaddr += step * PAGE_SIZE, paddr += step * PAGE_SIZE) {
     // get (or create if not exists) PDPT
     if (*(entry = &vmm_pml4_entry(vaddr)) == 0) {
-      vmm_debg("allocated a new PDPT @ 0x%p for mapping 0x%p", *entry = pmm_alloc(1, 0), vaddr);
-      *entry |= flags;
-      __vmm_alert_tasks();
-      bzero(vmm_pdpt_vaddr(vaddr), PAGE_SIZE);
+      if (__vmm_table_alloc(entry, flags, vmm_pdpt_vaddr(vaddr)) == 0)
+        goto fail;
+
+      vmm_debg("allocated a new PDPT @ 0x%p for mapping 0x%p", vmm_pdpt_paddr(vaddr), vaddr);
     }
 
-    // update the flags of the entry
-    else {
-      if (vmm_entry_to_flags(*entry) != flags)
-        __vmm_alert_tasks(); // we modified PML4, other tasks should sync
+    // update the flags of the entry (shared entries are copied to all the VMMs, so they are left untouched)
+    else if (!__vmm_is_shared(vaddr))
       *entry |= flags;
-    }
 
     // get (or create if not exists) PD
     if (*(entry = &vmm_pdpt_entry(vaddr)) == 0) {
-      vmm_debg("allocated a new PD @ 0x%p for mapping 0x%p", *entry = pmm_alloc(1, 0), vaddr);
-      *entry |= flags;
-      bzero(vmm_pd_vaddr(vaddr), PAGE_SIZE);
+      if (__vmm_table_alloc(entry, flags, vmm_pd_vaddr(vaddr)) == 0)
+        goto fail;
+
+      vmm_debg("allocated a new PD @ 0x%p for mapping 0x%p", vmm_pd_paddr(vaddr), vaddr);
+      __vmm_table_get(vmm_pdpt_paddr(vaddr));
     }
 
     // update the flags of the entry
     else
       *entry |= flags;
 
+    entry = &vmm_pd_entry(vaddr);
+
+    /*
+
+     * use a 2 MiB page if both addresses are aligned, and if we are mapping
+     * enough pages, unless there's already a PT for this area
+
+    */
+    if (__vmm_large_fits(paddr, vaddr, num) && (*entry == 0 || *entry & PTE_FLAG_PS)) {
+      if (!(invalidate = *entry != 0))
+        __vmm_table_get(vmm_pd_paddr(vaddr));
+
+      else if (!__vmm_is_shared(vaddr))
+        __vmm_count_maps(vmm_entry_to_addr(*entry), VMM_LARGE_PAGE_COUNT, false);
+
+      if (!__vmm_is_shared(vaddr))
+        __vmm_count_maps(paddr, VMM_LARGE_PAGE_COUNT, true);
+
+      *entry     = paddr | __vmm_attr_to_flags(attr, false) | __vmm_global(vaddr) | PTE_FLAG_PS;
+      step       = VMM_LARGE_PAGE_COUNT;
+
+      if (invalidate)
+        vmm_invlpg(vaddr);
+
+      continue;
+    }
+
+    step = 1;
+
+    // we are mapping a single page in a 2 MiB page, so split it
+    if (*entry & PTE_FLAG_PS && __vmm_split(vaddr) != 0)
+      goto fail;
+
     // get (or create if not exists) PT
-    if (*(entry = &vmm_pd_entry(vaddr)) == 0) {
-      vmm_debg("allocated a new PT @ 0x%p for mapping 0x%p", *entry = pmm_alloc(1, 0), vaddr);
-      *entry |= flags;
-      bzero(vmm_pt_vaddr(vaddr), PAGE_SIZE);
+    if (*entry == 0) {
+      if (__vmm_table_alloc(entry, flags, vmm_pt_vaddr(vaddr)) == 0)
+        goto fail;
+
+      vmm_debg("allocated a new PT @ 0x%p for mapping 0x%p", vmm_pt_paddr(vaddr), vaddr);
+      __vmm_table_get(vmm_pd_paddr(vaddr));
     }
 
     // update the flags of the entry
@@ -341,8 +1123,17 @@ void *__vmm_map_to_paddr_internal(uint64_t paddr, uint64_t vaddr, uint64_t num,
     entry      = &vmm_pt_entry(vaddr);
     invalidate = *entry != 0;
 
+    if (!invalidate)
+      __vmm_table_get(vmm_pt_paddr(vaddr));
+
+    else if (!__vmm_is_shared(vaddr))
+      __vmm_count_maps(vmm_entry_to_addr(*entry), 1, false);
+
+    if (!__vmm_is_shared(vaddr))
+      __vmm_count_maps(paddr, 1, true);
+
     // add the entry with the flags
-    *entry = paddr | __vmm_attr_to_flags(attr, false);
+    *entry = paddr | __vmm_attr_to_flags(attr, false) | __vmm_global(vaddr);
 
     // invalidate TLB cache for the page if vaddr was already mapped
     if (invalidate)
@@ -350,88 +1141,205 @@ void *__vmm_map_to_paddr_internal(uint64_t paddr, uint64_t vaddr, uint64_t num,
   }
 
   return (void *)start;
+
+fail:
+  // unmap the pages we have mapped so far, physical pages belong to the caller so they are not freed
+  if (vaddr > start)
+    __vmm_unmap_internal(start, (vaddr - start) / PAGE_SIZE, VMM_ATTR_SAVE);
+
+  return NULL;
 }
 
+#define VMM_MAP_BATCH (64) // max page count allocated at once for non-contiguous mappings
+
 void *__vmm_map_to_vaddr_internal(uint64_t vaddr, uint64_t num, uint64_t align, uint32_t attr) {
-  uint64_t paddr = NULL;
+  uint64_t pages[VMM_MAP_BATCH], paddr = NULL, pos = vaddr, cur = 0, i = 0, *entry = NULL;
 
-  if (NULL == (paddr = pmm_alloc(num, align))) {
-    vmm_debg("failed to allocate %u physical pages", num);
-    return NULL;
+  // physically contiguous (or aligned) memory is only needed by some callers (such as DMA)
+  if (attr & VMM_ATTR_CONTIG || align != 0) {
+    if (NULL == (paddr = pmm_alloc(num, align))) {
+      vmm_debg("failed to allocate %u physical pages", num);
+      return NULL;
+    }
+
+    if (NULL == __vmm_map_to_paddr_internal(paddr, vaddr, num, attr)) {
+      pmm_free(paddr, num);
+      return NULL;
+    }
+
+    return (void *)vaddr;
   }
 
-  return __vmm_map_to_paddr_internal(paddr, vaddr, num, attr);
-}
+  /*
 
-uint64_t __vmm_find_contiguous(uint64_t num, uint64_t align, uint32_t attr) {
-  uint64_t pos = 0, start = 0, cur = 0;
+   * otherwise we only need the virtual memory to be contiguous, so allocate
+   * individual pages in batches and map them one by one, so large mappings
+   * don't need a large contiguous physical block, if the virtual address is
+   * 2 MiB aligned, we still try to map a 2 MiB page first
 
-  if (attr & VMM_ATTR_USER)
-    pos = VMM_VMA_USER_START;
-  else
-    pos = VMM_VMA_KERNEL_START;
-
-  for (; num > cur; pos += PAGE_SIZE) {
-    // first page, so our first allocation will be the start address
-    if (cur == 0) {
-      // make sure the start address is aligned
-      if (align != 0 && pos % align != 0)
-        continue;
+  */
+  for (; num > 0; num -= cur) {
+    // try to use a 2 MiB page first
+    if (__vmm_is_large_aligned(pos) && num >= VMM_LARGE_PAGE_COUNT &&
+        NULL != (paddr = pmm_alloc(VMM_LARGE_PAGE_COUNT, VMM_LARGE_PAGE_SIZE))) {
+      if (NULL == __vmm_map_to_paddr_internal(paddr, pos, cur = VMM_LARGE_PAGE_COUNT, attr)) {
+        pmm_free(paddr, VMM_LARGE_PAGE_COUNT);
+        goto fail;
+      }
+
+      pos += VMM_LARGE_PAGE_SIZE;
+      continue;
+    }
+
+    cur = num > VMM_MAP_BATCH ? VMM_MAP_BATCH : num;
 
-      // set the start address
-      start = pos;
+    if (pmm_alloc_pages(cur, pages) != 0) {
+      vmm_debg("failed to allocate %u physical pages", cur);
+      goto fail;
     }
 
-    /*
+    for (i = 0; i < cur; i++, pos += PAGE_SIZE) {
+      if (NULL != __vmm_map_to_paddr_internal(pages[i], pos, 1, attr))
+        continue;
 
-     * if the address is mapped allocation is no longer contiguous
-     * and we should find a new start address, so reset cur
+      // free the rest of the batch, the pages before it are freed with the mapped ones
+      for (; i < cur; i++)
+        pmm_free(pages[i], 1);
 
-    */
-    if (__vmm_entry_from_vaddr(pos) != NULL)
-      cur = 0;
-    else
-      cur++;
+      goto fail;
+    }
   }
 
-  if (cur != num) {
-    vmm_debg("not enough memory for %u contiguous pages", num);
-    return 0;
+  return (void *)vaddr;
+
+fail:
+  // free & unmap the pages we have mapped so far, 2 MiB pages are freed as a whole
+  for (; pos > vaddr; pos -= cur * PAGE_SIZE) {
+    entry = __vmm_entry_from_vaddr(pos - PAGE_SIZE);
+    cur   = NULL != entry && *entry & PTE_FLAG_PS ? VMM_LARGE_PAGE_COUNT : 1;
+
+    pmm_free(vmm_resolve((void *)(pos - cur * PAGE_SIZE)), cur);
+    __vmm_unmap_internal(pos - cur * PAGE_SIZE, cur, VMM_ATTR_SAVE);
   }
 
-  return start;
+  return NULL;
+}
+
+/*
+
+ * find free virtual addresses for num pages, if the mapping is large enough
+ * to contain a 2 MiB page, the virtual address is placed at the same offset
+ * (off) from a 2 MiB boundary as the physical address, so 2 MiB pages can be
+ * used for the mapping
+
+*/
+uint64_t __vmm_range_alloc_pages(range_t **ranges, uint64_t num, uint64_t align, uint64_t off) {
+  uint64_t size = num * PAGE_SIZE, start = 0;
+
+  off %= VMM_LARGE_PAGE_SIZE;
+
+  if (align >= VMM_LARGE_PAGE_SIZE || round_up(off, VMM_LARGE_PAGE_SIZE) + VMM_LARGE_PAGE_SIZE > off + size)
+    return __vmm_range_alloc(ranges, size, align);
+
+  if ((start = __vmm_range_alloc(ranges, size + off, VMM_LARGE_PAGE_SIZE)) == 0)
+    return __vmm_range_alloc(ranges, size, align);
+
+  // give back the addresses before the offset
+  if (off != 0)
+    __vmm_range_free(ranges, start, start + off);
+
+  return start + off;
 }
 
 void *vmm_map(uint64_t num, uint64_t align, uint32_t attr) {
-  uint64_t vaddr = 0;
+  range_t **ranges = attr & VMM_ATTR_USER ? &vmm_current->free : &vmm_kernel_free;
+  uint64_t  vaddr  = 0;
+  void     *ret    = NULL;
 
-  if ((vaddr = __vmm_find_contiguous(num, align, attr)) == 0)
+  if ((vaddr = __vmm_range_alloc_pages(ranges, num, align, 0)) == 0) {
+    vmm_debg("not enough memory for %u contiguous pages", num);
     return NULL;
+  }
+
+  if (NULL == (ret = __vmm_map_to_vaddr_internal(vaddr, num, align, attr)))
+    __vmm_range_free(ranges, vaddr, vaddr + num * PAGE_SIZE);
 
-  return __vmm_map_to_vaddr_internal(vaddr, num, align, attr);
+  return ret;
 }
 
-void *vmm_map_paddr(uint64_t paddr, uint64_t num, uint32_t attr) {
-  uint64_t vaddr = 0, pos = 0;
+void *vmm_reserve(uint64_t vaddr, uint64_t num, uint32_t attr) {
+  range_t **ranges = attr & VMM_ATTR_USER ? &vmm_current->free : &vmm_kernel_free;
+
+  // if vaddr is not specified, find free virtual addresses
+  if (vaddr == 0) {
+    if ((vaddr = __vmm_range_alloc_pages(ranges, num, 0, 0)) == 0)
+      vmm_debg("not enough memory for %u contiguous pages", num);
+    return (void *)vaddr;
+  }
 
-  if ((vaddr = __vmm_find_contiguous(num, 0, attr)) == 0)
+  if (vaddr % PAGE_SIZE != 0 || !vmm_vma_does_contain(vaddr) || __vmm_reserve(vaddr, num, attr & VMM_ATTR_REUSE) != 0) {
+    vmm_fail("cannot reserve %u pages at 0x%p", num, vaddr);
     return NULL;
+  }
+
+  return (void *)vaddr;
+}
+
+int32_t vmm_release(void *vaddr, uint64_t num) {
+  return __vmm_release((uint64_t)vaddr, num);
+}
+
+bool vmm_vma_range(uint8_t vma, void *vaddr, uint64_t num) {
+  uint64_t start = VMM_VMA_USER == vma ? VMM_VMA_USER_START : VMM_VMA_KERNEL_START;
+  uint64_t end   = VMM_VMA_USER == vma ? VMM_VMA_USER_END : VMM_VMA_KERNEL_END;
+
+  // page count is checked first, so calculating the end of the range cannot overflow
+  if ((uint64_t)vaddr < start || (uint64_t)vaddr >= end || num > (end - (uint64_t)vaddr) / PAGE_SIZE)
+    return false;
+
+  return num != 0;
+}
+
+bool vmm_is_free(void *vaddr, uint64_t num, uint8_t vma) {
+  uint64_t start = (uint64_t)vaddr, end = start + num * PAGE_SIZE;
+  range_t *node  = NULL;
+
+  // addresses should be in the given VMA, and the task area is not tracked
+  if (start % PAGE_SIZE != 0 || !vmm_vma_range(vma, vaddr, num) || !__vmm_range_clip(&start, &end))
+    return false;
+
+  if (start != (uint64_t)vaddr || end != (uint64_t)vaddr + num * PAGE_SIZE)
+    return false;
+
+  // a single free range should contain all the pages
+  node = range_floor(*__vmm_ranges(start), start);
+  return NULL != node && range_end(node) >= end;
+}
+
+void *vmm_map_paddr(uint64_t paddr, uint64_t num, uint32_t attr) {
+  range_t **ranges = attr & VMM_ATTR_USER ? &vmm_current->free : &vmm_kernel_free;
+  uint64_t  vaddr  = 0;
+  void     *ret    = NULL;
 
   if (paddr % PAGE_SIZE != 0) {
     vmm_debg("attempt to map %u pages to an invalid physical address (0x%p)", num, paddr);
     return NULL;
   }
 
-  /*for (pos = paddr; pos < paddr + num * VMM_PAGE_SIZE; pos += VMM_PAGE_SIZE) {
-    if (pmm_is_allocated(pos))
-      vmm_debg("mapping paddr 0x%p, which is not a free page", pos);
-  }*/
+  if ((vaddr = __vmm_range_alloc_pages(ranges, num, 0, paddr)) == 0) {
+    vmm_debg("not enough memory for %u contiguous pages", num);
+    return NULL;
+  }
 
-  return __vmm_map_to_paddr_internal(paddr, vaddr, num, attr);
+  if (NULL == (ret = __vmm_map_to_paddr_internal(paddr, vaddr, num, attr)))
+    __vmm_range_free(ranges, vaddr, vaddr + num * PAGE_SIZE);
+
+  return ret;
 }
 
 void *vmm_map_vaddr(uint64_t vaddr, uint64_t num, uint64_t align, uint32_t attr) {
   uint64_t vaddr_pos = vaddr, cur = 0;
+  void    *ret       = NULL;
 
   for (; num > cur; cur++, vaddr_pos += PAGE_SIZE) {
     // make sure the virutal address is in one of the VMAs
@@ -453,12 +1361,20 @@ void *vmm_map_vaddr(uint64_t vaddr, uint64_t num, uint64_t align, uint32_t attr)
     return NULL;
   }
 
-  return __vmm_map_to_vaddr_internal(vaddr, num, align, attr);
+  if (__vmm_reserve(vaddr, num, attr & VMM_ATTR_REUSE) != 0)
+    return NULL;
+
+  // if we fail, pages are free again, unless they were already mapped
+  if (NULL == (ret = __vmm_map_to_vaddr_internal(vaddr, num, align, attr)) && !(attr & VMM_ATTR_REUSE))
+    __vmm_release(vaddr, num);
+
+  return ret;
 }
 
 void *vmm_map_exact(uint64_t paddr, uint64_t vaddr, uint64_t num, uint32_t attr) {
   uint64_t  vaddr_pos = vaddr, paddr_pos = paddr, cur = 0;
   uint64_t *entry = NULL;
+  void     *ret   = NULL;
 
   for (; num > cur; cur++, vaddr_pos += PAGE_SIZE, paddr_pos += PAGE_SIZE) {
     // make sure the virtual address is valid
@@ -471,17 +1387,22 @@ void *vmm_map_exact(uint64_t paddr, uint64_t vaddr, uint64_t num, uint32_t attr)
 
     /*
 
-     * check if vaddr is already mapped to the paddr
+     * check if vaddr is already mapped to the paddr (with the same flags)
 
      * if so move to the next page, and increment vaddr,
      * and decrement num, so we don't waste time mapping
-     * it again
+     * it again (unless it's a 2 MiB page, skipping the first
+     * page would split it, so we map it again as a whole)
 
     */
-    if (cur == 0 && entry != NULL && vmm_entry_to_addr(*entry) == paddr_pos) {
+    if (cur == 0 && entry != NULL && !(*entry & PTE_FLAG_PS) && vmm_entry_to_addr(*entry) == paddr_pos &&
+        (vmm_entry_to_flags(*entry) & ~PTE_FLAG_G) == __vmm_attr_to_flags(attr, false)) {
       vaddr += PAGE_SIZE;
       paddr += PAGE_SIZE;
-      num--;
+
+      // it was the only page we wanted to map
+      if (--num == 0)
+        return (void *)(vaddr - PAGE_SIZE);
     }
 
     // if REUSE is not set, we cannot remap an already mapped vaddr
@@ -494,5 +1415,101 @@ void *vmm_map_exact(uint64_t paddr, uint64_t vaddr, uint64_t num, uint32_t attr)
     return NULL;
   }
 
-  return __vmm_map_to_paddr_internal(paddr, vaddr, num, attr);
+  if (__vmm_reserve(vaddr, num, attr & VMM_ATTR_REUSE) != 0)
+    return NULL;
+
+  // if we fail, pages are free again, unless they were already mapped
+  if (NULL == (ret = __vmm_map_to_paddr_internal(paddr, vaddr, num, attr)) && !(attr & VMM_ATTR_REUSE))
+    __vmm_release(vaddr, num);
+
+  return ret;
+}
+
+/*
+
+ * direct map
+
+ * all the available physical memory is permanently mapped to the direct map
+ * window at the start of the kernel VMA, physical address X is mapped to
+ * VMM_DIRECT_START + X, so the kernel can access any physical page (page
+ * tables, pages of other address spaces etc.) without creating a temporary
+ * mapping
+
+ * the mapping uses 2 MiB pages where possible, and since it's in the kernel
+ * VMA, it's shared by all the VMMs
+
+*/
+// allocate all the PDPTs of the shared kernel VMA (see __vmm_share())
+int32_t __vmm_share_init() {
+  uint64_t vaddr = 0;
+
+  for (uint64_t i = vmm_pml4_index(VMM_VMA_KERNEL_START); i < PTE_COUNT; i++) {
+    vaddr = vmm_indexes_to_addr(i, 0, 0, 0);
+
+    if (!__vmm_is_shared(vaddr) || vmm_pml4_vaddr()[i] != 0)
+      continue;
+
+    if (__vmm_table_alloc(&vmm_pml4_vaddr()[i], PTE_FLAGS_DEFAULT, vmm_pdpt_vaddr(vaddr)) == 0) {
+      vmm_fail("failed to allocate the shared PDPT for 0x%p", vaddr);
+      return -ENOMEM;
+    }
+  }
+
+  return 0;
+}
+
+int32_t vmm_direct_init() {
+  struct multiboot_tag_mmap *mmap = NULL;
+  multiboot_memory_map_t    *map  = NULL;
+  uint64_t                   start = 0, end = 0, attr = VMM_ATTR_SAVE | VMM_ATTR_NO_EXEC;
+  int32_t                    err   = 0;
+
+  /*
+
+   * PMM is ready, so before creating any other VMMs, complete the shared part
+   * of the PML4 (PMM may have already allocated some of the shared PDPTs)
+
+  */
+  if ((err = __vmm_share_init()) != 0)
+    return err;
+
+  if (NULL == (mmap = mb_get(MULTIBOOT_TAG_TYPE_MMAP))) {
+    vmm_fail("cannot find the mmap multiboot info tag");
+    return -EFAULT;
+  }
+
+  for (map = (void *)&mmap->entries[0]; mmap->size > (uint64_t)map - (uint64_t)&mmap->entries[0]; map++) {
+    if (MULTIBOOT_MEMORY_AVAILABLE != map->type)
+      continue;
+
+    start = round_up(map->addr, PAGE_SIZE);
+    end   = round_down(map->addr + map->len, PAGE_SIZE);
+
+    if (start >= end)
+      continue;
+
+    // memory that does not fit in the window is not direct mapped
+    if (end > VMM_DIRECT_END - VMM_DIRECT_START)
+      end = VMM_DIRECT_END - VMM_DIRECT_START;
+
+    if (start >= end) {
+      vmm_warn("mmap entry 0x%p - 0x%p does not fit in the direct map", map->addr, map->addr + map->len);
+      continue;
+    }
+
+    if (NULL == __vmm_map_to_paddr_internal(start, VMM_DIRECT_START + start, (end - start) / PAGE_SIZE, attr))
+      return -ENOMEM;
+
+    if (vmm_direct_count < VMM_DIRECT_MAX) {
+      vmm_direct_ranges[vmm_direct_count].start = VMM_DIRECT_START + start;
+      vmm_direct_ranges[vmm_direct_count].size  = end - start;
+      range_insert(&vmm_direct, &vmm_direct_ranges[vmm_direct_count++]);
+    }
+
+    if (VMM_DIRECT_START + end > vmm_direct_end)
+      vmm_direct_end = VMM_DIRECT_START + end;
+  }
+
+  vmm_debg("mapped the direct map (0x%p - 0x%p)", VMM_DIRECT_START, vmm_direct_end);
+  return 0;
 }
@@ -2,11 +2,20 @@
 #include "sched/task.h"
 
 #include "util/string.h"
+#include "util/bit.h"
+
 #include "mm/region.h"
+#include "mm/paging.h"
+#include "mm/vmm.h"
 
+#include "config.h"
 #include "errno.h"
 #include "types.h"
 
+// check if the region overlaps with the [start, end) range
+#define __task_mem_overlaps(mem, start, end)                                                                           \
+  ((mem)->vma == VMM_VMA_USER && (mem)->vaddr < (end) && (mem)->vaddr + (mem)->num * PAGE_SIZE > (start))
+
 int32_t task_mem_del(task_t *task, region_t *reg) {
   if (NULL == task || NULL == reg)
     return -EINVAL;
@@ -26,3 +35,206 @@ int32_t task_mem_del(task_t *task, region_t *reg) {
   region_free(reg);
   return 0;
 }
+
+int32_t task_mem_fault(task_t *task, void *vaddr, uint64_t error) {
+  if (NULL == task)
+    return -EINVAL;
+
+  /*
+
+   * faults caused by a non-present page can be resolved by loading the page
+   * (demand paging), and write faults caused by a present page can be resolved
+   * by copying the page (copy-on-write)
+
+  */
+  if (bit_get(error, 0) && !bit_get(error, 1))
+    return -EFAULT;
+
+  // find the user memory region that contains the address
+  region_each(&task->mem) {
+    if (cur->vma != VMM_VMA_USER)
+      continue;
+
+    // stack grows down to the address if it's right below the stack (see region_grow())
+    if (REGION_TYPE_STACK == cur->type && cur->vaddr > vaddr && region_grow(cur, vaddr) != 0)
+      continue;
+
+    if (cur->vaddr > vaddr || cur->vaddr + cur->num * PAGE_SIZE <= vaddr)
+      continue;
+
+    return region_fault(cur, vaddr, bit_get(error, 1));
+  }
+
+  return -EFAULT;
+}
+
+int32_t task_mem_heap(task_t *task) {
+  if (NULL == task)
+    return -EINVAL;
+
+  region_t *heap = region_new(REGION_TYPE_HEAP, VMM_VMA_USER, NULL, 1);
+  int32_t   err  = 0;
+
+  // old program break is not valid anymore
+  task->brk = NULL;
+
+  if (NULL == heap)
+    return -ENOMEM;
+
+  /*
+
+   * heap region always has at least one page, the program break starts at the
+   * start of the region, and it can be moved till the region's max size
+
+  */
+  if ((err = region_limit(heap, CONFIG_TASK_HEAP_MAX)) != 0 || (err = region_map(heap)) != 0) {
+    sched_debg("failed to map the heap region: %s", strerror(err));
+    region_free(heap);
+    return err;
+  }
+
+  task_mem_add(task, heap);
+  task->brk = heap->vaddr;
+
+  return 0;
+}
+
+void *task_mem_brk(task_t *task, void *brk) {
+  region_t *heap = NULL;
+
+  if (NULL == task || NULL == (heap = task_mem_find(task, REGION_TYPE_HEAP, VMM_VMA_USER)))
+    return NULL;
+
+  // program break cannot be moved outside of the heap region's reserved pages
+  if (brk < heap->vaddr || brk > heap->vaddr + heap->max * PAGE_SIZE)
+    return task->brk;
+
+  if (region_resize(heap, brk == heap->vaddr ? 1 : vmm_calc(brk - heap->vaddr)) != 0)
+    return task->brk;
+
+  return task->brk = brk;
+}
+
+/*
+
+ * split the region, so the part of the region in [start, end) is a separate
+ * region in the task's memory region list, and return that part in mem
+
+*/
+int32_t __task_mem_isolate(task_t *task, region_t **mem, void *start, void *end) {
+  region_t *tail = NULL;
+
+  if ((*mem)->vaddr >= start && (*mem)->vaddr + (*mem)->num * PAGE_SIZE <= end)
+    return 0;
+
+  // stack and heap regions cannot be split (see region_split())
+  if (REGION_TYPE_STACK == (*mem)->type || REGION_TYPE_HEAP == (*mem)->type)
+    return -EINVAL;
+
+  if ((*mem)->vaddr < start) {
+    if (NULL == (tail = region_split(*mem, (start - (*mem)->vaddr) / PAGE_SIZE)))
+      return -ENOMEM;
+
+    task_mem_add(task, tail);
+    *mem = tail;
+  }
+
+  if ((*mem)->vaddr + (*mem)->num * PAGE_SIZE > end) {
+    if (NULL == (tail = region_split(*mem, (end - (*mem)->vaddr) / PAGE_SIZE)))
+      return -ENOMEM;
+
+    task_mem_add(task, tail);
+  }
+
+  return 0;
+}
+
+int32_t task_mem_map(task_t *task, void **vaddr, uint64_t num, uint8_t prot, bool fixed) {
+  if (NULL == task || NULL == vaddr || num == 0)
+    return -EINVAL;
+
+  region_t *mem = NULL;
+  int32_t   err = 0;
+
+  // mapping should be in the user VMA, an invalid hint is ignored
+  if (!vmm_vma_range(VMM_VMA_USER, *vaddr, num)) {
+    if (fixed)
+      return -EINVAL;
+    *vaddr = NULL;
+  }
+
+  // fixed mappings replace the existing mappings
+  if (fixed && (err = task_mem_unmap(task, *vaddr, num)) != 0)
+    return err;
+
+  // the address is only a hint, unless the mapping is fixed
+  if (NULL != *vaddr && !vmm_is_free(*vaddr, num, VMM_VMA_USER)) {
+    if (fixed)
+      return -ENOMEM;
+    *vaddr = NULL;
+  }
+
+  // mapping is a demand paged data region, which is filled with zeros
+  if (NULL == (mem = region_new(REGION_TYPE_DATA, VMM_VMA_USER, *vaddr, num)))
+    return -ENOMEM;
+
+  if ((err = region_protect(mem, prot)) != 0 || (err = region_map(mem)) != 0) {
+    sched_debg("failed to map %u pages @ 0x%p: %s", num, *vaddr, strerror(err));
+    region_free(mem);
+    return err;
+  }
+
+  task_mem_add(task, mem);
+  *vaddr = mem->vaddr;
+
+  return 0;
+}
+
+// find the first user region that overlaps with the [start, end) range
+region_t *__task_mem_overlap(task_t *task, void *start, void *end) {
+  region_each(&task->mem) {
+    if (__task_mem_overlaps(cur, start, end))
+      return cur;
+  }
+
+  return NULL;
+}
+
+int32_t task_mem_unmap(task_t *task, void *vaddr, uint64_t num) {
+  if (NULL == task || (uint64_t)vaddr % PAGE_SIZE != 0)
+    return -EINVAL;
+
+  void     *end = vaddr + num * PAGE_SIZE;
+  region_t *mem = NULL;
+  int32_t   err = 0;
+
+  // removing a region modifies the list, so look for the next region from the start of the list
+  while (NULL != (mem = __task_mem_overlap(task, vaddr, end))) {
+    if ((err = __task_mem_isolate(task, &mem, vaddr, end)) != 0 || (err = task_mem_del(task, mem)) != 0)
+      return err;
+  }
+
+  return 0;
+}
+
+int32_t task_mem_protect(task_t *task, void *vaddr, uint64_t num, uint8_t prot) {
+  if (NULL == task || (uint64_t)vaddr % PAGE_SIZE != 0)
+    return -EINVAL;
+
+  void     *end = vaddr + num * PAGE_SIZE;
+  region_t *mem = NULL;
+  int32_t   err = 0;
+
+  // regions split from a region are added to the end of the list, so they are also checked
+  region_each(&task->mem) {
+    if (!__task_mem_overlaps(cur, vaddr, end) || cur->prot == prot)
+      continue;
+
+    mem = cur;
+
+    if ((err = __task_mem_isolate(task, &mem, vaddr, end)) != 0 || (err = region_protect(mem, prot)) != 0)
+      return err;
+  }
+
+  return 0;
+}
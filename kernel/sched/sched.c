@@ -6,20 +6,38 @@
 #include "util/panic.h"
 #include "util/list.h"
 #include "util/bit.h"
+#include "util/asm.h"
 
+#include "core/timer.h"
 #include "core/im.h"
 #include "core/pic.h"
 
 #include "mm/vmm.h"
 #include "mm/heap.h"
 
+#include "config.h"
 #include "errno.h"
 #include "types.h"
 
-// used to keep track of the task queue
+// used to keep track of all the tasks
 task_t *task_head = NULL, *task_tail = NULL;
-task_t *task_current  = NULL; // current running task
-task_t *task_promoted = NULL; // promoted task will always run next
+task_t *task_current = NULL; // current running task
+task_t *task_corpse  = NULL; // dead task that should be freed after the next switch
+task_t *task_idle    = NULL; // idle task, runs when the run queue is empty
+
+/*
+
+ * run queue, every priority level has it's own FIFO of tasks that are ready
+ * to run, and a bitmap keeps track of the non-empty levels, so the highest
+ * priority task is found with a single bsr, current task is not in the run
+ * queue, it's added back to the end of it's level when it's time slice ends
+
+ * dead tasks are never added back, so they never sit on the run queue
+
+*/
+task_t  *sched_runq_head[TASK_PRIO_MAX + 1];
+task_t  *sched_runq_tail[TASK_PRIO_MAX + 1];
+uint64_t sched_runq_map = 0;
 
 #define __sched_print_task(task)                                                                                       \
   do {                                                                                                                 \
@@ -29,100 +47,172 @@ task_t *task_promoted = NULL; // promoted task will always run next
     sched_debg("`- Stack: 0x%x", task->regs.rsp);                                                                      \
   } while (0)
 
-// delete a task from the task queue
-#define __sched_queue_del(task) dlist_del(&task_head, &task_tail, task, task_t)
+// add the task to the end of the run queue of it's priority level
+void __sched_runq_add(task_t *task) {
+  uint8_t prio = task->prio;
 
-// add task to scheduler queue (higher priority task is placed before lower ones)
-int32_t __sched_queue_add(task_t *task) {
-  if (NULL == task_head && NULL == task_tail) {
-    task_head = task_tail = task;
-    task->next            = NULL;
-    task->prev            = NULL;
-    return 0;
-  }
+  if (task->queued)
+    return;
 
-  dlist_reveach(&task_tail, task_t) {
-    /*
+  task->run_next = NULL;
+  task->run_prev = sched_runq_tail[prio];
 
-     * our priority should be lower or equal to the current task
-     * so we'll be able to place it after it without breaking the
-     * order in the queue
+  if (NULL == sched_runq_tail[prio])
+    sched_runq_head[prio] = task;
+  else
+    sched_runq_tail[prio]->run_next = task;
+
+  sched_runq_tail[prio] = task;
+  sched_runq_map |= 1ull << prio;
+  task->queued = 1;
+}
+
+// remove the task from the run queue of it's priority level
+void __sched_runq_del(task_t *task) {
+  uint8_t prio = task->prio;
+
+  if (!task->queued)
+    return;
+
+  if (NULL == task->run_prev)
+    sched_runq_head[prio] = task->run_next;
+  else
+    task->run_prev->run_next = task->run_next;
+
+  if (NULL == task->run_next)
+    sched_runq_tail[prio] = task->run_prev;
+  else
+    task->run_next->run_prev = task->run_prev;
+
+  if (NULL == sched_runq_head[prio])
+    sched_runq_map &= ~(1ull << prio);
+
+  task->run_next = task->run_prev = NULL;
+  task->queued                    = 0;
+}
+
+// remove and return the first task in the highest priority level
+task_t *__sched_runq_pop() {
+  task_t *task = NULL;
+
+  if (sched_runq_map == 0)
+    return NULL;
+
+  task = sched_runq_head[bit_last(sched_runq_map)];
+  __sched_runq_del(task);
+
+  return task;
+}
+
+/*
+
+ * idle task, it's not in the run queue, scheduler switches to it when the
+ * run queue is empty, and it halts the CPU until an interrupt wakes up a task
+
+ * while idle, the periodic scheduler tick is stopped, as there is nothing to
+ * switch to, and the timer is programmed for the next pending timer instead
+ * (see timer_idle_enter()), the tick starts again when a task becomes ready
+
+ * if supported, monitor/mwait is used instead of hlt, it's given the run
+ * queue bitmap as the monitored address, and it's told to treat the masked
+ * interrupts as break events, so it can be used with the interrupts disabled
+
+*/
+bool sched_idle_mwait = false; // is monitor/mwait supported
+
+// check if the CPU supports monitor/mwait, with the interrupt break event extension
+bool __sched_idle_mwait_check() {
+  uint32_t regs[4];
+
+  _cpuid(0, 0, regs);
+
+  if (regs[CPUID_EAX] < 5)
+    return false;
+
+  // CPUID.01H:ECX.MONITOR[bit 3]
+  _cpuid(1, 0, regs);
+
+  if (!bit_get(regs[CPUID_ECX], 3))
+    return false;
+
+  // CPUID.05H:ECX[bit 0] (extensions are enumerated) and ECX[bit 1] (interrupt break events)
+  _cpuid(5, 0, regs);
+  return bit_get(regs[CPUID_ECX], 0) && bit_get(regs[CPUID_ECX], 1);
+}
+
+void __sched_idle() {
+  while (true) {
+    im_disable();
+
+    // stop the tick and halt till an interrupt wakes up a task
+    if (sched_runq_map == 0) {
+      timer_idle_enter();
+
+      if (sched_idle_mwait) {
+        __asm__ volatile("monitor" ::"a"(&sched_runq_map), "c"(0), "d"(0));
+
+        if (sched_runq_map == 0)
+          __asm__ volatile("mwait" ::"a"(0), "c"(1));
+
+        __asm__ volatile("sti");
+      }
+
+      else
+        __asm__ volatile("sti\nhlt\n");
 
-    */
-    if (task->prio > cur->prio)
       continue;
+    }
 
-    // place the task after the current (cur) task
-    task->prev = cur;
-    task->next = cur->next;
-    cur->next  = task;
+    // a task is ready, start the tick and switch to it
+    timer_idle_exit();
 
-    if (NULL != task->next)
-      task->next->prev = task;
+    task_current->ticks = 0;
+    sched();
   }
+}
+
+// add a task to the run queue, so it's scheduled again
+void __sched_ready(task_t *task) {
+  __sched_runq_add(task);
 
   /*
 
    * if the task have a higher priority then the current task (task_current)
-   * we should promote the new task so we'll switch to it next time scheduler
-   * timer is called
+   * current task's time slice ends, so we'll switch to the new task next time
+   * scheduler timer is called
 
   */
-  if (task->prio > task_current->prio)
-    task_promoted = task;
+  if (NULL != task_current && task->prio > task_current->prio)
+    task_current->ticks = 0;
+}
+
+// add a new task to the task list and the run queue
+int32_t __sched_queue_add(task_t *task) {
+  task->next = task->prev = NULL;
+  dlist_add(&task_head, &task_tail, task);
 
+  __sched_ready(task);
   return 0;
 }
 
+// free the previous dead task (see TASK_STATE_DEAD)
 void __sched_queue_clean() {
-  task_t *corpse = NULL, *parent = NULL;
-
-  // look for the dead task
-  dlist_foreach(&task_head, task_t) {
-    if (cur->state == TASK_STATE_DEAD) {
-      corpse = cur;
-      break;
-    }
-  }
+  task_t *parent = NULL;
 
   // we should have switch to a new task
-  if (NULL == corpse || task_current == corpse)
+  if (NULL == task_corpse || task_current == task_corpse)
     return;
 
-  // add task to parent's wait queue
-  if (NULL != (parent = sched_find(corpse->ppid)))
-    task_waitq_add(parent, corpse);
+  // add task to parent's wait queue, and wake up the parent if it's waiting for it
+  if (NULL != (parent = sched_find(task_corpse->ppid)) && task_waitq_add(parent, task_corpse) == 0)
+    waitq_wake_all(&parent->wait);
 
   // remove from the list
-  __sched_queue_del(corpse);
+  dlist_del(&task_head, &task_tail, task_corpse, task_t);
 
   // dismember
-  task_free(corpse);
-}
-
-// get next task in the queue
-task_t *__sched_queue_next() {
-  task_t *pos = task_current;
-
-  do {
-    // promoted task will always be selected next
-    if (NULL != task_promoted) {
-      pos           = task_promoted;
-      task_promoted = NULL;
-      continue;
-    }
-
-    // if we reached the end of the queue, go back to the start
-    if (NULL == pos || NULL == pos->next) {
-      pos = task_head;
-      continue;
-    }
-
-    // get the next task using the next pointer
-    pos = pos->next;
-  } while (pos->state == TASK_STATE_DEAD);
-
-  return pos;
+  task_free(task_corpse);
+  task_corpse = NULL;
 }
 
 // find the next available PID
@@ -140,19 +230,59 @@ void __sched_pid(task_t *task) {
   task->pid++;
 }
 
+/*
+
+ * task switch benchmark, if the benchmarks are enabled, cost of every switch
+ * to a different VMM is measured (in cycles), and the average cost is reported
+ * after every SCHED_BENCH_SWITCHES switches
+
+*/
+#define SCHED_BENCH_SWITCHES (1000)
+
+uint64_t sched_bench_cycles = 0, sched_bench_switches = 0;
+
+// switch to the task's VMM
+void __sched_switch(task_t *task) {
+  uint64_t start = 0;
+
+  if (!CONFIG_BENCH || vmm_get() == task->vmm) {
+    task_switch(task);
+    return;
+  }
+
+  start = _rdtsc();
+  task_switch(task);
+  sched_bench_cycles += _rdtsc() - start;
+
+  if (++sched_bench_switches % SCHED_BENCH_SWITCHES != 0)
+    return;
+
+  sched_info("average task switch: %u cycles (%u switches)",
+      sched_bench_cycles / sched_bench_switches,
+      sched_bench_switches);
+}
+
 // scheduler timer interrupt handler
 void __sched_timer_handler(im_stack_t *stack) {
   task_t *task_new = NULL;
 
+  // scheduler is not initialized yet (see sched_init())
+  if (NULL == task_current)
+    return;
+
   /*
 
-   * if we don't have a task selected (so first time running)
-   * get the next task in the queue, which would be the first
-   * and the current task
+   * exceptions in the kernel (such as a page fault on a user buffer during a
+   * syscall) are handled on the stack the kernel was running on, if it's the
+   * kernel stack of a user task, it's at the same address in every VMM (see
+   * TASK_KERNEL_STACK_START), so switching the VMM here would switch the
+   * stack we are running on, tasks are only switched on the way back to ring 3,
+   * or when the interrupt is handled on the interrupt stack (see sched())
 
   */
-  if (NULL == task_current)
-    task_current = __sched_queue_next();
+  if ((stack->cs & 3) == 0 &&
+      (stack->vector < IM_INT_EXCEPTIONS || (stack->rsp >= VMM_TASK_START && VMM_TASK_END > stack->rsp)))
+    return;
 
   // if we received a signal, handle it
   if (!task_sigset_empty(task_current))
@@ -188,10 +318,10 @@ void __sched_timer_handler(im_stack_t *stack) {
   case TASK_STATE_WAIT:
     /*
 
-     * wait state means task is waiting on something
+     * wait state means task is blocked on a wait queue
      * so we can skip to the next task, after saving
      * the registers so we'll continue where we left
-     * of when we get to this task again
+     * of when it's woken up (see waitq_wake_one())
 
     */
     task_update_regs(task_current, stack);
@@ -208,6 +338,7 @@ void __sched_timer_handler(im_stack_t *stack) {
      * after the next task switch with __sched_queue_clean
 
     */
+    task_corpse  = task_current;
     task_current = NULL;
     break;
 
@@ -253,6 +384,10 @@ void __sched_timer_handler(im_stack_t *stack) {
     break;
   }
 
+  // only the timer tick uses up the time slice of the current task
+  if (NULL != task_current && pic_to_int(PIC_IRQ_TIMER) == stack->vector && task_current->ticks > 0)
+    task_current->ticks--;
+
   /*
 
    * if the current task has no more remaining ticks
@@ -260,8 +395,15 @@ void __sched_timer_handler(im_stack_t *stack) {
 
   */
   if (NULL == task_current || task_current->ticks <= 0) {
-    // get the new task
-    if ((task_new = __sched_queue_next()) != task_current)
+    // current task goes back to the end of it's run queue, unless it's blocked (or idle)
+    if (NULL != task_current && task_current->state != TASK_STATE_WAIT && task_current != task_idle)
+      __sched_runq_add(task_current);
+
+    // get the new task, or the idle task if there is nothing to run
+    if (NULL == (task_new = __sched_runq_pop()))
+      task_new = task_idle;
+
+    if (task_new != task_current)
       sched_debg("switching to the next task (PID: %d)", task_new->pid);
 
     // update the current task
@@ -270,7 +412,7 @@ void __sched_timer_handler(im_stack_t *stack) {
     // switch to the new task
     task_ticks_reset(task_current);
     task_update_stack(task_current, stack);
-    task_switch(task_current);
+    __sched_switch(task_current);
 
     // cleanup previous dead task
     __sched_queue_clean();
@@ -278,15 +420,6 @@ void __sched_timer_handler(im_stack_t *stack) {
 
   // reset the state of the task
   task_current->state = TASK_STATE_READY;
-
-  /*
-
-   * decrement the remaining ticks of the current task
-   * before jumping back to it again
-
-  */
-  task_current->ticks--;
-  return;
 }
 
 void __sched_exception_handler(im_stack_t *stack) {
@@ -302,9 +435,18 @@ void __sched_exception_handler(im_stack_t *stack) {
     break;
 
   case IM_INT_DOUBLE_FAULT:
-    sched_fail("#DF abort at 0x%x", stack->rip);
-    task_signal_add(current, SIGSEGV);
-    break;
+    /*
+
+     * #DF is an abort, we cannot return to the task, it's handled on it's own
+     * stack (see core/im/im.c), it's usually caused by a page fault that
+     * cannot be delivered, such as a stack overflow into a guard page, in that
+     * case CR2 contains the address the stack overflowed to
+
+    */
+    if (_get_cr2() >= VMM_TASK_START && TASK_KERNEL_STACK_START > _get_cr2())
+      panic("Kernel stack overflow (#DF abort at 0x%x, fault address: 0x%x)", stack->rip, _get_cr2());
+
+    panic("#DF abort at 0x%x (last page fault address: 0x%x)", stack->rip, _get_cr2());
 
   case IM_INT_GENERAL_PROTECTION_FAULT:
     sched_fail("#GP fault at 0x%x", stack->rip);
@@ -312,6 +454,10 @@ void __sched_exception_handler(im_stack_t *stack) {
     break;
 
   case IM_INT_PAGE_FAULT:
+    // see if the task's memory regions can handle the fault (copy-on-write)
+    if (NULL != task_current && task_mem_fault(task_current, (void *)_get_cr2(), stack->error) == 0)
+      return;
+
     sched_fail("#PF fault at 0x%x", stack->rip);
     printf("            P=%u W=%u U=%u R=%u I=%u PK=%u SS=%u SGX=%u\n",
         bit_get(stack->error, 0),
@@ -340,13 +486,14 @@ int32_t sched_init() {
   int32_t err       = 0;
 
   // clear the queue
-  task_current = task_head = task_tail = NULL;
+  task_current = task_head = task_tail = task_corpse = NULL;
 
   // mask the timer interrupt during initialization of the scheduler
   pic_mask(PIC_IRQ_TIMER);
 
-  // add the scheduler handler
+  // add the scheduler handler (for the timer tick and for sched())
   im_add_handler(pic_to_int(PIC_IRQ_TIMER), IM_HANDLER_PRIO_SECOND, __sched_timer_handler);
+  im_add_handler(SCHED_INT, IM_HANDLER_PRIO_SECOND, __sched_timer_handler);
 
   // add the exception handlers
   for (uint8_t i = 0; i < IM_INT_EXCEPTIONS; i++) {
@@ -376,8 +523,26 @@ int32_t sched_init() {
   task_main->prio  = TASK_PRIO_LOW;
   task_main->ppid  = 0;
 
-  // add new task to the task list
+  // add new task to the task list, and make it the current task, as it's running right now
   __sched_queue_add(task_main);
+  task_current = task_main;
+
+  // create the idle task, it's only added to the task list, not to the run queue
+  if ((task_idle = task_kernel(__sched_idle)) == NULL) {
+    sched_fail("failed to create the idle task");
+    return -ENOMEM;
+  }
+
+  __sched_pid(task_idle);
+  task_rename(task_idle, "idle");
+  task_idle->state = TASK_STATE_READY;
+  task_idle->prio  = TASK_PRIO_IDLE;
+  task_idle->ppid  = 0;
+
+  dlist_add(&task_head, &task_tail, task_idle);
+
+  if ((sched_idle_mwait = __sched_idle_mwait_check()))
+    sched_info("using monitor/mwait for the idle task");
 
   // unmask the timer interrupt for the scheduler
   if (!pic_unmask(PIC_IRQ_TIMER)) {
@@ -390,6 +555,33 @@ int32_t sched_init() {
   return 0;
 }
 
+int32_t sched_kernel(const char *name, void (*entry)(), uint8_t prio) {
+  task_t *task = NULL;
+
+  if (NULL == name || NULL == entry || prio > TASK_PRIO_MAX)
+    return -EINVAL;
+
+  if (NULL == (task = task_kernel(entry))) {
+    sched_fail("failed to create the %s kernel task", name);
+    return -ENOMEM;
+  }
+
+  // hold the scheduler while modifying the task queue
+  sched_hold();
+
+  __sched_pid(task);
+  task_rename(task, name);
+  task->state = TASK_STATE_READY;
+  task->prio  = prio;
+  task->ppid  = 0;
+
+  __sched_queue_add(task);
+  sched_state(TASK_STATE_READY);
+
+  sched_debg("created the %s kernel task (PID %d)", name, task->pid);
+  return 0;
+}
+
 task_t *sched_find(pid_t pid) {
   slist_foreach(&task_head, task_t) if (cur->pid == pid) return cur;
   return NULL;
@@ -432,7 +624,7 @@ int32_t sched_exit(int32_t exit_code) {
 
 /*
 
- * this is different from __sched_queue_next(), this function
+ * this is different from __sched_runq_pop(), this function
  * is used to loop through all the tasks, so we don't really care
  * about their order
 
@@ -464,3 +656,53 @@ task_t *sched_child(task_t *task, task_t *child) {
   // return the found child
   return child;
 }
+
+void __waitq_sleep(waitq_t *wq) {
+  // we can't block, caller will just check the condition again
+  if (!sched_sleepable()) {
+    __asm__("pause");
+    return;
+  }
+
+  // add the current task to the end of the wait queue
+  task_current->run_next = NULL;
+  task_current->run_prev = wq->tail;
+
+  if (NULL == wq->tail)
+    wq->head = task_current;
+  else
+    wq->tail->run_next = task_current;
+
+  wq->tail = task_current;
+
+  // block until we are woken up
+  sched_state(TASK_STATE_WAIT);
+  sched();
+}
+
+task_t *waitq_wake_one(waitq_t *wq) {
+  task_t  *task  = NULL;
+  uint64_t flags = 0;
+
+  im_save(flags);
+
+  // remove the first task from the wait queue
+  if (NULL != (task = wq->head)) {
+    if (NULL == (wq->head = task->run_next))
+      wq->tail = NULL;
+    else
+      wq->head->run_prev = NULL;
+
+    // put it back to the run queue
+    task->run_next = task->run_prev = NULL;
+    __sched_ready(task);
+  }
+
+  im_restore(flags);
+  return task;
+}
+
+void waitq_wake_all(waitq_t *wq) {
+  while (NULL != waitq_wake_one(wq))
+    ;
+}
@@ -1,7 +1,7 @@
 #include "sched/sched.h"
 #include "sched/task.h"
 
-#include "mm/heap.h"
+#include "mm/slab.h"
 
 #include "util/panic.h"
 #include "util/list.h"
@@ -11,12 +11,15 @@
 #include "types.h"
 
 #define SIG_EXIT_CODE              128
-#define __sigset_free(ss)          heap_free(ss)
+#define __sigset_free(ss)          slab_free(ss)
 #define __signal_can_ignore(sig)   (sig != SIGKILL)
 #define __signal_call_default(sig) sigdfl[sig - 1](sig)
 
 task_sighand_t sigdfl[SIG_MAX];
 
+// object cache for the signal queue entries
+slab_cache_t task_sigset_cache = slab_cache("task_sigset", sizeof(task_sigset_t));
+
 void __sighand_term(int32_t sig) {
   task_current->term_code = sig;
   sched_exit(SIG_EXIT_CODE + sig);
@@ -34,17 +37,18 @@ int32_t task_signal_setup() {
   sigdfl[SIGILL - 1]  = __sighand_dump;
   sigdfl[SIGKILL - 1] = __sighand_term;
   sigdfl[SIGSEGV - 1] = __sighand_dump;
+  sigdfl[SIGALRM - 1] = __sighand_term;
   return 0;
 }
 
 int32_t task_signal_set(task_t *task, int32_t sig, task_sighand_t hand) {
-  if (NULL == task || sig > SIG_MAX || sig < 0)
+  if (NULL == task || sig > SIG_MAX || sig < SIG_MIN)
     return -EINVAL;
 
   if (SIG_IGN == hand && !__signal_can_ignore(sig))
     return 0;
 
-  task->sighand[sig] = hand;
+  task->sighand[sig - 1] = hand;
   return 0;
 }
 
@@ -53,7 +57,11 @@ int32_t task_signal_add(task_t *task, int32_t sig) {
     return -EINVAL;
 
   // allocate & setup the signal
-  task_sigset_t *signal = heap_alloc(sizeof(task_sigset_t));
+  task_sigset_t *signal = slab_alloc(&task_sigset_cache);
+
+  if (NULL == signal)
+    return -ENOMEM;
+
   bzero(signal, sizeof(task_sigset_t));
   signal->value = sig;
 
@@ -81,7 +89,7 @@ int32_t task_signal_pop(task_t *task) {
   if (signal > SIG_MAX || signal < SIG_MIN)
     return -EINVAL;
 
-  handler = (uint64_t)task->sighand[signal];
+  handler = (uint64_t)task->sighand[signal - 1];
 
   switch (handler) {
   case (uint64_t)SIG_DFL:
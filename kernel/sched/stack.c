@@ -3,9 +3,11 @@
 
 #include "mm/region.h"
 #include "mm/paging.h"
+#include "mm/arena.h"
 #include "mm/vmm.h"
 
 #include "util/string.h"
+#include "util/math.h"
 #include "util/mem.h"
 
 #include "config.h"
@@ -21,11 +23,28 @@ int32_t task_stack_alloc(task_t *task) {
    * this function allocates both of these stacks and adds them to the memory
    * region list of the task
 
+   * kernel stack is placed in the task area, so every task (VMM) has it's
+   * own kernel stack at the same address, which lets the forked tasks to
+   * continue running on their copy of the parent's kernel stack, it has a
+   * fixed size, and the first page of the task area is left as it's guard page
+
+   * user stack starts small, and grows down on page faults till it reaches
+   * the max stack size (see region_grow())
+
   */
-  region_t *kernel_stack = region_new(REGION_TYPE_STACK, VMM_VMA_KERNEL, NULL, CONFIG_TASK_STACK_PAGES);
+  region_t *kernel_stack =
+      region_new(REGION_TYPE_STACK, VMM_VMA_KERNEL, (void *)TASK_KERNEL_STACK_START, CONFIG_TASK_STACK_PAGES);
   region_t *user_stack   = region_new(REGION_TYPE_STACK, VMM_VMA_USER, NULL, CONFIG_TASK_STACK_PAGES);
   int32_t   err          = 0;
 
+  if (NULL == kernel_stack || NULL == user_stack)
+    return -ENOMEM;
+
+  if ((err = region_limit(user_stack, CONFIG_TASK_STACK_MAX)) != 0) {
+    sched_fail("failed to set the user stack limit for 0x%p: %s", task, strerror(err));
+    return err;
+  }
+
   if ((err = region_map(kernel_stack)) != 0) {
     sched_fail("failed to map kernel stack region for 0x%p: %s", task, strerror(err));
     return err;
@@ -53,53 +72,92 @@ uint64_t task_stack_add(task_t *task, void *val, uint64_t size) {
   return size;
 }
 
-int32_t task_stack_add_list(task_t *task, char *list[], uint64_t limit, void **stack) {
+// count the elements of a list, and the total size of the elements
+int32_t __task_stack_measure(char *list[], uint64_t limit, uint64_t *count, uint64_t *size) {
+  for (*count = *size = 0; NULL != list && list[*count] != NULL; (*count)++) {
+    // each element is at least one byte
+    if (*count >= limit || (*size += strlen(list[*count]) + 1) > limit)
+      return -E2BIG;
+  }
+
+  return 0;
+}
+
+// copy the elements of the list to the image, pointers are set to the addresses the elements will have on the stack
+char *__task_stack_copy(char *list[], uint64_t count, char **ptrs, char *str, uint64_t offset) {
+  uint64_t len = 0;
+
+  for (uint64_t i = 0; i < count; i++, str += len) {
+    len     = strlen(list[i]) + 1;
+    ptrs[i] = str + offset;
+    memcpy(str, list[i], len);
+  }
+
+  // end pointer list with a NULL pointer
+  ptrs[count] = NULL;
+  return str;
+}
+
+int64_t task_stack_args(task_t *task, char *argv[], char *envp[], arena_t *arena, void **image) {
   /*
 
-   * this function is used to copy the argv and envp to the
-   * new process' stack, and here is the layout we use:
+   * this function builds the argv and envp for the task's user stack in the
+   * arena, so the lists can be copied to the stack with a single copy after
+   * the memory they are copied from is gone, here is the layout we use:
 
    * --- higher address ---
-   * NULL
-   * arg/env 4 pointer
-   * arg/env 3 pointer ----.
-   * arg/env 2 pointer     |
-   * arg/env 1 pointer <-. |
-   * arg/env 4 value     | |
-   * arg/env 3 value <---|-'
-   * arg/env 2 value     |
-   * arg/env 1 value     |
-   * ...............     |
-   * argv/envp pointer --'
+   * env 2 value
+   * env 1 value
+   * arg 2 value
+   * arg 1 value <-------.
+   * NULL                |
+   * env 2 pointer       |
+   * env 1 pointer <---. |
+   * NULL              | |
+   * arg 2 pointer     | |
+   * arg 1 pointer ----|-'
+   * envp pointer -----'
+   * argv pointer <- stack pointer
+
+   * both lists are measured first, so the arena is allocated once with the
+   * exact size of the image (which is aligned to 16 bytes)
 
   */
-  uint64_t len = 0, total = 0, i = 0;
-  char   **cur = NULL;
+  uint64_t argc = 0, argv_size = 0, envc = 0, envp_size = 0, size = 0, offset = 0;
+  void    *top = task_stack_get(task, VMM_VMA_USER);
+  char   **ptrs = NULL, *str = NULL;
+  int32_t  err  = 0;
 
-  // create space for the pointer list
-  for (i = 0; NULL != list && list[i] != NULL; i++) {
-    if (i > limit) // each element is at least one byte
-      return -E2BIG;
-    task->regs.rsp -= sizeof(char *);
-  }
+  if (NULL == top)
+    return -EFAULT;
 
-  task->regs.rsp -= sizeof(char *); // one more for NULL
-  cur = *stack = (void *)task->regs.rsp;
+  if ((err = __task_stack_measure(argv, ARG_MAX, &argc, &argv_size)) != 0 ||
+      (err = __task_stack_measure(envp, ENV_MAX, &envc, &envp_size)) != 0)
+    return err;
 
-  // copy all the elements
-  for (i = 0; NULL != list && list[i] != NULL; i++) {
-    if ((total += len = strlen(list[i]) + 1) > limit)
-      return -E2BIG;
+  size = round_up((argc + envc + 4) * sizeof(char *) + argv_size + envp_size, 16);
 
-    task_stack_add(task, list[i], len);
+  if ((err = arena_init(arena, size)) != 0)
+    return err;
 
-    *cur = (void *)task->regs.rsp;
-    cur++;
-  }
+  if (NULL == (*image = arena_alloc(arena, size)))
+    return -ENOMEM;
 
-  // end pointer list with a NULL pointer
-  *cur = NULL;
-  return 0;
+  // don't leak the old contents of the arena pages (alignment padding)
+  bzero(*image, size);
+
+  // difference between the address of the image and the address it will have on the stack
+  offset = (uint64_t)(top - size) - (uint64_t)*image;
+  ptrs   = *image;
+  str    = (void *)&ptrs[argc + envc + 4];
+
+  ptrs[0] = (void *)&ptrs[2] + offset;
+  ptrs[1] = (void *)&ptrs[argc + 3] + offset;
+
+  str = __task_stack_copy(argv, argc, &ptrs[2], str, offset);
+  __task_stack_copy(envp, envc, &ptrs[argc + 3], str, offset);
+
+  return size;
 }
 
 void *task_stack_get(task_t *task, uint8_t vma) {
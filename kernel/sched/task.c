@@ -6,15 +6,24 @@
 #include "util/mem.h"
 
 #include "mm/vmm.h"
-#include "mm/heap.h"
+#include "mm/slab.h"
+
+#include "boot/boot.h"
+#include "config.h"
 
 #include "types.h"
 #include "errno.h"
 
+// object cache for the task structures
+slab_cache_t task_cache = slab_cache("task", sizeof(task_t));
+
 task_t *task_new() {
-  task_t *task_new = heap_alloc(sizeof(task_t));
+  task_t *task_new = slab_alloc(&task_cache);
   int32_t err      = 0;
 
+  if (NULL == task_new)
+    return NULL;
+
   // clear the task structure
   bzero(task_new, sizeof(task_t));
 
@@ -26,7 +35,7 @@ task_t *task_new() {
   sched_debg("allocating a new stack for the new task 0x%p", task_new);
   if ((err = task_stack_alloc(task_new)) != 0) {
     sched_fail("failed to allocate a new stack for the tasK 0x%p: %s", task_new, strerror(err));
-    heap_free(task_new);
+    slab_free(task_new);
     return NULL;
   }
 
@@ -34,24 +43,83 @@ task_t *task_new() {
   return task_new;
 }
 
+/*
+
+ * kernel tasks run a kernel function in ring 0, they never touch the user VMA
+ * so they just use the current VMM, since the task area of the current VMM
+ * already belongs to the current task, their stack is mapped to the shared
+ * kernel VMA instead, kernel tasks should never return or exit
+
+*/
+task_t *task_kernel(void (*entry)()) {
+  task_t   *task  = slab_alloc(&task_cache);
+  region_t *stack = NULL;
+  int32_t   err   = 0;
+
+  if (NULL == task)
+    return NULL;
+
+  bzero(task, sizeof(task_t));
+  task->vmm = vmm_get();
+
+  if (NULL == (stack = region_new(REGION_TYPE_STACK, VMM_VMA_KERNEL, NULL, CONFIG_TASK_STACK_PAGES))) {
+    slab_free(task);
+    return NULL;
+  }
+
+  if ((err = region_map(stack)) != 0) {
+    sched_fail("failed to map the stack region for the kernel task 0x%p: %s", task, strerror(err));
+    region_free(stack);
+    slab_free(task);
+    return NULL;
+  }
+
+  task_mem_add(task, stack);
+
+  // bit 1 = reserved, 9 = interrupt enable
+  task->regs.rflags = ((1 << 1) | (1 << 9));
+  task->regs.rip    = (uint64_t)entry;
+  task->regs.cs     = gdt_offset(gdt_desc_kernel_code_addr);
+  task->regs.ss     = gdt_offset(gdt_desc_kernel_data_addr);
+
+  // stack should look like the entry function is called (return address is pushed)
+  task->regs.rsp = (uint64_t)task_stack_get(task, VMM_VMA_KERNEL) - sizeof(uint64_t);
+
+  return task;
+}
+
 task_t *task_copy() {
-  task_t   *copy = heap_alloc(sizeof(task_t));
+  task_t   *copy = slab_alloc(&task_cache);
   region_t *cur = NULL, *new = NULL;
+  void     *vmm = vmm_get();
   int32_t   err = 0;
 
+  if (NULL == copy)
+    return NULL;
+
   // clear the stack structure
   bzero(copy, sizeof(task_t));
 
   // create a new VMM for the task
   sched_debg("creating a new VMM for the task 0x%p", task_new);
-  copy->vmm = vmm_new();
+  if (NULL == (copy->vmm = vmm_new())) {
+    slab_free(copy);
+    return NULL;
+  }
+
+  /*
+
+   * copy the task's memory regions, user memory regions are shared with the
+   * copy (copy-on-write), so their pages are only copied when they are written
+   * to, kernel memory regions (kernel stack) are copied right away, since the
+   * kernel should never fault on it's own stack
 
-  // copy the task's memory regions
+  */
   for (cur = current->mem; cur != NULL; cur = cur->next) {
     // copy the memory region
-    if ((new = region_copy(cur)) == NULL) {
+    if ((new = cur->vma == VMM_VMA_USER ? region_share(cur) : region_copy(cur)) == NULL) {
       sched_fail("failed to copy the %s memory region (0x%p)", region_name(cur), cur->vaddr);
-      return NULL;
+      goto fail;
     }
 
     // add new memory region to the task
@@ -59,38 +127,77 @@ task_t *task_copy() {
     task_mem_add(copy, new);
   }
 
+  /*
+
+   * map the copied memory regions to the new VMM, the VMM keeps them mapped
+   * till they are removed, so we don't need to map them again when switching
+   * to the task, mapping is done using the recursive paging, so we temporarily
+   * switch to the new VMM (we are running on the interrupt stack, which is
+   * mapped in every VMM)
+
+  */
+  vmm_switch(copy->vmm);
+
+  for (cur = copy->mem; cur != NULL; cur = cur->next) {
+    if ((err = region_map(cur)) != 0) {
+      sched_fail("failed to map the %s memory region (0x%p): %s", region_name(cur), cur->vaddr, strerror(err));
+      break;
+    }
+  }
+
+  vmm_switch(vmm);
+
+  if (err != 0)
+    goto fail;
+
   // copy the registers
   sched_debg("copying registers from current task");
   memcpy(&copy->regs, &task_current->regs, sizeof(task_regs_t));
 
+  // copy the kernel stack pointer, copy continues from the parent's last sched() call
+  copy->ksp = task_current->ksp;
+
+  // copy the program break (heap region is already copied)
+  copy->brk = task_current->brk;
+
   // return the copied task
   return copy;
+
+fail:
+  /*
+
+   * free the VMM and the regions we copied so far, this drops the references
+   * added for the shared pages, parent's pages stay read-only till they are
+   * written to, but they are not shared anymore, so they are just made writeable
+   * again on the first write (see region_fault())
+
+  */
+  task_free(copy);
+  return NULL;
 }
 
 void task_free(task_t *task) {
   sched_debg("freeing the task 0x%p", task);
 
+  // remove the pending timers
+  timer_del(&task->timer);
+  timer_del(&task->alarm);
+
+  // free the VMM (before the memory regions, so it doesn't count the maps of the freed pages, see vmm_free())
+  vmm_free(task->vmm);
+
   // free the memory regions
-  region_each(&task->mem) {
-    sched_debg("freeing %s memory region @ 0x%p (%u pages)", region_name(cur), cur->paddr, cur->num);
-    region_free(cur);
-  }
+  slist_clear(&task->mem, region_free, region_t);
 
   // clear the signal & wait queue
   task_signal_clear(task);
   task_waitq_clear(task);
 
   // close all the files
-  for (uint8_t fd = 0; fd < CONFIG_TASK_FILES_MAX; fd++) {
-    vfs_close(task->files[fd]->node);
-    heap_free(task->files[fd]);
-  }
-
-  // free the VMM
-  vmm_free(task->vmm);
+  task_file_clear(task);
 
   // free the task structure
-  heap_free(task);
+  slab_free(task);
 }
 
 int32_t task_rename(task_t *task, const char *name) {
@@ -107,22 +214,11 @@ int32_t task_switch(task_t *task) {
   if (vmm_get() == task->vmm)
     return 0;
 
-  if (task->old) {
-    vmm_sync(task->vmm);
-    task->old = false;
-  }
-
+  // memory regions are already mapped to the task's VMM (see task_copy())
   if ((err = vmm_switch(task->vmm)) != 0) {
     sched_fail("failed to switch to the task VMM: %s", strerror(err));
     return err;
   }
 
-  region_each(&task->mem) {
-    if ((err = region_map(cur)) != 0) {
-      sched_fail("failed to map the %s memory region (0x%p)", region_name(cur), cur->vaddr);
-      return err;
-    }
-  }
-
   return 0;
 }
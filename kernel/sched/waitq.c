@@ -1,5 +1,5 @@
 #include "sched/task.h"
-#include "mm/heap.h"
+#include "mm/slab.h"
 
 #include "util/mem.h"
 #include "util/list.h"
@@ -7,12 +7,15 @@
 #include "errno.h"
 #include "types.h"
 
+// object cache for the wait queue entries
+slab_cache_t task_waitq_cache = slab_cache("task_waitq", sizeof(task_waitq_t));
+
 int32_t task_waitq_add(task_t *task, task_t *child) {
   // check the arguments
   if (NULL == task || NULL == child)
     return -EINVAL;
 
-  task_waitq_t *waitq = heap_alloc(sizeof(task_waitq_t));
+  task_waitq_t *waitq = slab_alloc(&task_waitq_cache);
 
   // check if failed to allocate the waitq object
   if (NULL == waitq)
@@ -30,7 +33,7 @@ int32_t task_waitq_add(task_t *task, task_t *child) {
   if (NULL == task->waitq_head || NULL == task->waitq_tail)
     task->waitq_head = task->waitq_tail = waitq;
   else
-    task->waitq_tail->next = waitq;
+    task->waitq_tail = task->waitq_tail->next = waitq;
 
   return 0;
 }
@@ -0,0 +1,33 @@
+#include "syscall.h"
+
+#include "sched/sched.h"
+#include "sched/task.h"
+#include "core/timer.h"
+
+#include "util/math.h"
+
+#include "types.h"
+#include "signal.h"
+
+// send SIGALRM to the task when it's alarm timer expires
+void __sys_alarm_expired(timer_t *timer) {
+  task_signal_add(timer->data, SIGALRM);
+}
+
+uint32_t sys_alarm(uint32_t seconds) {
+  timer_t *alarm = &task_current->alarm;
+  uint64_t left  = timer_left(alarm);
+
+  // cancel the previous alarm
+  timer_del(alarm);
+
+  // schedule the new alarm (if there is one)
+  if (seconds != 0) {
+    alarm->func = __sys_alarm_expired;
+    alarm->data = task_current;
+    timer_add(alarm, seconds * NSEC_PER_SEC);
+  }
+
+  // return the remaining seconds of the previous alarm
+  return div_ceil(left, NSEC_PER_SEC);
+}
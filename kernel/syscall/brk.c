@@ -0,0 +1,20 @@
+#include "syscall.h"
+
+#include "sched/sched.h"
+#include "sched/task.h"
+
+#include "types.h"
+#include "errno.h"
+
+void *sys_brk(void *brk) {
+  /*
+
+   * returns the new program break, or the current program break if it cannot
+   * be moved, so NULL can be used to get the current program break
+
+  */
+  if (NULL == brk)
+    return task_current->brk;
+
+  return task_mem_brk(task_current, brk);
+}
@@ -15,6 +15,13 @@ struct syscall syscalls[] = {
     {.code = 7, .func = sys_write},
     {.code = 8, .func = sys_mount},
     {.code = 9, .func = sys_umount},
+    {.code = 10, .func = sys_brk},
+    {.code = 11, .func = sys_mmap},
+    {.code = 12, .func = sys_munmap},
+    {.code = 13, .func = sys_mprotect},
+    {.code = 14, .func = sys_nanosleep},
+    {.code = 15, .func = sys_alarm},
+    {.code = 16, .func = sys_clock_gettime},
     {.func = NULL},
 };
 
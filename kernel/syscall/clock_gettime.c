@@ -0,0 +1,32 @@
+#include "syscall.h"
+#include "core/clock.h"
+#include "core/timer.h"
+
+#include "types.h"
+#include "errno.h"
+#include "time.h"
+
+int32_t sys_clock_gettime(clockid_t clock, struct timespec *ts) {
+  uint64_t ns = 0;
+
+  if (NULL == ts)
+    return -EINVAL;
+
+  switch (clock) {
+  case CLOCK_REALTIME:
+    ns = clock_real();
+    break;
+
+  case CLOCK_MONOTONIC:
+    ns = clock_now();
+    break;
+
+  default:
+    return -EINVAL;
+  }
+
+  ts->tv_sec  = ns / NSEC_PER_SEC;
+  ts->tv_nsec = ns % NSEC_PER_SEC;
+
+  return 0;
+}
@@ -23,9 +23,11 @@ int32_t sys_exec(char *path, char *argv[], char *envp[]) {
   region_t   *cur  = NULL;
   fmt_t       fmt;
 
-  char  **argv_copy = NULL, **envp_copy = NULL;
-  void   *stack_argv = NULL, *stack_envp = NULL;
-  int32_t err = 0;
+  char   *temp_argv[] = {path, NULL};
+  arena_t scratch     = {0};
+  void   *image       = NULL;
+  int64_t size        = 0;
+  int32_t err         = 0;
 
   // try to open the VFS node
   if ((err = vfs_open(&node, path)) != 0)
@@ -39,13 +41,19 @@ int32_t sys_exec(char *path, char *argv[], char *envp[]) {
 
   // TODO: handle shebang
 
-  // copy the arguments
-  if (NULL != argv)
-    argv_copy = charlist_copy(argv, ARG_MAX);
+  /*
+
+   * copy the arguments and the environment vars to the scratch arena, while
+   * the memory they are copied from is still mapped, the arena holds the final
+   * image of the new stack, so it's copied to the stack in one go
 
-  // copy the environment vars
-  if (NULL != envp)
-    envp_copy = charlist_copy(envp, ENV_MAX);
+   * don't allow NULL argv
+
+  */
+  if ((size = task_stack_args(current, NULL == argv ? temp_argv : argv, envp, &scratch, &image)) < 0) {
+    err = size;
+    goto end;
+  }
 
   // try to load the file using a known format
   if ((err = fmt_load(node, &fmt)) < 0) {
@@ -84,9 +92,17 @@ int32_t sys_exec(char *path, char *argv[], char *envp[]) {
   while (NULL != (cur = task_mem_find(current, REGION_TYPE_DATA, VMM_VMA_USER)))
     task_mem_del(current, cur);
 
+  // remove the old heap (program break)
+  while (NULL != (cur = task_mem_find(current, REGION_TYPE_HEAP, VMM_VMA_USER)))
+    task_mem_del(current, cur);
+
   // add the new regions from the loaded format
   task_mem_add(current, fmt.mem);
 
+  // create a new heap, if we fail, the program break just cannot be moved
+  if (task_mem_heap(current) != 0)
+    sys_debg("failed to create the heap for %s", path);
+
   // update the registers
   bzero(&current->regs, sizeof(task_regs_t));
 
@@ -122,34 +138,15 @@ int32_t sys_exec(char *path, char *argv[], char *envp[]) {
   current->regs.cs |= 3;
   current->regs.ss |= 3;
 
-  // copy the environment variables to the stack
-  if ((err = task_stack_add_list(current, envp_copy, ENV_MAX, &stack_envp)) != 0)
-    panic("Failed to copy arguments to new task stack for %s", path);
-
-  // copy the arguments to the stack
-  if (NULL != argv_copy)
-    err = task_stack_add_list(current, argv_copy, ARG_MAX, &stack_argv);
-
-  // don't allow NULL argv
-  else {
-    char *temp_argv[] = {task_current->name, NULL};
-    err               = task_stack_add_list(current, temp_argv, ARG_MAX, &stack_argv);
-  }
-
-  if (err != 0)
-    panic("Failed to copy arguments to new task stack for %s", path);
-
-  // add pointers for the argv and envp to the stack
-  task_stack_add(current, &stack_envp, sizeof(void *));
-  task_stack_add(current, &stack_argv, sizeof(void *));
+  // copy the arguments and the environment variables to the stack
+  task_stack_add(current, image, size);
 
   // call the scheduler to run as the new task
   sys_info("executing the new binary");
 
 end:
-  // free the copy of the argument and the environment list
-  charlist_free(argv_copy);
-  charlist_free(envp_copy);
+  // free the scratch arena with the copy of the argument and the environment list
+  arena_free(&scratch);
 
   /*
 
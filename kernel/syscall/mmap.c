@@ -0,0 +1,34 @@
+#include "syscall.h"
+
+#include "sched/sched.h"
+#include "sched/task.h"
+#include "mm/vmm.h"
+
+#include "mman.h"
+#include "types.h"
+#include "errno.h"
+
+int64_t sys_mmap(void *addr, uint64_t len, int32_t prot, int32_t flags) {
+  int32_t err = 0;
+
+  // PROT_* flags are the same as the memory region protection flags (see REGION_PROT_*)
+  if (len == 0 || prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))
+    return -EINVAL;
+
+  // only the private anonymous mappings are supported
+  if (flags & MAP_SHARED || !(flags & MAP_ANONYMOUS))
+    return -ENOTSUP;
+
+  if (!(flags & MAP_PRIVATE))
+    return -EINVAL;
+
+  // fixed address should be page aligned, otherwise the address is just a hint
+  if (flags & MAP_FIXED && (uint64_t)addr % PAGE_SIZE != 0)
+    return -EINVAL;
+
+  if ((err = task_mem_map(task_current, &addr, vmm_calc(len), prot, flags & MAP_FIXED)) != 0)
+    return err;
+
+  sys_debg("mapped %u pages @ 0x%p", vmm_calc(len), addr);
+  return (int64_t)addr;
+}
@@ -0,0 +1,20 @@
+#include "syscall.h"
+
+#include "sched/sched.h"
+#include "sched/task.h"
+#include "mm/vmm.h"
+
+#include "mman.h"
+#include "types.h"
+#include "errno.h"
+
+int32_t sys_mprotect(void *addr, uint64_t len, int32_t prot) {
+  if (len == 0 || (uint64_t)addr % PAGE_SIZE != 0)
+    return -EINVAL;
+
+  // PROT_* flags are the same as the memory region protection flags (see REGION_PROT_*)
+  if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))
+    return -EINVAL;
+
+  return task_mem_protect(task_current, addr, vmm_calc(len), prot);
+}
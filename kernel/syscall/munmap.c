@@ -0,0 +1,15 @@
+#include "syscall.h"
+
+#include "sched/sched.h"
+#include "sched/task.h"
+#include "mm/vmm.h"
+
+#include "types.h"
+#include "errno.h"
+
+int32_t sys_munmap(void *addr, uint64_t len) {
+  if (len == 0 || (uint64_t)addr % PAGE_SIZE != 0)
+    return -EINVAL;
+
+  return task_mem_unmap(task_current, addr, vmm_calc(len));
+}
@@ -0,0 +1,30 @@
+#include "syscall.h"
+
+#include "sched/sched.h"
+#include "core/timer.h"
+
+#include "types.h"
+#include "errno.h"
+#include "time.h"
+
+int32_t sys_nanosleep(struct timespec *req, struct timespec *rem) {
+  uint64_t ns = 0;
+
+  if (NULL == req || req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= (int64_t)NSEC_PER_SEC)
+    return -EINVAL;
+
+  // don't overflow, sleep for the max time instead
+  if ((uint64_t)req->tv_sec >= UINT64_MAX / NSEC_PER_SEC)
+    ns = UINT64_MAX;
+  else
+    ns = req->tv_sec * NSEC_PER_SEC + req->tv_nsec;
+
+  // block until the sleep timer expires
+  timer_sleep(ns);
+
+  // sleep is never interrupted, so there is no remaining time
+  if (NULL != rem)
+    rem->tv_sec = rem->tv_nsec = 0;
+
+  return 0;
+}
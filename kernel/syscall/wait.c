@@ -22,11 +22,8 @@ pid_t sys_wait(int32_t *status) {
   if (NULL == sched_child(task_current, NULL))
     return -ECHILD;
 
-  // wait for a waitq
-  while (task_waitq_is_empty(task_current)) {
-    sched_state(TASK_STATE_WAIT);
-    sched();
-  }
+  // block until a child exits (see __sched_queue_clean())
+  waitq_sleep(&task_current->wait, !task_waitq_is_empty(task_current));
 
 end:
   // get the current waitq in the queue
@@ -1,8 +1,26 @@
 #include "sched/sched.h"
 #include "util/lock.h"
 
+// tasks waiting for a spinlock to be released (shared by all the spinlocks)
+waitq_t spinlock_waitq = {NULL, NULL};
+
 void spinlock_acquire(spinlock_t *lock) {
+  uint64_t flags = 0;
+
+  // block until the lock is released, interrupts stay disabled till we take it
+  im_save(flags);
+
   while (spinlock_locked(lock))
-    sched_wait();
+    __waitq_sleep(&spinlock_waitq);
+
   __asm__("lock bts $0, (%0)" ::"r"(lock));
+  im_restore(flags);
+}
+
+void spinlock_release(spinlock_t *lock) {
+  *lock = 0;
+
+  // wake up the waiting tasks, they'll check their lock again
+  if (NULL != spinlock_waitq.head)
+    waitq_wake_all(&spinlock_waitq);
 }
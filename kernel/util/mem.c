@@ -2,8 +2,6 @@
 #include "util/printk.h"
 #include "util/string.h"
 
-#include "mm/heap.h"
-
 bool bzero(void *data, int64_t size) {
   if (NULL == data || size <= 0)
     return false;
@@ -32,45 +30,3 @@ void memswap(char *x, char *y) {
   *y ^= *x;
   *x ^= *y;
 }
-
-char **charlist_copy(char *list[], uint64_t limit) {
-  if (NULL == list)
-    return NULL;
-
-  uint64_t cur_size = 0, size = 0, count = 0;
-  char   **cur = NULL, **copy = NULL;
-
-  for (cur = list;; cur++) {
-    if (++count > limit)
-      return NULL;
-
-    if (NULL == *cur)
-      break;
-  }
-
-  copy  = heap_alloc(sizeof(char *) * count);
-  count = 0;
-
-  for (cur = list; *cur != NULL; cur++, count++) {
-    size += cur_size = strlen(*cur) + 1;
-
-    if (size > limit)
-      return NULL;
-
-    copy[count] = heap_alloc(cur_size);
-    memcpy(copy[count], *cur, cur_size);
-  }
-
-  copy[count] = NULL;
-  return copy;
-}
-
-void charlist_free(char **list) {
-  if (NULL == list)
-    return;
-
-  for (char **cur = list; *cur != NULL; cur++)
-    heap_free(*cur);
-
-  heap_free(list);
-}
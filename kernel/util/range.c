@@ -0,0 +1,185 @@
+#include "util/range.h"
+#include "types.h"
+
+/*
+
+ * range tree is a treap (binary search tree + heap), ranges are ordered
+ * by their start address, and each node has a priority that is derived
+ * from the node's address, the node with the higher priority is always
+ * placed above the ones with lower priority, which keeps the tree balanced
+ * (expected O(log n) depth) without storing any extra balancing info
+
+ * all the operations are recursive, and every node on the path is updated
+ * on the way back up, so the "max" field (largest range in the subtree)
+ * is always up-to-date
+
+*/
+
+#define __range_prio(node) (((uint64_t)(node) >> 4) * 0x9e3779b97f4a7c15)
+#define __range_max(a, b)  ((a) > (b) ? (a) : (b))
+
+void __range_update(range_t *node) {
+  node->max = node->size;
+
+  if (NULL != node->left)
+    node->max = __range_max(node->max, node->left->max);
+
+  if (NULL != node->right)
+    node->max = __range_max(node->max, node->right->max);
+}
+
+range_t *__range_rotate_right(range_t *node) {
+  range_t *left = node->left;
+
+  node->left  = left->right;
+  left->right = node;
+
+  __range_update(node);
+  __range_update(left);
+
+  return left;
+}
+
+range_t *__range_rotate_left(range_t *node) {
+  range_t *right = node->right;
+
+  node->right = right->left;
+  right->left = node;
+
+  __range_update(node);
+  __range_update(right);
+
+  return right;
+}
+
+range_t *__range_insert(range_t *root, range_t *node) {
+  if (NULL == root)
+    return node;
+
+  if (node->start < root->start) {
+    root->left = __range_insert(root->left, node);
+
+    if (__range_prio(root->left) > __range_prio(root))
+      return __range_rotate_right(root);
+  }
+
+  else {
+    root->right = __range_insert(root->right, node);
+
+    if (__range_prio(root->right) > __range_prio(root))
+      return __range_rotate_left(root);
+  }
+
+  __range_update(root);
+  return root;
+}
+
+// joins two subtrees, all the ranges in the left one should be lower
+range_t *__range_join(range_t *left, range_t *right) {
+  if (NULL == left)
+    return right;
+
+  if (NULL == right)
+    return left;
+
+  if (__range_prio(left) > __range_prio(right)) {
+    left->right = __range_join(left->right, right);
+    __range_update(left);
+    return left;
+  }
+
+  right->left = __range_join(left, right->left);
+  __range_update(right);
+  return right;
+}
+
+range_t *__range_remove(range_t *root, range_t *node) {
+  if (NULL == root)
+    return NULL;
+
+  if (root == node)
+    return __range_join(root->left, root->right);
+
+  if (node->start < root->start)
+    root->left = __range_remove(root->left, node);
+  else
+    root->right = __range_remove(root->right, node);
+
+  __range_update(root);
+  return root;
+}
+
+void range_insert(range_t **root, range_t *node) {
+  node->left = node->right = NULL;
+  node->max                = node->size;
+  *root                    = __range_insert(*root, node);
+}
+
+void range_remove(range_t **root, range_t *node) {
+  *root       = __range_remove(*root, node);
+  node->left  = node->right = NULL;
+}
+
+bool __range_fits(range_t *node, uint64_t size, uint64_t align) {
+  uint64_t start = node->start;
+
+  if (align > 1)
+    start = (start + align - 1) / align * align;
+
+  return start >= node->start && start + size <= range_end(node);
+}
+
+range_t *range_fit(range_t *root, uint64_t size, uint64_t align) {
+  range_t *found = NULL;
+
+  // none of the ranges in this subtree is large enough
+  if (NULL == root || root->max < size)
+    return NULL;
+
+  // lower addresses first
+  if (NULL != (found = range_fit(root->left, size, align)))
+    return found;
+
+  if (__range_fits(root, size, align))
+    return root;
+
+  return range_fit(root->right, size, align);
+}
+
+range_t *range_floor(range_t *root, uint64_t addr) {
+  range_t *found = NULL;
+
+  while (NULL != root) {
+    if (root->start > addr)
+      root = root->left;
+
+    else {
+      found = root;
+      root  = root->right;
+    }
+  }
+
+  return found;
+}
+
+range_t *range_ceil(range_t *root, uint64_t addr) {
+  range_t *found = NULL;
+
+  while (NULL != root) {
+    if (root->start < addr)
+      root = root->right;
+
+    else {
+      found = root;
+      root  = root->left;
+    }
+  }
+
+  return found;
+}
+
+uint64_t range_count(range_t *root) {
+  if (NULL == root)
+    return 0;
+  return 1 + range_count(root->left) + range_count(root->right);
+}
@@ -0,0 +1,83 @@
+#include <types.h>
+#include <sys.h>
+
+/*
+
+ * fork+exec+wait microbenchmark, it measures the average cost (in cycles) of
+ * forking, and waiting for the child to exit, both when the child exits right
+ * away, and when the child executes a new program (this program, which exits
+ * right away when it's ran as the child)
+
+ * results are written to the first serial port, it's ran by init if the
+ * benchmarks are enabled in the configuration
+
+*/
+
+#define BENCH_ROUNDS (100)
+#define BENCH_PATH   "/bin/bench"
+#define BENCH_DEV    "/dev"
+#define BENCH_OUTPUT "/dev/com1"
+
+uint64_t bench_rdtsc() {
+  uint32_t low = 0, high = 0;
+  __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+// write the message and the number to the output
+void bench_print(int32_t fd, char *msg, uint64_t num) {
+  char     buf[21];
+  uint64_t len = 0, pos = sizeof(buf);
+
+  for (; msg[len] != 0; len++)
+    ;
+
+  do {
+    buf[--pos] = '0' + num % 10;
+  } while ((num /= 10) != 0);
+
+  write(fd, msg, len);
+  write(fd, &buf[pos], sizeof(buf) - pos);
+  write(fd, " cycles\n", 8);
+}
+
+uint64_t bench_run(bool exec_child) {
+  char    *argv[] = {"bench", "child", NULL};
+  uint64_t total = 0, start = 0;
+  int32_t  status = 0;
+  pid_t    pid    = 0;
+
+  for (uint64_t i = 0; i < BENCH_ROUNDS; i++) {
+    start = bench_rdtsc();
+
+    if ((pid = fork()) == 0)
+      exit(exec_child ? exec(BENCH_PATH, argv, NULL) : 0);
+
+    if (pid < 0 || wait(&status) < 0)
+      return 0;
+
+    total += bench_rdtsc() - start;
+  }
+
+  return total / BENCH_ROUNDS;
+}
+
+int main(int argc, char *argv[]) {
+  int32_t fd = 0;
+
+  // we are the child, just exit
+  if (argc > 1)
+    return 0;
+
+  // mount the devfs to access the serial port (it may be already mounted)
+  mount(NULL, BENCH_DEV, "DEVFS", 0);
+
+  if ((fd = open(BENCH_OUTPUT, 0, 0)) < 0)
+    return 1;
+
+  bench_print(fd, "fork+exit+wait: ", bench_run(false));
+  bench_print(fd, "fork+exec+wait: ", bench_run(true));
+
+  close(fd);
+  return 0;
+}
@@ -1,6 +1,16 @@
+#include <config.h>
 #include <types.h>
 #include <sys.h>
 
 int main(int argc, char *argv[]) {
+  int32_t status = 0;
+
+  // run the fork+exec+wait benchmark (if enabled)
+  if (CONFIG_BENCH) {
+    if (fork() == 0)
+      exit(exec("/bin/bench", NULL, NULL));
+    wait(&status);
+  }
+
   return 0;
 }
@@ -1,4 +1,6 @@
 #include "types.h"
+#include "mman.h"
+#include "time.h"
 
 // syscall function (see sys.S)
 extern uint64_t syscall(uint64_t num, ...);
@@ -14,3 +16,16 @@ int64_t        read(int32_t fd, void *buf, uint64_t size);
 int64_t        write(int32_t fd, void *buf, uint64_t size);
 int32_t        mount(char *source, char *target, char *filesystem, int32_t flags);
 int32_t        umount(char *target);
+
+// memory management syscalls (see sys.c), mmap() returns a negative error number on failure
+void   *sys_brk(void *addr);
+int32_t brk(void *addr);
+void   *sbrk(int64_t inc);
+void   *mmap(void *addr, uint64_t len, int32_t prot, int32_t flags);
+int32_t munmap(void *addr, uint64_t len);
+int32_t mprotect(void *addr, uint64_t len, int32_t prot);
+
+// timer syscalls (see sys.c)
+int32_t  nanosleep(struct timespec *req, struct timespec *rem);
+uint32_t alarm(uint32_t seconds);
+int32_t  clock_gettime(clockid_t clock, struct timespec *ts);
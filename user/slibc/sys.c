@@ -1,4 +1,5 @@
 #include "sys.h"
+#include "errno.h"
 
 void exit(int32_t code) {
   syscall(0, code);
@@ -42,3 +43,44 @@ int32_t mount(char *source, char *target, char *filesystem, int32_t flags) {
 int32_t umount(char *target) {
   return syscall(9, target);
 }
+
+void *sys_brk(void *addr) {
+  return (void *)syscall(10, addr);
+}
+
+int32_t brk(void *addr) {
+  return sys_brk(addr) == addr ? 0 : -ENOMEM;
+}
+
+void *sbrk(int64_t inc) {
+  void *cur = sys_brk(NULL);
+
+  if (inc != 0 && sys_brk(cur + inc) != cur + inc)
+    return (void *)-1;
+
+  return cur;
+}
+
+void *mmap(void *addr, uint64_t len, int32_t prot, int32_t flags) {
+  return (void *)syscall(11, addr, len, prot, flags);
+}
+
+int32_t munmap(void *addr, uint64_t len) {
+  return syscall(12, addr, len);
+}
+
+int32_t mprotect(void *addr, uint64_t len, int32_t prot) {
+  return syscall(13, addr, len, prot);
+}
+
+int32_t nanosleep(struct timespec *req, struct timespec *rem) {
+  return syscall(14, req, rem);
+}
+
+uint32_t alarm(uint32_t seconds) {
+  return syscall(15, seconds);
+}
+
+int32_t clock_gettime(clockid_t clock, struct timespec *ts) {
+  return syscall(16, clock, ts);
+}